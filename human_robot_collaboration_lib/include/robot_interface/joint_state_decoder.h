@@ -0,0 +1,138 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#ifndef __JOINT_STATE_DECODER_H__
+#define __JOINT_STATE_DECODER_H__
+
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <string>
+
+#include <sensor_msgs/JointState.h>
+
+#define NUM_JOINTS 7
+
+/**
+ * Decodes the joint states of one or more limbs from a sensor_msgs::JointState.
+ * Rather than matching the names of the joints on every message, the index of
+ * every joint in the message is resolved once, in a single pass for all the
+ * limbs, and reused as long as the layout of the message does not change.
+ * The layout of a limb is only replaced by a message that carries all of its
+ * joints, so that messages with none or part of them (e.g. the ones coming
+ * from the grippers) do not force a new resolution at the next full message.
+ * The limbs share the same /robot/joint_states topic, and hence the same
+ * decoder (see RobotInterface::jnts_decoder).
+ */
+class JointStateDecoder
+{
+private:
+    /**
+     * Layout of a limb (i.e. where its joints are in the message)
+     */
+    struct LimbLayout
+    {
+        std::array<std::string, NUM_JOINTS> names;  // Names of the joints (_j0 to _j6)
+        std::array<size_t,      NUM_JOINTS>   idx;  // Index of each joint in the message
+        bool                                   ok;  // True if all the joints have been found
+
+        // Scratch space to resolve the layout (see resolveLayout())
+        std::array<size_t,      NUM_JOINTS> found;  // Index of each joint found in the message
+        size_t                          num_found;  // Number of joints found in the message
+    };
+
+    std::mutex                             mtx;     // Mutex to protect the layout
+
+    std::map<std::string, LimbLayout>    limbs;     // Layouts of the registered limbs
+
+    // Lookup table from joint name to limb layout and joint number, used to
+    // resolve the layout of all the limbs in a single pass over the message
+    std::unordered_map<std::string, std::pair<LimbLayout*, size_t> > lookup;
+
+    unsigned long               num_resolves;       // Number of times a layout has been replaced
+
+    /**
+     * Registers a limb without locking the mutex (see addLimb()).
+     *
+     * @param  _limb the limb
+     * @return       true/false if success/failure (i.e. if it was already registered)
+     */
+    bool registerLimb(const std::string& _limb);
+
+    /**
+     * Checks if the layout of a limb is valid for the message, i.e. if the names
+     * of the joints are where they were when the layout was resolved.
+     * Only NUM_JOINTS names are compared, instead of the whole message.
+     *
+     * @param  _msg    the message
+     * @param  _layout the layout of the limb
+     * @return         true/false if valid/invalid
+     */
+    bool isLayoutValid(const sensor_msgs::JointState& _msg, const LimbLayout& _layout);
+
+    /**
+     * Resolves the layout of all the registered limbs from the names in the message.
+     * Only the limbs whose joints are all in the message get a new layout, the others
+     * keep their current one. It does not allocate memory.
+     *
+     * @param _msg the message
+     */
+    void resolveLayout(const sensor_msgs::JointState& _msg);
+
+public:
+    /**
+     * Constructor
+     */
+    JointStateDecoder();
+
+    /**
+     * Registers a limb to the decoder. The joints of the limb are expected to
+     * be called <limb>_j0 to <limb>_j6. Its layout is resolved at the first
+     * message that carries all of them.
+     *
+     * @param  _limb the limb
+     * @return       true/false if success/failure (i.e. if it was already registered)
+     */
+    bool addLimb(const std::string& _limb);
+
+    /**
+     * Decodes the joint positions and velocities of a limb from the message.
+     * If the limb has not been registered yet, it will be registered first.
+     * Velocities that are not in the message are set to 0.
+     *
+     * @param  _msg  the message
+     * @param  _limb the limb
+     * @param  _pos  the joint positions (ordered from _j0 to _j6)
+     * @param  _vel  the joint velocities (ordered from _j0 to _j6)
+     * @return       true/false if the message carries all the joints of the limb or not
+     */
+    bool decode(const sensor_msgs::JointState& _msg, const std::string& _limb,
+                std::array<double, NUM_JOINTS>& _pos,
+                std::array<double, NUM_JOINTS>& _vel);
+
+    /**
+     * Returns the number of times the layout of a limb has been replaced
+     * (for diagnostics, since it should change only if the publisher does)
+     */
+    unsigned long getNumResolves();
+
+    /**
+     * Destructor
+     */
+    ~JointStateDecoder();
+};
+
+#endif
@@ -16,9 +16,11 @@
 #ifndef __ROBOT_INTERFACE_H__
 #define __ROBOT_INTERFACE_H__
 
+#include <array>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 #include "gtest/gtest_prod.h"
 
@@ -43,12 +45,63 @@
 
 #include "robot_utils/particle_thread.h"
 #include "robot_utils/hiro_trac_ik.h"
+#include "robot_utils/seqlock.h"
+#include "robot_utils/rt_loop.h"
+#include "robot_interface/joint_state_decoder.h"
 
 #include <human_robot_collaboration_msgs/GoToPose.h>
 #include <human_robot_collaboration_msgs/ArmState.h>
 
 #include <tf/transform_listener.h>
 
+/**
+ * Snapshot of the state of the robot, as received by the callbacks. Every part
+ * of it is stamped with the time it was received. It does not own any dynamic
+ * memory, so that it can be shared with the control threads through a SeqLock.
+ */
+struct RobotState
+{
+    /**
+     * End-effector state
+     */
+    ros::Time              endpt_stamp;
+    std::array<double, 3>          pos; // Position    (x, y, z)
+    std::array<double, 4>          ori; // Orientation (x, y, z, w)
+    std::array<double, 3>        force; // Force  of the wrench
+    std::array<double, 3>       torque; // Torque of the wrench
+    std::array<double, 3>   filt_force; // Filtered force (see filterForces())
+
+    /**
+     * Joint States, in the same order of the joint names (i.e. _j0 to _j6)
+     */
+    ros::Time                        jnts_stamp;
+    bool                                jnts_ok; // True if the joint states have been received
+    std::array<double, NUM_JOINTS>     jnts_pos;
+    std::array<double, NUM_JOINTS>     jnts_vel;
+
+    /**
+     * IR Sensor
+     */
+    ros::Time   ir_stamp;
+    bool           ir_ok;
+    double         range;
+    double     min_range;
+    double     max_range;
+
+    /**
+     * Collision avoidance and collision detection states
+     */
+    ros::Time  coll_av_stamp;
+    bool       is_coll_av_on;
+    ros::Time coll_det_stamp;
+    bool      is_coll_det_on;
+
+    /**
+     * Constructor (everything is initialized to zero)
+     */
+    RobotState();
+};
+
 /**
  * @brief A ROS Thread class
  * @details This class initializes overhead ROS features: subscriber/publishers,
@@ -74,14 +127,30 @@ private:
     ros::Publisher  joint_cmd_pub; // Publisher to control the robot in joint space
     ros::Publisher    coll_av_pub; // Publisher to suppress collision avoidance behavior
 
+    std::vector<std::string>        jnt_names; // Names of the joints of the limb (built once)
+    intera_core_msgs::JointCommandPtr jnt_cmd; // Joint command, preallocated and reused at every cycle
+    std::mutex                    mtx_jnt_cmd; // Mutex to protect the joint command
+
+    /**
+     * State of the robot (end-effector, joints, IR sensor, collision states).
+     * It is written by the callbacks, and read without locks by the control threads.
+     */
+    SeqLock<RobotState> robot_state;
+
+    /**
+     * Motion updates. Blocking motions (e.g. goToPose) wait on cv_motion, which is
+     * signalled every time the endpoint or collision avoidance states are updated,
+     * rather than polling the state of the robot.
+     */
+    std::mutex               mtx_motion; // Mutex to protect the motion update counter
+    std::condition_variable   cv_motion; // Signalled at every motion update
+    unsigned long            motion_seq; // Number of motion updates received so far
+    double            cmd_keepalive_rate; // [Hz] Rate at which blocking motions republish their commands
+
     /**
      * IR Sensor
      */
     ros::Subscriber ir_sub;
-    bool             ir_ok;
-    double      curr_range;
-    double  curr_min_range;
-    double  curr_max_range;
 
     /**
      * Inverse Kinematics
@@ -89,6 +158,9 @@ private:
     // Default: TRAC IK
     hiroTracIK ik_solver;
 
+    // Time of the last successful IK solve (to know if its warm start is stale)
+    ros::Time time_last_ik;
+
     // Alternative IK: baxter-provided IK solver (for the TTT demo)
     bool             use_trac_ik;
     ros::ServiceClient ik_client;
@@ -96,6 +168,18 @@ private:
     // Rate [Hz] of the control loop. Default 100Hz.
     double ctrl_freq;
 
+    /**
+     * Real-time mode of the control loop (see RTLoop). If enabled, the control loop
+     * runs with absolute deadlines, and its timing statistics are published on the
+     * /<name>/<limb>/ctrl_stats topic.
+     */
+    bool                  rt_ctrl; // Flag to know if the control loop runs in real-time mode
+    int               rt_priority; // SCHED_FIFO priority of the control loop (0 to not change it)
+    int                    rt_cpu; // CPU to pin the control loop to (-1 to not pin it)
+    RTLoop              ctrl_loop; // Real-time control loop
+    ros::Publisher ctrl_stats_pub; // Publisher of the timing statistics of the control loop
+    ros::Timer   ctrl_stats_timer; // Timer to publish the timing statistics of the control loop
+
     /**
      * End-effector state
      */
@@ -107,28 +191,24 @@ private:
     double               rel_force_thres; // relative threshold for force interaction
     double                 filt_variance; // variance threshold for force filter
 
-    geometry_msgs::Point        curr_pos;
-    geometry_msgs::Quaternion   curr_ori;
-    geometry_msgs::Wrench    curr_wrench;
-
     /**
      * Joint States
      */
     ros::Subscriber         jntstate_sub;
-    sensor_msgs::JointState    curr_jnts;
-    std::mutex                  mtx_jnts;   // Mutex to protect joint state variable
+
+    // Decoder of the joint states, shared by all the limbs since
+    // they are subscribed to the same topic (/robot/joint_states)
+    static JointStateDecoder jnts_decoder;
 
     /**
      * Collision avoidance State
      */
     ros::Subscriber coll_av_sub;
-    bool          is_coll_av_on;
 
     /**
      * Collision Detection State
      */
     ros::Subscriber coll_det_sub;
-    bool          is_coll_det_on;
 
     /**
      * Cuff buttons
@@ -151,6 +231,7 @@ private:
     std::mutex  mtx_ctrl;   // Mutex to protect the is_ctrl_running flag
     bool is_experimental;   // Flag to know if the robot is running in experimental mode
     bool ctrl_track_mode;   // Flag to know the tracking mode of the control loop
+    bool use_inline_traj;   // Flag to know if the trajectory is evaluated within the control loop
 
     // Control mode for the controller server. It can be either
     // human_robot_collaboration_msgs::GoToPose::POSITION_MODE,
@@ -198,13 +279,20 @@ private:
      */
     void ThreadEntry();
 
+    /**
+     * Callback to publish the timing statistics of the control loop
+     * (only if the control loop runs in real-time mode).
+     */
+    void publishCtrlStatsCb(const ros::TimerEvent&);
+
     /**
      * Publishes the desired joint configuration in the proper topic, i.e.
-     * /robot/limb/" + limb + "/joint_command"
+     * /robot/limb/" + limb + "/joint_command". The message is published by
+     * pointer, so that intra-process subscribers receive it without copies.
      *
      * @param _cmd The desired joint configuration
      */
-    void publishJointCmd(intera_core_msgs::JointCommand _cmd);
+    void publishJointCmd(const intera_core_msgs::JointCommandConstPtr& _cmd);
 
     /*
      * Callback function that sets the current pose to the pose received from
@@ -266,8 +354,10 @@ protected:
     // Publisher that publishes the current target on rviz
     RVIZPublisher   rviz_pub;
 
-    // Particle thread to control the end effector over time
-    std::unique_ptr<ParticleThread> particle;
+    // Particle thread to control the end effector over time. If use_inline_traj
+    // is true, its thread is never started: the particle is evaluated by the
+    // control loop, and it is reused for every new target.
+    std::unique_ptr<ParticleThread<3> > particle;
 
     // Publisher to publish the high-level state of the controller
     // (to be shown in the Baxter display)
@@ -408,7 +498,7 @@ protected:
      * @param  _mode   (strict/loose) the desired level of precision
      * @return         true/false if success/failure
      */
-    bool isConfigurationReached(Eigen::VectorXd _dj, std::string _mode = "loose");
+    bool isConfigurationReached(const Eigen::VectorXd& _dj, const std::string& _mode = "loose");
 
     /*
      * Checks if the arm has reached its intended joint configuration by comparing
@@ -418,7 +508,18 @@ protected:
      * @param  _mode   (strict/loose) the desired level of precision
      * @return         true/false if success/failure
      */
-    bool isConfigurationReached(intera_core_msgs::JointCommand _dj, std::string _mode = "loose");
+    bool isConfigurationReached(const intera_core_msgs::JointCommand& _dj,
+                                const std::string& _mode = "loose");
+
+    /*
+     * Checks if a single joint has reached its intended position
+     *
+     * @param  _des    requested joint position
+     * @param  _curr   current joint position
+     * @param  _mode   (strict/loose) the desired level of precision
+     * @return         true/false if the joint has reached the position or not
+     */
+    bool isJointReached(double _des, double _curr, const std::string& _mode);
 
     /*
      * Uses IK solver to find joint angles solution for desired pose
@@ -480,7 +581,9 @@ protected:
                                  double ox, double oy, double oz, double ow);
 
     /*
-     * Moves arm to the requested pose , and checks if the pose has been achieved
+     * Moves arm to the requested pose , and checks if the pose has been achieved.
+     * The check is driven by the endpoint state callback, and the joint command
+     * is republished at the keep-alive rate of the robot (cmd_keepalive_rate).
      *
      * @param  requested pose (3D position + 4D quaternion for the orientation)
      * @param  mode (either loose or strict, it checks for the final desired position)
@@ -492,22 +595,24 @@ protected:
 
     /**
      * Moves arm to the requested joint configuration, without checking if the configuration
-     * has been reached or not.
+     * has been reached or not. The joint command is preallocated, and only its payload
+     * is updated here.
      *
      * @param  joint_values requested joint configuration
      * @return              true/false if success/failure
      */
-    bool goToJointConfNoCheck(Eigen::VectorXd joint_values);
+    bool goToJointConfNoCheck(const Eigen::VectorXd& joint_values);
 
     /*
-     * Sets the joint names of a JointCommand
+     * Sets the joint names of a JointCommand (they are formatted only once per limb)
      *
      * @param    joint_cmd the joint command
      */
     void setJointNames(intera_core_msgs::JointCommand& joint_cmd);
 
     /*
-     * Sets the joint commands of a JointCommand
+     * Sets the joint commands of a JointCommand. Any previous command is overwritten,
+     * so that the same JointCommand can be reused without reallocations.
      *
      * @param        s0 First  shoulder joint
      * @param        s1 Second shoulder joint
@@ -554,8 +659,27 @@ protected:
 
     /*
      * Filters the forces using a low pass filter and testing against predicted trends in filter values
+     *
+     * @param _force the force just received by the endpoint state callback
      */
-    void filterForces();
+    void filterForces(const geometry_msgs::Vector3& _force);
+
+    /**
+     * Notifies any blocking motion that the state of the robot has been updated.
+     * It is called by the endpoint and collision avoidance callbacks.
+     */
+    void notifyMotionUpdate();
+
+    /**
+     * Waits until a new motion update is received (see notifyMotionUpdate),
+     * or until a timeout expires.
+     *
+     * @param  _seq     the number of the last motion update seen by the caller.
+     *                  It is set to the number of the latest motion update.
+     * @param  _timeout the maximum time to wait for, in [s]
+     * @return          true/false if a new motion update has been received or not
+     */
+    bool waitForMotionUpdate(unsigned long& _seq, double _timeout);
 
     /**
      * @brief Suppresses the collision avoidance for this arm
@@ -600,6 +724,7 @@ protected:
      * Let's add a number of friend tests to test the private methods of this class (without ROS).
      */
     FRIEND_TEST(RobotInterfaceTest, testPrivateMethods);
+    FRIEND_TEST(RobotInterfaceTest, testJointCommands);
 
 public:
     RobotInterface(std::string          _name, std::string                   _limb,
@@ -625,6 +750,15 @@ public:
      */
     void setTracIK(bool _use_trac_ik);
 
+    /**
+     * Sets if the trajectory of the cartesian controller is evaluated within
+     * the control loop (true), or by a separate particle thread (false).
+     * It takes effect from the next target.
+     *
+     * @param _use_inline_traj if to evaluate the trajectory inline or not
+     */
+    void setInlineTraj(bool _use_inline_traj);
+
     /**
      * Set the type of the cartesian controller server.
      * @param  _ctrl_type control type (pose, position or orientation)
@@ -651,6 +785,7 @@ public:
     bool      useTracIK() { return     use_trac_ik; };
     bool    useCartCtrl() { return   use_cart_ctrl; };
     bool isExperimental() { return is_experimental; };
+    bool   useInlineTraj() { return use_inline_traj; };
 
     std::string      getName() { return           name; };
     std::string      getLimb() { return           limb; };
@@ -658,14 +793,21 @@ public:
     double       getCtrlFreq() { return      ctrl_freq; };
     std::string  getCtrlType() { return      ctrl_type; };
     int          getCtrlMode() { return      ctrl_mode; };
-    double      getCurrRange() { return     curr_range; };
-    double   getCurrMinRange() { return curr_min_range; };
-    double   getCurrMaxRange() { return curr_max_range; };
+    double      getCurrRange() { return robot_state.get().range;     };
+    double   getCurrMinRange() { return robot_state.get().min_range; };
+    double   getCurrMaxRange() { return robot_state.get().max_range; };
 
+    /**
+     * Returns a consistent snapshot of the full state of the robot. It does
+     * not lock nor allocate, so it is safe to be used in the control loops.
+     *
+     * @return the state of the robot
+     */
+    RobotState   getRobotState() { return robot_state.get(); };
 
-    geometry_msgs::Point        getPos()         { return    curr_pos; };
-    geometry_msgs::Quaternion   getOri()         { return    curr_ori; };
-    geometry_msgs::Wrench       getWrench()      { return curr_wrench; };
+    geometry_msgs::Point        getPos();
+    geometry_msgs::Quaternion   getOri();
+    geometry_msgs::Wrench       getWrench();
 
     sensor_msgs::JointState     getJointStates();
     geometry_msgs::Pose                getPose();
@@ -680,7 +822,7 @@ public:
     /*
      * Check availability of the infrared data
     */
-    bool    isIRok() { return ir_ok; };
+    bool    isIRok() { return robot_state.get().ir_ok; };
 
     /**
      * Safely manipulate the boolean needed to kill the thread entry
@@ -0,0 +1,128 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#ifndef __BLOB_EXTRACTION_H__
+#define __BLOB_EXTRACTION_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Connected blob of a binary image, as found by BlobExtractor
+ */
+struct Blob
+{
+    int       area;     // Number of pixels of the blob
+    cv::Rect  bbox;     // Bounding box of the blob
+};
+
+/**
+ * Extracts the 8-connected blobs of a binary image in a single pass. Every row is
+ * run-length encoded, and runs that touch a run of the previous row are merged
+ * with a union-find, so that the cost scales with the number of runs rather than
+ * with the number of pixels. The area and the bounding box of every blob are
+ * accumulated while resolving the runs, and the endpoints of the runs are the
+ * only candidates for the convex hull of a blob (so, e.g., cv::minAreaRect on
+ * them gives the same result as on the contour of the blob).
+ *
+ * The binary image can be either a mask, or a bit of a labeled image (see hsvLabeler),
+ * in which case there is no need to extract the mask first. All the buffers are reused
+ * across calls, so an extractor should be kept alive (one per thread) and reused.
+ */
+class BlobExtractor
+{
+private:
+    struct Run
+    {
+        int              y;     // Row of the run
+        int        x_start;     // First column of the run
+        int          x_end;     // Last column of the run (included)
+        int           blob;     // Index of the blob the run belongs to
+    };
+
+    std::vector<Run>           runs;    // Runs of the image, sorted by row and column
+    std::vector<int>        parents;    // Union-find forest of the runs
+    std::vector<Blob>         blobs;    // Blobs of the image
+    std::vector<cv::Point> hull_pts;    // Buffer for the candidates of the convex hull
+
+    /**
+     * Finds the root of a run in the union-find forest (with path halving)
+     */
+    int findRoot(int _run);
+
+    /**
+     * Run-length encodes an image, merging the runs that touch each other,
+     * and resolves the runs into blobs
+     *
+     * @param _src  the image (T is uchar for masks, or uint32_t for labeled images)
+     * @param _bits the bits that a pixel should have set to be part of a blob
+     */
+    template<typename T>
+    void extractRuns(const cv::Mat& _src, T _bits);
+
+public:
+    /* CONSTRUCTOR */
+    BlobExtractor() {};
+
+    /**
+     * Extracts the blobs of a binary mask (i.e. of its non-zero pixels)
+     *
+     * @param _mask the mask (CV_8UC1)
+     */
+    void extract(const cv::Mat& _mask);
+
+    /**
+     * Extracts the blobs of a color range of a labeled image (see hsvLabeler)
+     *
+     * @param _labels the labeled image (CV_32SC1)
+     * @param _idx    the index of the color range
+     */
+    void extract(const cv::Mat& _labels, int _idx);
+
+    /**
+     * Counts the blobs that are bigger than an area threshold
+     *
+     * @param  _min_area the area threshold [px]
+     * @return           the number of blobs
+     */
+    size_t countBlobs(int _min_area) const;
+
+    /**
+     * Draws the blobs that are bigger than an area threshold. Nothing else is
+     * changed, so multiple objects can be drawn into the same image.
+     *
+     * @param _min_area the area threshold [px]
+     * @param _dst      the image to draw into (CV_8UC1, same size as the source image)
+     */
+    void draw(int _min_area, cv::Mat& _dst) const;
+
+    /**
+     * Gets the candidates for the convex hull of the blobs that are bigger than
+     * an area threshold, i.e. of the union of those blobs (see cv::minAreaRect)
+     *
+     * @param  _min_area the area threshold [px]
+     * @param  _offset   offset to add to the points (e.g. if the image is a ROI)
+     * @return           the points (valid until the next call)
+     */
+    const std::vector<cv::Point>& getHullPoints(int _min_area,
+                                                const cv::Point& _offset = cv::Point(0, 0));
+
+    /* GETTERS */
+    const std::vector<Blob>& getBlobs() const { return blobs; };
+};
+
+#endif // __BLOB_EXTRACTION_H__
@@ -22,15 +22,51 @@
 #include <tf/transform_listener.h>
 #include <tf/transform_broadcaster.h>
 
+#include <condition_variable>
+#include <memory>
+
 #include <opencv2/opencv.hpp>
 
+#include <aruco/aruco.h>
 #include <aruco/cameraparameters.h>
+#include <aruco/cvdrawingutils.h>
 #include <aruco_ros/aruco_ros_utils.h>
 #include <aruco_msgs/MarkerArray.h>
 
 #include "robot_utils/ros_thread_image.h"
+#include "robot_utils/thread_pool.h"
+
+#include "robot_perception/blob_extraction.h"
+#include "robot_perception/scratch_arena.h"
 
 #define AREA_THRES  50      // px
+#define ROI_MARGIN  40      // px
+#define ROI_REFRESH 30      // frames
+#define PYR_MAX_LEVELS  2   // Maximum number of levels of the pyramid (i.e. 1/4 scale)
+#define PYR_MARGIN      8   // px
+#define TF_TIMEOUT   0.05   // [s] Maximum time to wait for the camera transform at every frame
+#define MARKER_SIZE  0.05   // [m] Default size of the ArUco markers
+
+/**
+ * Snapshot of what is needed to draw a segmented object, i.e. its name, its
+ * rotated rectangle and its pose with respect to the camera.
+ */
+struct SegmentedObjSnapshot
+{
+    std::string          name;
+    cv::RotatedRect      rect;
+    cv::Matx33d           rot;
+    cv::Vec3d            tran;
+
+    /**
+     * Draws the object (its 3D axis, its bounding box and its name)
+     *
+     * @param _img      the image to draw onto
+     * @param _cam_mat  the camera matrix
+     * @param _dist_mat the distortion coefficients
+     */
+    void draw(cv::Mat &_img, const cv::Mat& _cam_mat, const cv::Mat& _dist_mat) const;
+};
 
 /**
  * Generic class for representing a segmented object. It is a virtual class,
@@ -45,6 +81,35 @@ private:
     // Flag to know if the object is there or not
     bool is_there;
 
+    // Tracking mode: once the object is found, the next frames are searched only in a
+    // region of interest (ROI) around its last position, inflated by a motion margin.
+    // The whole frame is searched again if the object is lost, or every roi_refresh frames.
+    bool roi_tracking;  // Flag to enable the tracking mode
+    int    roi_margin;  // [px] Margin to inflate the last bounding box of the object with
+    int   roi_refresh;  // Number of frames after which a full-frame search is forced
+    int    roi_frames;  // Number of frames since the last full-frame search
+
+    // Pyramid mode: the whole image is searched at a coarser scale (1/2^pyr_levels) to find
+    // candidate blobs, and the object is then detected at full resolution only around them
+    int    pyr_levels;  // Number of levels of the pyramid (0 to disable the pyramid mode)
+
+    // True if the pose has been estimated in the previous frame, in which case
+    // it is used as a guess for the pose in the current one
+    bool     has_pose;
+
+    /**
+     * Gets the region of the full-resolution image around the blobs extracted
+     * from the coarse image (see getCoarseROI)
+     *
+     * @param _pyr_levels the level of the pyramid the blobs have been extracted at
+     */
+    bool getCoarseROIFromBlobs(int _pyr_levels, const cv::Size& _img_size, cv::Rect& _roi);
+
+protected:
+    // Connected components of the last binary image of the object. An object is
+    // processed by a single task at a time, so it is safe to keep it per object
+    BlobExtractor blobs;
+
 public:
     // ID of the object
     int id;
@@ -58,8 +123,9 @@ public:
     // Segmented objects as a rotated rectangle
     cv::RotatedRect     rect;
 
-    // Rotation and translation matrices with respect to the camera
-    cv::Mat Rvec, Tvec;
+    // Rotation matrix and translation vector with respect to the camera
+    cv::Matx33d  rot;
+    cv::Vec3d   tran;
 
     // Pose of the object in the root reference frame
     geometry_msgs::Pose pose;
@@ -92,6 +158,64 @@ public:
      */
     virtual bool detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres);
 
+    /**
+     * Detects the object in the image, using the scratch buffers of the calling thread
+     * instead of allocating its own. By default, the buffers are not used.
+     *
+     * @param _in        Input image to detect objects from
+     * @param _out       Output image to show the result of the segmentation
+     * @param _out_thres Optional output image to show the thresholded image
+     * @param _arena     Scratch buffers of the calling thread (reserved for the size of _in)
+     *
+     * @return true/false if success/failure
+     */
+    virtual bool detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres,
+                              ScratchArena& _arena);
+
+    /**
+     * Gets the region of the image in which to search for the object. If the tracking
+     * mode is enabled and the object has been found in the previous frame, it is
+     * its last bounding box inflated by roi_margin (and clipped to the image),
+     * otherwise (or if a periodic refresh is due) it is the whole image.
+     *
+     * @param _img_size the size of the image
+     * @param _roi      the region of the image to search into
+     *
+     * @return true/false if the region is a ROI or the whole image
+     */
+    bool getSearchROI(const cv::Size& _img_size, cv::Rect& _roi);
+
+    /**
+     * Gets the region of the full-resolution image in which to detect the object from a
+     * binary image of the object at the coarse scale of the pyramid. Blobs that are smaller
+     * than the (scaled) area threshold are discarded, and the region is the bounding box of the
+     * remaining ones, scaled back to full resolution and inflated by PYR_MARGIN.
+     *
+     * @param _coarse_mask Binary image of the object at the coarse scale
+     * @param _img_size    the size of the full-resolution image
+     * @param _roi         the region of the full-resolution image to search into
+     *
+     * @return true/false if there are candidate blobs or not
+     */
+    bool getCoarseROI(const cv::Mat& _coarse_mask, const cv::Size& _img_size, cv::Rect& _roi);
+
+    /**
+     * Same as getCoarseROI, but straight from a labeled image at the coarse scale
+     * (see hsvLabeler), without extracting the binary image of the object first.
+     * Since the labeled image is shared by all the objects, its level of the pyramid
+     * is the one of whoever labeled it, and not the one of the object.
+     *
+     * @param _coarse_labels Labeled image at the coarse scale (CV_32SC1)
+     * @param _idx           the index of the label of the object
+     * @param _pyr_levels    the level of the pyramid of the labeled image
+     * @param _img_size      the size of the full-resolution image
+     * @param _roi           the region of the full-resolution image to search into
+     *
+     * @return true/false if there are candidate blobs or not
+     */
+    bool getCoarseROI(const cv::Mat& _coarse_labels, int _idx, int _pyr_levels,
+                      const cv::Size& _img_size, cv::Rect& _roi);
+
     /**
      * Draws a box in the image where the object is located
      *
@@ -139,6 +263,14 @@ public:
     bool draw(cv::Mat &_img, const cv::Mat& _cam_mat,
                              const cv::Mat& _dist_mat);
 
+    /**
+     * Copies what is needed to draw the object into a snapshot. The storage
+     * of the snapshot is reused, so that it can be refilled at every frame.
+     *
+     * @param _snap the snapshot to fill
+     */
+    void snapshot(SegmentedObjSnapshot& _snap) const;
+
     /**
      * Converts the segmented object to a string.
      * @return the segmented object as a string
@@ -147,14 +279,107 @@ public:
     virtual operator std::string();
 
     /* GETTERS */
-    bool isThere()        { return is_there; };
-    std::string getName() { return     name; };
+    bool isThere()        { return     is_there; };
+    std::string getName() { return         name; };
+    bool getROITracking() { return roi_tracking; };
+    int  getPyrLevels()   { return   pyr_levels; };
+    bool hasPose()        { return     has_pose; };
 
     /* SETTERS */
     void setIsThere(bool _it)           { is_there = _it; };
     void setName(const std::string &_s) {     name =  _s; };
+    void setHasPose(bool _hp)           { has_pose = _hp; };
+
+    /**
+     * Sets the tracking mode
+     *
+     * @param _roi_tracking true/false to enable/disable it
+     * @param _roi_margin   [px] margin to inflate the last bounding box of the object with
+     * @param _roi_refresh  number of frames after which a full-frame search is forced
+     */
+    void setROITracking(bool _roi_tracking, int _roi_margin  = ROI_MARGIN,
+                                            int _roi_refresh = ROI_REFRESH);
+
+    /**
+     * Sets the number of levels of the pyramid mode
+     *
+     * @param _pyr_levels the number of levels, in [0, PYR_MAX_LEVELS] (0 to disable it)
+     */
+    void setPyrLevels(int _pyr_levels);
 };
 
+/**
+ * Detects a set of objects in the same image in parallel, one task per object.
+ * The input image is shared (read-only) by all the tasks, while every worker adds
+ * the blobs it detects to its own thresholded image, so that no locks are needed.
+ * The per-worker images are merged into _out_thres at the end. Since _out is
+ * shared among the tasks, objects should not draw into it while detecting.
+ *
+ * @param _objs         the objects to detect
+ * @param _pool         the thread pool to run the tasks
+ * @param _in           Input image to detect objects from
+ * @param _out          Output image to show the result of the segmentation
+ * @param _out_thres    Output image to show the thresholded image (CV_8UC1)
+ * @param _worker_thres Per-worker thresholded images (reused across calls)
+ * @param _arenas       Per-worker scratch buffers (reused across calls)
+ *
+ * @return true/false if all the objects have been detected or not
+ */
+bool detectObjectsParallel(const std::vector<SegmentedObj*>& _objs, ThreadPool& _pool,
+                           const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres,
+                           std::vector<cv::Mat>& _worker_thres,
+                           std::vector<ScratchArena>& _arenas);
+
+/**
+ * Reserves the per-worker scratch buffers at the beginning of a frame
+ * (they are reallocated only if the size of the image has changed)
+ *
+ * @param _arenas      the per-worker scratch buffers
+ * @param _num_workers the number of workers
+ * @param _size        the size of the image
+ */
+void reserveArenas(std::vector<ScratchArena>& _arenas, size_t _num_workers, cv::Size _size);
+
+/**
+ * Resets the per-worker thresholded images at the beginning of a frame
+ *
+ * @param _worker_thres the per-worker thresholded images
+ * @param _num_workers  the number of workers
+ * @param _size         the size of the thresholded image
+ */
+void resetWorkerThres(std::vector<cv::Mat>& _worker_thres, size_t _num_workers, cv::Size _size);
+
+/**
+ * Merges the per-worker thresholded images into the output one at the end of a frame
+ *
+ * @param _worker_thres the per-worker thresholded images
+ * @param _out_thres    the output thresholded image
+ */
+void mergeWorkerThres(const std::vector<cv::Mat>& _worker_thres, cv::Mat& _out_thres);
+
+/**
+ * Estimates the pose of a planar rectangle with respect to the camera in closed form,
+ * by decomposing the homography between its plane and the (rectified) image plane.
+ * Only fixed-size matrices are used, so nothing is allocated on the heap.
+ * The rectangle is centered in the origin of its RF, and its corners are ordered as
+ * (-w/2,-h/2), (-w/2,+h/2), (+w/2,+h/2), (+w/2,-h/2). Since a rectangle is symmetric,
+ * the same pose rotated by 180 deg around its normal fits the corners equally well:
+ * if a guess is given (i.e. the pose of the previous frame), the closest one is chosen.
+ *
+ * @param _img_pts   the corners of the rectangle in the image [px]
+ * @param _w         the width of the rectangle [m]
+ * @param _h         the height of the rectangle [m]
+ * @param _cam_mat   the camera matrix
+ * @param _rot       the rotation of the rectangle (also the guess, if _use_guess is true)
+ * @param _tran      the translation of the rectangle [m]
+ * @param _use_guess true/false to use _rot as a guess or not
+ *
+ * @return true/false if success/failure (i.e. if the corners are degenerate)
+ */
+bool planarRectPose(const cv::Point2f _img_pts[4], double _w, double _h,
+                    const cv::Matx33d& _cam_mat, cv::Matx33d& _rot, cv::Vec3d& _tran,
+                    bool _use_guess = false);
+
 /**
  * Generic helper class to estimate the cartesian position of a blob in the camera
  * reference frame (RF) and project it into any other RF (usually the base RF).
@@ -178,9 +403,44 @@ private:
     // Camera parameters
     aruco::CameraParameters cam_param;
 
+    // Camera matrix, as a fixed-size matrix for the pose estimation
+    cv::Matx33d cam_mat;
+
     // Transform listener to convert reference frames
     tf::TransformListener tfListener_;
 
+    // Transform broadcaster to send the poses of the objects (one for the whole estimator)
+    tf::TransformBroadcaster tfBroadcaster_;
+
+    // Transform from the camera frame to the reference frame. It is resolved once per frame
+    // at the time the image has been captured (or only once if the camera is static),
+    // and it is then shared by all the objects detected in the frame
+    tf::StampedTransform cameraToReference;
+    bool                 is_cam2ref_valid;  // True if cameraToReference has been resolved
+
+    // Transforms of the objects (one slot per object), that are
+    // sent in a single batch at the end of every frame
+    std::vector<tf::StampedTransform>  obj_tfs;
+    std::vector<tf::StampedTransform> send_tfs;
+
+    // Drawing stage: the debug image is drawn and published by a separate, low-priority
+    // thread, and only if somebody subscribed to it, so that it never delays the
+    // detection of the objects and the publishing of their poses
+    std::thread                draw_thread;
+    std::mutex                    mtx_draw;     // Mutex to protect the frame to draw
+    std::condition_variable        cv_draw;     // Signals the drawing thread that a frame is ready
+    bool                      draw_pending;     // True if a new frame is ready to be drawn
+    bool                      draw_closing;     // Flag to close the drawing thread
+    cv_bridge::CvImageConstPtr    draw_img;     // Frame to draw on (shared with the ROS message)
+    std::vector<SegmentedObjSnapshot> draw_objs;  // Snapshots of the objects detected in the frame
+    size_t                   num_draw_objs;     // Number of valid snapshots in draw_objs
+    std::vector<aruco::Marker> draw_markers;     // Snapshot of the markers detected in the frame
+
+    // ArUco stage (see use_aruco): the markers are detected in the same frame as the objects
+    aruco::MarkerDetector           aruco_detector;
+    std::vector<aruco::Marker>       aruco_markers;    // Markers detected in the current frame
+    std::vector<geometry_msgs::Pose>   aruco_poses;    // Their poses in the reference frame
+
     /** EXTERNAL PARAMETERS **/
     // Name of the reference frame to transform the camera poses to
     std::string reference_frame;
@@ -188,19 +448,42 @@ private:
     // Name of the camera frame to refer the object poses to
     std::string camera_frame;
 
+    // If the camera is statically mounted with respect to the reference frame,
+    // in which case the transform between them is resolved only once
+    bool static_camera;
+
     // Minimum area threshold in pixel for an object to be considered valid.
     // Used to avoid having erroneous detections due to noise or whatnot.
     int area_threshold;
 
+    // If ArUco markers are detected together with the objects, and published in the same
+    // array, in place of running a separate aruco_ros marker_publisher on the same camera
+    bool use_aruco;
+
+    // Physical size of the ArUco markers [m]
+    double marker_size;
+
     /**
-     * [getTransform description]
-     * @param  refFrame   [description]
-     * @param  childFrame [description]
-     * @param  transform  [description]
+     * Gets the transform between two frames at a given time. It waits at most
+     * TF_TIMEOUT for the transform to become available.
+     *
+     * @param  refFrame   the frame to transform to
+     * @param  childFrame the frame to transform from
+     * @param  stamp      the time of the transform
+     * @param  transform  the transform
      * @return            true/false if success/failure
      */
-    bool getTransform(const std::string& refFrame,
-                      const std::string& childFrame, tf::StampedTransform& transform);
+    bool getTransform(const std::string& refFrame, const std::string& childFrame,
+                      const ros::Time& stamp, tf::StampedTransform& transform);
+
+    /**
+     * Resolves the transform from the camera frame to the reference frame for the current
+     * frame. If it is not available, the last one is used (if there is any).
+     *
+     * @param  _stamp the time the current image has been captured at
+     * @return        true/false if success/failure
+     */
+    bool updateCameraToReference(const ros::Time& _stamp);
 
     /**
      * Converts the detected object's pose into a TF transform object
@@ -212,17 +495,74 @@ private:
     tf::Transform object2Tf(int idx);
 
     /**
-     * Publishes the array of objects on the proper topic
+     * Detects the ArUco markers in the image. It is the same image the objects are
+     * detected in, so that every frame is received and decoded only once for both.
+     *
+     * @param  _in the input image
+     * @return     true/false if success/failure
+     */
+    bool detectMarkers(const cv::Mat& _in);
+
+    /**
+     * Calculates the poses of the detected ArUco markers in the root frame, given
+     * the transform of the current frame (see updateCameraToReference)
+     */
+    void poseMarkersRootRF();
+
+    /**
+     * Publishes the array of objects on the proper topic, followed by
+     * the ArUco markers (if they are detected, see use_aruco)
+     *
+     * @param _stamp the time of the image the objects have been detected in
+     *               (if zero, the current time is used)
      *
      * @return true/false if success/failure
      */
-    bool publishObjects();
+    bool publishObjects(const ros::Time& _stamp);
+
+    /**
+     * Hands a frame over to the drawing thread, together with a snapshot of the
+     * objects detected in it. If the drawing thread is still busy with the previous
+     * frame, the frame that is waiting to be drawn (if any) is replaced.
+     *
+     * @param _img the frame the objects have been detected in
+     */
+    void queueDraw(const cv_bridge::CvImageConstPtr& _img);
+
+    /**
+     * Function that is run by the drawing thread
+     */
+    void drawThread();
 
 protected:
 
     // Vector of segmented objects to track
     std::vector<SegmentedObj*>  objs;
 
+    // Tracking mode of the objects (see SegmentedObj::getSearchROI)
+    bool roi_tracking;
+    int    roi_margin;
+    int   roi_refresh;
+
+    // Pyramid mode of the objects (see SegmentedObj::getCoarseROI)
+    int    pyr_levels;
+
+    // Number of workers to detect the objects in parallel
+    // (0 to do everything in the thread of the estimator)
+    int num_workers;
+
+    // Thread pool to detect the objects in parallel
+    std::unique_ptr<ThreadPool> pool;
+
+    // Per-worker thresholded images, merged into the output one at the end of every frame
+    std::vector<cv::Mat> worker_thres;
+
+    // Per-worker scratch buffers, so that the steady-state loop does not allocate
+    std::vector<ScratchArena> arenas;
+
+    // Thresholded image of all the objects, reused across frames
+    cv::Mat img_thres;
+
     /*
      * Function that will be spun out as a thread
      */
@@ -268,10 +608,27 @@ protected:
     bool addObjects(XmlRpc::XmlRpcValue _params);
 
     /**
-     * Detects the object in the image
+     * Detects the objects in the image, and publishes the thresholded image
+     *
+     * @param _in        Input image to detect objects from
+     * @param _out       Output image to show the result of the segmentation
+     *
+     * @return true/false if success/failure
      */
     bool detectObjects(const cv::Mat& _in, cv::Mat& _out);
 
+    /**
+     * Detects the objects in the image. By default, every object detects itself
+     * independently, but derived classes can do it jointly for all the objects.
+     *
+     * @param _in        Input image to detect objects from
+     * @param _out       Output image to show the result of the segmentation
+     * @param _out_thres Output image to show the thresholded image
+     *
+     * @return true/false if success/failure
+     */
+    virtual bool detectObjects(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres);
+
     /**
      * Prints the object database to screen.
      */
@@ -286,6 +643,7 @@ protected:
     /**
      * Calculates the cartesian pose of the segmented object in the camera frame
      * given the rotated bounding box, the camera parameters and the real physical size of the object.
+     * If the object has been seen in the previous frame, its pose is used as a guess.
      *
      * @param idx the object's index
      *
@@ -295,31 +653,39 @@ protected:
 
     /**
      * Projects the cartesian pose of the segmented object from the camera frame to the root frame,
-     * given the kinematics of the robot, and the pose in the camera frame
+     * given the transform of the current frame (see updateCameraToReference), and the pose
+     * in the camera frame. The resulting transform is stored to be sent with the others.
      *
-     * @param idx the object's index
+     * @param idx    the object's index
+     * @param _stamp the time the current image has been captured at
      *
      * @return true/false if success/failure
      */
-    bool cameraRFtoRootRF(int idx);
+    bool cameraRFtoRootRF(int idx, const ros::Time& _stamp);
 
     /**
-     * Calculates the cartesian pose of all the segmented objects in the root frame
+     * Calculates the cartesian pose of all the segmented objects in the root frame.
+     * The transforms of all the objects are then broadcast in a single batch.
+     * Objects whose pose cannot be estimated are marked as not there for this frame.
+     * The poses of the ArUco markers (if any) are computed as well.
      *
-     * @return true/false if success/failure
+     * @param _stamp the time the current image has been captured at
+     *
+     * @return true/false if success/failure (i.e. if the camera transform is available)
      */
-    bool poseRootRF();
+    bool poseRootRF(const ros::Time& _stamp);
 
     /**
      * Calculates the cartesian pose of the segmented object in the root frame
      * given the rotated bounding box, the camera parameters, the real physical
      * size of the object, and the kinematics of the robot
      *
-     * @param idx the object's index
+     * @param idx    the object's index
+     * @param _stamp the time the current image has been captured at
      *
      * @return true/false if success/failure
      */
-    bool poseRootRF(int idx);
+    bool poseRootRF(int idx, const ros::Time& _stamp);
 
     /**
      * Draws all objects in the image where they are located
@@ -366,6 +732,7 @@ public:
 
     /** GETTERS **/
     int getAreaThreshold() { return area_threshold; };
+    int getNumWorkers()    { return    num_workers; };
 
     /** SETTERS **/
 
@@ -19,8 +19,27 @@
 #include "robot_perception/hsv_detection.h"
 #include "robot_perception/cartesian_estimator.h"
 
+#define MORPH_ERODE_ITERATIONS   2   // Erosions before (and after) the dilations
+#define MORPH_DILATE_ITERATIONS  4   // Dilations in between the erosions
+
 class SegmentedObjHSV: public SegmentedObj
 {
+private:
+    // If true, the binary image of the object is cleaned up with morphological operations
+    // before extracting its blobs. Without them, noise is discarded by the area threshold.
+    bool morphology;
+
+    /**
+     * Detects the object from the blobs just extracted by the BlobExtractor. Blobs that are
+     * smaller than the area threshold are discarded, and the remaining ones are merged.
+     *
+     * @param _out_thres Output image where the detected blobs are added
+     * @param _offset    Offset of the blobs in the full image, if they come from a ROI of it
+     *
+     * @return true/false if the object has been detected or not
+     */
+    bool detectObjectFromBlobs(cv::Mat& _out_thres, const cv::Point& _offset);
+
 public:
 
     // Color of the object to segment
@@ -55,6 +74,80 @@ public:
      */
     bool detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres);
 
+    /**
+     * Detects the object in the image, using the scratch buffers of the calling thread
+     *
+     * @param _in        Input image to detect objects from
+     * @param _out       Output image to show the result of the segmentation
+     * @param _out_thres Optional output image to show the thresholded image
+     * @param _arena     Scratch buffers of the calling thread (reserved for the size of _in)
+     *
+     * @return true/false if success/failure
+     */
+    bool detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres,
+                      ScratchArena& _arena);
+
+    /**
+     * Detects the object in a region of the image
+     *
+     * @param _in        Input image to detect objects from
+     * @param _roi       Region of the image to search into
+     * @param _out_thres Output image to show the thresholded image (same size as _in)
+     * @param _arena     Scratch buffers of the calling thread (reserved for the size of _in)
+     *
+     * @return true/false if the object has been detected or not
+     */
+    bool detectObjectInROI(const cv::Mat& _in, const cv::Rect& _roi, cv::Mat& _out_thres,
+                           ScratchArena& _arena);
+
+    /**
+     * Finds the region of the image in which to detect the object when searching the
+     * whole image. In the pyramid mode, the image is thresholded at a coarser scale,
+     * and the region is the one around the candidate blobs (see getCoarseROI),
+     * otherwise it is the whole image.
+     *
+     * @param _in    Input image to detect objects from
+     * @param _roi   Region of the image to search into
+     * @param _arena Scratch buffers of the calling thread (reserved for the size of _in)
+     *
+     * @return true/false if there are candidate blobs or not
+     */
+    bool findCandidateROI(const cv::Mat& _in, cv::Rect& _roi, ScratchArena& _arena);
+
+    /**
+     * Detects the object from a binary image of the pixels that match its color,
+     * after the morphological operations (if any). Blobs that are smaller than the area
+     * threshold are discarded, and the remaining ones are merged together.
+     *
+     * @param _mask      Binary image of the object
+     * @param _out_thres Output image where the detected blobs are added (same size as _mask)
+     * @param _offset    Offset of the mask in the full image, if the mask is a ROI of it
+     *
+     * @return true/false if the object has been detected or not
+     */
+    bool detectObjectFromMask(const cv::Mat& _mask, cv::Mat& _out_thres,
+                              const cv::Point& _offset = cv::Point(0, 0));
+
+    /**
+     * Same as detectObjectFromMask, but straight from a labeled image (see hsvLabeler),
+     * without extracting the binary image of the object first.
+     *
+     * @param _labels    Labeled image (CV_32SC1)
+     * @param _idx       the index of the label of the object
+     * @param _out_thres Output image where the detected blobs are added (same size as _labels)
+     * @param _offset    Offset of the labels in the full image, if they are a ROI of it
+     *
+     * @return true/false if the object has been detected or not
+     */
+    bool detectObjectFromLabels(const cv::Mat& _labels, int _idx, cv::Mat& _out_thres,
+                                const cv::Point& _offset = cv::Point(0, 0));
+
+    /* GETTERS */
+    bool getMorphology()            { return  morphology; };
+
+    /* SETTERS */
+    void setMorphology(bool _m)     { morphology =    _m; };
+
     /**
      * Converts the segmented object to a string.
      * @return the segmented object as a string
@@ -63,12 +156,89 @@ public:
     operator std::string();
 };
 
+/**
+ * Parameters and buffers to detect a set of HSV objects all at once (see detectObjectsHSV).
+ * The buffers are shared by all the objects, and reused across frames.
+ */
+struct hsvLabeling
+{
+    // Number of levels of the pyramid (0 to disable the pyramid mode, see SegmentedObj)
+    int pyr_levels;
+
+    // If true, the image is labeled straight from BGR through a lookup table (see hsvLabeler),
+    // which skips the HSV conversion at the expense of 16MB of memory every 8 objects
+    bool use_bgr_lut;
+
+    // If true, the labels are cleaned up with morphological operations before extracting
+    // the blobs of the objects (see SegmentedObjHSV::setMorphology)
+    bool use_morphology;
+
+    // Labelers that threshold all the objects in a single pass
+    // (one every HSV_MAX_LABELS objects, since every object is a bit of the label)
+    std::vector<hsvLabeler>   labelers;
+    std::vector<hsvColorRange> obj_cols;    // Color ranges of the objects to label
+
+    cv::Mat img_hsv;        // Input image, converted to HSV
+    cv::Mat img_labels;     // Labeled image
+    cv::Mat img_tmp;        // Temporary buffer for the morphological operations
+
+    cv::Mat img_coarse;     // Input image, at the coarse scale of the pyramid
+
+    /* CONSTRUCTOR */
+    hsvLabeling() : pyr_levels(0), use_bgr_lut(true), use_morphology(false) {};
+};
+
+/**
+ * Sets the color ranges of a set of objects into the labelers of an hsvLabeling,
+ * one labeler every HSV_MAX_LABELS objects. Objects that are not HSV objects get an
+ * empty color range. The lookup tables are rebuilt only if the color ranges have changed.
+ * If use_bgr_lut is set, the BGR lookup tables are built here as well, so this should be
+ * called whenever the objects change rather than waiting for the first frame.
+ *
+ * @param _objs     the objects to detect
+ * @param _labeling the labeling to set the color ranges into
+ *
+ * @return true/false if success/failure
+ */
+bool setLabelingColors(const std::vector<SegmentedObj*>& _objs, hsvLabeling& _labeling);
+
+/**
+ * Detects a set of HSV objects in the same image all at once. The image is converted
+ * to HSV only once (or not at all, if use_bgr_lut is set), it is labeled against
+ * the colors of all the objects in a single pass,
+ * and the morphological operations (if any) are done on all the labels together.
+ * The cost of a frame thus scales with the number of pixels, and not with
+ * the number of pixels times the number of objects. The blobs of the
+ * single objects are then extracted from the labels in parallel by the thread pool.
+ * In the pyramid mode, all of this is done at a coarser scale, and only
+ * the regions around the candidate blobs are processed at full resolution.
+ * Objects that are not HSV objects are skipped.
+ *
+ * @param _objs         the objects to detect
+ * @param _pool         the thread pool to extract the blobs of the objects
+ * @param _in           Input image to detect objects from
+ * @param _out_thres    Output image to show the thresholded image (CV_8UC1)
+ * @param _worker_thres Per-worker thresholded images (reused across calls)
+ * @param _arenas       Per-worker scratch buffers (reused across calls)
+ * @param _labeling     the parameters and the shared buffers (reused across calls)
+ *
+ * @return true/false if all the objects have been detected or not
+ */
+bool detectObjectsHSV(const std::vector<SegmentedObj*>& _objs, ThreadPool& _pool,
+                      const cv::Mat& _in, cv::Mat& _out_thres,
+                      std::vector<cv::Mat>& _worker_thres,
+                      std::vector<ScratchArena>& _arenas, hsvLabeling& _labeling);
+
 /**
  * Class that is able to detect objects from a range of HSV colors that
  * define their color.
  */
 class CartesianEstimatorHSV : public CartesianEstimator
 {
+private:
+    // Parameters and buffers to detect all the objects at once
+    hsvLabeling labeling;
+
 protected:
 
     /**
@@ -114,9 +284,15 @@ protected:
     bool addObjects(XmlRpc::XmlRpcValue _params);
 
     /**
-     * Detects the object in the image
+     * Detects all the objects in the image at once (see detectObjectsHSV)
+     *
+     * @param _in        Input image to detect objects from
+     * @param _out       Output image to show the result of the segmentation
+     * @param _out_thres Output image to show the thresholded image
+     *
+     * @return true/false if success/failure
      */
-    bool detectObjects(const cv::Mat& _in, cv::Mat& _out) { return false; };
+    bool detectObjects(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres);
 
 
 public:
@@ -16,11 +16,33 @@
 #ifndef __CLIENT_TEMPLATE__
 #define __CLIENT_TEMPLATE__
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+
 #include <ros/ros.h>
 #include <ros/console.h>
+#include <geometry_msgs/Pose.h>
 
 #include "robot_utils/utils.h"
 
+#define PERCEPTION_TIMEOUT      3.0     // [s] Default time to wait for data from perception
+#define PERCEPTION_WARN_TIME    0.2     // [s] Time after which a warning is issued while waiting
+#define PERCEPTION_WAIT_SLICE    10     // [ms] Wall time after which ROS time is checked while waiting
+
+/**
+ * Latest observation of an object, as received from the perception node
+ */
+struct ObjectObservation
+{
+    ros::Time              stamp; // Time of the observation
+    geometry_msgs::Pose     pose; // Pose of the object
+    double            confidence; // Confidence of the detection
+
+    ObjectObservation() : confidence(0.0) {};
+};
+
 /**
  * Base class for deriving a generic perception client that reads information from a
  * variety of sources. Needs to be specialized. ARucoClient and CartesianEstimatorClient
@@ -33,6 +55,7 @@ protected:
     std::string     limb; // Limb of the gripper: left or right
     ros::Subscriber  sub; // Subscriber to the topic that sends perception information
 
+    // Flags signalled by the callback, and waited upon through cv_obs (all protected by mtx_obs)
     bool         is_ok; // Bool to check if the Client is fine or not
     bool objects_found; // Bool to check if there are any objects detected
     bool  object_found; // Bool to check if the selected object was found or not
@@ -41,15 +64,26 @@ protected:
     geometry_msgs::Point        curr_object_pos;
     geometry_msgs::Quaternion   curr_object_ori;
 
-    std::vector<T> available_objects; // List of available objects
     T                      object_id; // ID of the object to detect
 
+    // Latest observation of every object ever seen, keyed by its id
+    std::unordered_map<T, ObjectObservation> observations;
+
+    std::vector<T> available_objects; // Objects visible in the last message (i.e. at last_obs_stamp)
+    ros::Time         last_obs_stamp; // Time of the last message with any object in it
+
+    std::mutex               mtx_obs; // Mutex to protect the observations and the flags
+    std::condition_variable   cv_obs; // Signals the waiting threads that new data arrived
+
+    double                ct_timeout; // [s] Time to wait for data from perception
+
     /**
      * Resets the cartesian estimator state in order to wait for
      * fresh, new data from the topic
      */
     void reset()
     {
+        std::lock_guard<std::mutex> lck(mtx_obs);
         is_ok = false;
     };
 
@@ -59,6 +93,7 @@ protected:
      */
     void clearObjFound()
     {
+        std::lock_guard<std::mutex> lck(mtx_obs);
         object_found = false;
     };
 
@@ -68,116 +103,205 @@ protected:
      */
     void clearObjsFound()
     {
-        objects_found = false;
+        std::lock_guard<std::mutex> lck(mtx_obs);
 
+        objects_found = false;
         available_objects.clear();
     };
 
-protected:
-    // Print level to be used throughout the code
-    int ct_print_level;
+    /**
+     * Signals the threads waiting for data that a new message has been received.
+     * To be called by the callback of the derived classes, at the end of every message.
+     *
+     * @param _objs_found if there are any objects in the message
+     * @param _obj_found  if the selected object is in the message
+     */
+    void notifyData(bool _objs_found, bool _obj_found)
+    {
+        {
+            std::lock_guard<std::mutex> lck(mtx_obs);
+
+            is_ok = true;
+            if (_objs_found)    { objects_found = true; }
+            if (_obj_found)     {  object_found = true; }
+        }
+
+        cv_obs.notify_all();
+    };
 
     /**
-     * Waits to get feedback from the perception node.
+     * Waits for a flag to be set by the callback, or for the timeout to expire.
+     * It returns as soon as the flag is set, since the callback wakes it up.
+     * The timeout follows ROS time (i.e. it honors /use_sim_time), which a condition
+     * variable cannot wait upon: the wait is thus split into slices of PERCEPTION_WAIT_SLICE
+     * of wall time, after each of which ROS time is checked against the timeout.
      *
-     * @return true/false if success/failure
+     * @param  _flag the flag to wait for
+     * @param  _warn the warning to issue if the flag is not set within PERCEPTION_WARN_TIME
+     * @param  _err  the error to issue if the flag is not set within the timeout
+     * @return       true/false if the flag has been set or not
      */
-    bool waitForOK()
+    bool waitForFlag(const bool& _flag, const std::string& _warn, const std::string& _err)
     {
-        reset();
+        std::unique_lock<std::mutex> lck(mtx_obs);
 
-        int cnt=0;
-        ros::Rate r(10);
+        ros::Time start = ros::Time::now();
+        ros::Time warn  = start + ros::Duration(PERCEPTION_WARN_TIME);
+        ros::Time end   = start + ros::Duration(ct_timeout);
 
-        while (!is_ok)
+        bool warned = false;
+
+        while (not _flag)
         {
-            ROS_WARN_COND(cnt>1, "No callback from perception. Is perception running?");
-            ++cnt;
+            ros::Time now = ros::Time::now();
 
-            if (cnt == OBJ_NOT_FOUND_NUM_ATTEMPTS)
+            if (now >= end)
             {
-                ROS_ERROR("No callback from perception! Stopping.");
+                ROS_ERROR("%s", _err.c_str());
                 return false;
             }
 
-            r.sleep();
+            if (not warned && now >= warn)
+            {
+                ROS_WARN_COND(not _warn.empty(), "%s", _warn.c_str());
+                warned = true;
+            }
+
+            cv_obs.wait_for(lck, std::chrono::milliseconds(PERCEPTION_WAIT_SLICE));
         }
 
         return true;
     };
 
     /**
-     * Waits to see if there are any objects detected
+     * Starts a new set of visible objects (i.e. a new message with objects in it).
+     * The table of observations is not cleared, so that objects that are not
+     * visible any more can still be looked up (see isObjectSeen()). A message
+     * older than the last one (i.e. a late message) does not start a new set.
      *
-     * @return true/false if success/failure
+     * @param _stamp the time of the message
+     * @return       true/false if a new set has been started or not
      */
-    bool waitForObjsFound()
+    bool clearAvailableObjects(const ros::Time& _stamp)
     {
-        clearObjsFound();
+        std::lock_guard<std::mutex> lck(mtx_obs);
 
-        int cnt=0;
-        ros::Rate r(10);
+        if (_stamp < last_obs_stamp)    { return false; }
 
-        while (!objects_found)
-        {
-            ROS_WARN_COND(ct_print_level>0 && cnt>1, "Objects not found. Are there any the objects there?");
-            ++cnt;
+        available_objects.clear();
+        last_obs_stamp = _stamp;
 
-            if (cnt == OBJ_NOT_FOUND_NUM_ATTEMPTS)
-            {
-                ROS_ERROR("Objects not found! Stopping.");
-                return false;
-            }
+        return true;
+    };
 
-            r.sleep();
-        }
+    /**
+     * Updates the latest observation of an object, and adds the object to the set of
+     * visible objects if the observation belongs to the last message. Observations
+     * older than the latest one of the object (i.e. from a late message) are discarded.
+     *
+     * @param _id         the id of the object
+     * @param _pose       its pose
+     * @param _confidence the confidence of the detection
+     * @param _stamp      the time of the observation
+     * @return            true/false if the observation is the latest one or not
+     */
+    bool addObservation(const T& _id, const geometry_msgs::Pose& _pose,
+                        double _confidence, const ros::Time& _stamp)
+    {
+        std::lock_guard<std::mutex> lck(mtx_obs);
+
+        ObjectObservation& obs = observations[_id];
+
+        if (_stamp < obs.stamp)    { return false; }
+
+        obs.stamp      =      _stamp;
+        obs.pose       =       _pose;
+        obs.confidence = _confidence;
+
+        if (_stamp == last_obs_stamp)    { available_objects.push_back(_id); }
 
         return true;
     };
 
+protected:
+    // Print level to be used throughout the code
+    int ct_print_level;
+
     /**
-     * Waits to see if the desired object has been detected
+     * Waits to get feedback from the perception node.
      *
      * @return true/false if success/failure
      */
-    bool waitForObjFound()
+    bool waitForOK()
     {
-        clearObjFound();
-
-        int cnt=0;
-        ros::Rate r(10);
+        reset();
 
-        while (!object_found)
-        {
-            ROS_WARN_COND(ct_print_level>0 && cnt>0, "Object not found. Is the object there?");
+        return waitForFlag(is_ok, "No callback from perception. Is perception running?",
+                                  "No callback from perception! Stopping.");
+    };
 
-            ++cnt;
+    /**
+     * Waits to see if there are any objects detected
+     *
+     * @return true/false if success/failure
+     */
+    bool waitForObjsFound()
+    {
+        clearObjsFound();
 
-            if (cnt == OBJ_NOT_FOUND_NUM_ATTEMPTS)
-            {
-                ROS_ERROR("Object not found! Stopping.");
-                return false;
-            }
+        return waitForFlag(objects_found, ct_print_level>0?
+                           "Objects not found. Are there any the objects there?" : "",
+                           "Objects not found! Stopping.");
+    };
 
-            r.sleep();
-        }
+    /**
+     * Waits to see if the desired object has been detected
+     *
+     * @return true/false if success/failure
+     */
+    bool waitForObjFound()
+    {
+        clearObjFound();
 
-        return true;
+        return waitForFlag(object_found, ct_print_level>0?
+                           "Object not found. Is the object there?" : "",
+                           "Object not found! Stopping.");
     };
 
     /**
      * Waits for useful data coming from the perception node. It performs
-     * all the wait* functions declared above (i.e. waitForOK(),
-     * waitForObjsFound() and waitForObjFound())
+     * all the checks of the wait* functions declared above (i.e. waitForOK(),
+     * waitForObjsFound() and waitForObjFound()), but the flags are cleared
+     * only once, so that a single message can satisfy all of them.
      * @return true/false if success/failure
      */
     bool waitForData()
     {
         ROS_INFO("[%s] Waiting for data from perception..", getClientLimb().c_str());
 
-        if (!waitForOK())        return false;
-        if (!waitForObjsFound()) return false;
-        if (!waitForObjFound())  return false;
+        reset();
+        clearObjsFound();
+        clearObjFound();
+
+        if (!waitForFlag(is_ok, "No callback from perception. Is perception running?",
+                                "No callback from perception! Stopping."))
+        {
+            return false;
+        }
+
+        if (!waitForFlag(objects_found, ct_print_level>0?
+                         "Objects not found. Are there any the objects there?" : "",
+                         "Objects not found! Stopping."))
+        {
+            return false;
+        }
+
+        if (!waitForFlag(object_found, ct_print_level>0?
+                         "Object not found. Is the object there?" : "",
+                         "Object not found! Stopping."))
+        {
+            return false;
+        }
 
         return true;
     };
@@ -187,7 +311,11 @@ protected:
      *
      * @return true/false if feedback from the perception is received
     */
-    bool isOK() { return   is_ok; };
+    bool isOK()
+    {
+        std::lock_guard<std::mutex> lck(mtx_obs);
+        return is_ok;
+    };
 
     /* GETTERS */
     geometry_msgs::Point      getObjectPos() { return curr_object_pos; };
@@ -199,11 +327,33 @@ protected:
     /* SETTERS */
     void setObjectID(T _id) { object_id = _id; };
 
+    /**
+     * Sets the time to wait for data from perception (for each of the wait* functions)
+     *
+     * @param _timeout the timeout, in [s]
+     */
+    void setPerceptionTimeout(double _timeout) { ct_timeout = _timeout; };
+
     /**
      * Returns a list of available markers
      * @return a list of available markers
      */
-    std::vector<T> getAvailableObjects() { return available_objects; };
+    std::vector<T> getAvailableObjects()
+    {
+        std::lock_guard<std::mutex> lck(mtx_obs);
+        return available_objects;
+    };
+
+    /**
+     * Copies the list of available markers into a vector, reusing its memory
+     *
+     * @param _objects the list of available markers
+     */
+    void getVisibleObjects(std::vector<T>& _objects)
+    {
+        std::lock_guard<std::mutex> lck(mtx_obs);
+        _objects.assign(available_objects.begin(), available_objects.end());
+    };
 
     /**
      * Looks if a set of markers is present among those available.
@@ -211,14 +361,18 @@ protected:
      */
     std::vector<T> getAvailableObjects(std::vector<T> _objects)
     {
+        std::lock_guard<std::mutex> lck(mtx_obs);
+
         std::vector<T> res;
 
         for (size_t i = 0; i < _objects.size(); ++i)
         {
-            if(std::find(available_objects.begin(), available_objects.end(),
-                                    _objects[i]) != available_objects.end())
+            // An object is available if it was seen in the last message
+            auto it = observations.find(_objects[i]);
+
+            if (it != observations.end() && not available_objects.empty() &&
+                it->second.stamp == last_obs_stamp)
             {
-                /* available_objects contains _objects[i] */
                 res.push_back(_objects[i]);
             }
         }
@@ -226,15 +380,53 @@ protected:
         return res;
     };
 
+    /**
+     * Gets the latest observation of an object
+     *
+     * @param  _id  the id of the object
+     * @param  _obs its latest observation
+     * @return      true/false if the object has ever been seen or not
+     */
+    bool getObservation(const T& _id, ObjectObservation& _obs)
+    {
+        std::lock_guard<std::mutex> lck(mtx_obs);
+
+        auto it = observations.find(_id);
+
+        if (it == observations.end())    { return false; }
+
+        _obs = it->second;
+        return true;
+    };
+
+    /**
+     * Checks if an object has been seen recently
+     *
+     * @param  _id     the id of the object
+     * @param  _within the time window, in [s]
+     * @return         true/false if the object has been seen in the last _within seconds or not
+     */
+    bool isObjectSeen(const T& _id, double _within)
+    {
+        std::lock_guard<std::mutex> lck(mtx_obs);
+
+        auto it = observations.find(_id);
+
+        return it != observations.end() &&
+               (ros::Time::now() - it->second.stamp).toSec() <= _within;
+    };
+
 public:
     /**
      * Constructor
      */
     ClientTemplate(std::string _name, std::string _limb) :
                    ctnh(_name), limb(_limb), is_ok(false),
-                   objects_found(false), object_found(false), ct_print_level(0)
+                   objects_found(false), object_found(false),
+                   ct_timeout(PERCEPTION_TIMEOUT), ct_print_level(0)
     {
-        ctnh.param<int> ("/print_level", ct_print_level, 0);
+        ctnh.param<int>   ("/print_level",         ct_print_level,                  0);
+        ctnh.param<double>("/perception_timeout",      ct_timeout, PERCEPTION_TIMEOUT);
     };
 
     /**
@@ -16,9 +16,14 @@
 #ifndef __HSV_DETECTION_H__
 #define __HSV_DETECTION_H__
 
+#include <array>
+#include <stdint.h>
+
 #include <ros/ros.h>
 #include <opencv2/core/core.hpp>
 
+#define HSV_MAX_LABELS  32  // Maximum number of color ranges handled by a single hsvLabeler
+
 typedef std::vector<cv::Point>   Contour;
 typedef std::vector<Contour>    Contours;
 
@@ -42,6 +47,12 @@ struct colorRange
     * Copy Operator
     **/
     colorRange &operator=(const colorRange &);
+
+    /**
+    * Comparison Operators
+    **/
+    bool operator==(const colorRange &_cr) const { return min == _cr.min && max == _cr.max; };
+    bool operator!=(const colorRange &_cr) const { return not (*this == _cr);               };
 };
 
 struct hsvColorRange
@@ -93,6 +104,12 @@ struct hsvColorRange
     * Copy Operator
     **/
     hsvColorRange &operator=(const hsvColorRange &);
+
+    /**
+    * Comparison Operators
+    **/
+    bool operator==(const hsvColorRange &_hsv) const { return H == _hsv.H && S == _hsv.S && V == _hsv.V; };
+    bool operator!=(const hsvColorRange &_hsv) const { return not (*this == _hsv);                        };
 };
 
 /**
@@ -106,5 +123,110 @@ struct hsvColorRange
  */
 cv::Mat hsvThreshold(const cv::Mat& _src, hsvColorRange _hsv);
 
+/**
+ * Same as hsvThreshold, but into preallocated images (see ScratchArena)
+ *
+ * @param _src the HSV image (CV_8UC3)
+ * @param _hsv the color range
+ * @param _dst the binary image (CV_8UC1). It is reallocated only if its size or type are different.
+ * @param _tmp a temporary binary image (only needed for the red), as _dst
+ */
+void hsvThreshold(const cv::Mat& _src, hsvColorRange _hsv, cv::Mat& _dst, cv::Mat& _tmp);
+
+/**
+ * Thresholds an HSV image against multiple color ranges in a single pass.
+ * Every pixel is labeled with a bitmask of the color ranges it belongs to
+ * (bit i is set if the pixel is in the i-th range). Since the color ranges
+ * are boxes in the HSV space, the bitmask is the AND of three lookup tables
+ * (one per channel), which are built once when the color ranges are set.
+ * The red (i.e. H.min > H.max) is handled as in hsvThreshold.
+ *
+ * BGR images can also be labeled directly, skipping the HSV conversion altogether,
+ * through a lookup table that maps every BGR color to its bitmask. The table has
+ * 256^3 entries of 8 bits (i.e. 16MB every 8 color ranges), and it takes about 150ms
+ * to build, so it is built only on request when the color ranges are set.
+ */
+class hsvLabeler
+{
+private:
+    std::array<uint32_t, 256> lut_h;    // Bitmask of the color ranges for every value of H
+    std::array<uint32_t, 256> lut_s;    // Bitmask of the color ranges for every value of S
+    std::array<uint32_t, 256> lut_v;    // Bitmask of the color ranges for every value of V
+
+    // Bitmask of the color ranges for every BGR color, 8 color ranges per table
+    std::vector<std::vector<uint8_t> > lut_bgr;
+    bool                        is_lut_bgr_ok;  // True if lut_bgr is up to date with the color ranges
+
+    std::vector<hsvColorRange> ranges;  // Color ranges the lookup tables are built for
+
+    /**
+     * Builds the BGR lookup tables out of the HSV ones, converting
+     * every BGR color to HSV in the same way cv::cvtColor does.
+     */
+    void buildBGRLUT();
+
+public:
+    /* CONSTRUCTOR */
+    hsvLabeler();
+
+    /**
+     * Sets the color ranges and builds the lookup tables. It does nothing if
+     * the color ranges have not changed since the last call (and the BGR lookup
+     * table, if requested, is already built).
+     *
+     * @param  _hsvs      the color ranges (at most HSV_MAX_LABELS)
+     * @param  _build_bgr true/false to build the BGR lookup table as well or not
+     * @return            true/false if success/failure
+     */
+    bool setColorRanges(const std::vector<hsvColorRange>& _hsvs, bool _build_bgr = false);
+
+    /**
+     * Labels an HSV image
+     *
+     * @param _src    the HSV image (CV_8UC3)
+     * @param _labels the labeled image (CV_32SC1, one bitmask per pixel).
+     *                It is reallocated only if its size or type are different.
+     */
+    void label(const cv::Mat& _src, cv::Mat& _labels) const;
+
+    /**
+     * Labels a BGR image, without converting it to HSV. The result is the same
+     * as converting the image with cv::cvtColor(CV_BGR2HSV) and calling label().
+     * If the BGR lookup table has not been built by setColorRanges, it is built here.
+     *
+     * @param _src    the BGR image (CV_8UC3)
+     * @param _labels the labeled image (CV_32SC1, one bitmask per pixel).
+     *                It is reallocated only if its size or type are different.
+     */
+    void labelBGR(const cv::Mat& _src, cv::Mat& _labels);
+
+    /**
+     * Extracts a binary image out of a labeled image
+     *
+     * @param _labels the labeled image (CV_32SC1)
+     * @param _idx    the index of the color range to extract
+     * @param _dst    the binary image (CV_8UC1, 255 where the label is set).
+     *                It is reallocated only if its size or type are different.
+     */
+    static void extract(const cv::Mat& _labels, int _idx, cv::Mat& _dst);
+
+    /* GETTERS */
+    size_t getNumRanges() const { return  ranges.size(); };
+    bool   isBGRLUTOk()   const { return is_lut_bgr_ok; };
+};
+
+/**
+ * Erodes (or dilates) a labeled image with a 3x3 rectangular kernel, as cv::erode
+ * (or cv::dilate) with their default parameters would do on every label separately.
+ * All the labels are processed at once, since for binary images erosion and dilation
+ * are the bitwise AND and OR over the kernel.
+ *
+ * @param _labels     the labeled image (CV_32SC1), processed in place
+ * @param _tmp        a temporary buffer, reallocated only if needed
+ * @param _iterations the number of times the operation is applied
+ */
+void erodeLabels (cv::Mat& _labels, cv::Mat& _tmp, int _iterations = 1);
+void dilateLabels(cv::Mat& _labels, cv::Mat& _tmp, int _iterations = 1);
+
 
 #endif // __HSV_DETECTION_H__
@@ -0,0 +1,196 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#ifndef __OBJECT_TRACKER_H__
+#define __OBJECT_TRACKER_H__
+
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include <Eigen/Dense>
+
+#include <ros/ros.h>
+#include <geometry_msgs/Pose.h>
+
+#define OBJ_KF_ACC_NOISE          0.1   // [m^2/s^3] Spectral density of the (white) acceleration
+#define OBJ_KF_MEAS_NOISE       1e-4    // [m^2]     Variance of the measured position
+#define OBJ_KF_VEL_VAR_INIT       0.01  // [m^2/s^2] Initial variance of the velocity
+#define OBJ_KF_ORI_GAIN           0.5   // Gain of the orientation filter, in (0, 1]
+#define OBJ_KF_HISTORY           10     // Number of measurements kept to handle late messages
+#define OBJ_KF_TIMEOUT            0.5   // [s] Time after which the filter is reset
+#define OBJ_KF_MAX_PREDICTION     0.2   // [s] Maximum time the pose is extrapolated for
+
+/**
+ * Constant-velocity Kalman filter of the pose of an object. The position is
+ * filtered with a constant-velocity model (the three axes are independent, and
+ * they share the same covariance), while the orientation is smoothed with a
+ * fixed-gain slerp and it is not extrapolated.
+ *
+ * Measurements are time-stamped: the last OBJ_KF_HISTORY of them are kept
+ * together with the state of the filter after each of them, so that late
+ * (i.e. out-of-order) measurements are inserted in the right place and
+ * the filter is re-run from there.
+ */
+class ObjectKF
+{
+public:
+    // Position (first column) and velocity (second column) of the object. Types are
+    // unaligned so that they can be stored in std containers without aligned allocators
+    typedef Eigen::Matrix<double, 3, 2, Eigen::DontAlign> StateMat;
+    typedef Eigen::Matrix<double, 2, 2, Eigen::DontAlign>   CovMat;
+    typedef Eigen::Quaternion<double, Eigen::DontAlign>      OriQuat;
+
+private:
+    struct State
+    {
+        ros::Time            stamp; // Time of the state
+        StateMat                 x; // Position and velocity
+        CovMat                   P; // Covariance of the position and velocity (same for all the axes)
+        OriQuat                ori; // Orientation
+    };
+
+    struct Measurement
+    {
+        ros::Time            stamp; // Time of the measurement
+        Eigen::Vector3d        pos; // Measured position
+        OriQuat                ori; // Measured orientation
+        State            posterior; // State of the filter after the measurement
+    };
+
+    std::deque<Measurement> history; // Last measurements, sorted by time
+
+    double acc_noise;   // Spectral density of the acceleration
+    double meas_noise;  // Variance of the measured position
+
+    /**
+     * Propagates a state to a given time with the constant-velocity model
+     *
+     * @param _s the state (it is modified in place)
+     * @param _t the time to propagate the state to
+     */
+    void predict(State& _s, const ros::Time& _t) const;
+
+    /**
+     * Corrects a state with a measurement taken at the same time
+     *
+     * @param _s the state (it is modified in place)
+     * @param _m the measurement
+     */
+    void correct(State& _s, const Measurement& _m) const;
+
+public:
+    /**
+     * Constructor
+     *
+     * @param _acc_noise  spectral density of the acceleration
+     * @param _meas_noise variance of the measured position
+     */
+    explicit ObjectKF(double _acc_noise  = OBJ_KF_ACC_NOISE,
+                      double _meas_noise = OBJ_KF_MEAS_NOISE);
+
+    /**
+     * Updates the filter with a new measurement. If the measurement is more recent than
+     * the last one by more than OBJ_KF_TIMEOUT, the filter is reset to the measurement.
+     *
+     * @param  _pose  the measured pose
+     * @param  _stamp the time of the measurement
+     * @return        true/false if the measurement has been used or not (i.e. if it is a
+     *                duplicate, or if it is older than all the measurements in the history)
+     */
+    bool update(const geometry_msgs::Pose& _pose, const ros::Time& _stamp);
+
+    /**
+     * Predicts the pose of the object at a given time. The pose is extrapolated
+     * for OBJ_KF_MAX_PREDICTION at most after the last measurement.
+     *
+     * @param  _t    the time to predict the pose at
+     * @param  _pose the predicted pose
+     * @return       true/false if the pose is valid or not (i.e. if there are no
+     *               measurements, or if the last one is older than OBJ_KF_TIMEOUT)
+     */
+    bool predict(const ros::Time& _t, geometry_msgs::Pose& _pose) const;
+
+    /**
+     * Gets the estimated velocity of the object at the time of the last measurement
+     *
+     * @return the velocity
+     */
+    Eigen::Vector3d getVelocity() const;
+
+    /**
+     * Gets the time of the last measurement
+     *
+     * @return the time of the last measurement (0 if there are none)
+     */
+    ros::Time getLastStamp() const;
+
+    /**
+     * Resets the filter
+     */
+    void reset() { history.clear(); };
+};
+
+/**
+ * Set of Kalman filters of the poses of a set of objects, keyed by their id.
+ * It is thread-safe, so that it can be updated by a ROS callback and read
+ * by a control thread at the same time.
+ */
+class ObjectTracker
+{
+private:
+    std::map<int, ObjectKF> filters; // Filters of the objects, keyed by their id
+    mutable std::mutex          mtx; // Mutex to protect the filters
+
+    double acc_noise;   // Spectral density of the acceleration
+    double meas_noise;  // Variance of the measured position
+
+public:
+    /**
+     * Constructor
+     *
+     * @param _acc_noise  spectral density of the acceleration
+     * @param _meas_noise variance of the measured position
+     */
+    explicit ObjectTracker(double _acc_noise  = OBJ_KF_ACC_NOISE,
+                           double _meas_noise = OBJ_KF_MEAS_NOISE);
+
+    /**
+     * Updates the filter of an object with a new measurement (see ObjectKF::update)
+     *
+     * @param  _id    the id of the object
+     * @param  _pose  the measured pose
+     * @param  _stamp the time of the measurement
+     * @return        true/false if the measurement has been used or not
+     */
+    bool update(int _id, const geometry_msgs::Pose& _pose, const ros::Time& _stamp);
+
+    /**
+     * Predicts the pose of an object at a given time (see ObjectKF::predict)
+     *
+     * @param  _id   the id of the object
+     * @param  _t    the time to predict the pose at
+     * @param  _pose the predicted pose
+     * @return       true/false if the pose is valid or not
+     */
+    bool predict(int _id, const ros::Time& _t, geometry_msgs::Pose& _pose) const;
+
+    /**
+     * Resets the filters of all the objects
+     */
+    void clear();
+};
+
+#endif
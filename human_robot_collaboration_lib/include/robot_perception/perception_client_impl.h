@@ -17,11 +17,16 @@
 #define __PERCEPTION_CLIENT_IMPL__
 
 #include "robot_perception/client_template.h"
+#include "robot_perception/object_tracker.h"
 
 #include <aruco_msgs/MarkerArray.h>
 
 class PerceptionClientImpl : public ClientTemplate<int>
 {
+private:
+    // Kalman filters of the poses of the objects, keyed by their marker id
+    ObjectTracker tracker;
+
 protected:
     /**
      * Callback function for the ARuco topic
@@ -32,22 +37,34 @@ protected:
     {
         ROS_INFO_COND(ct_print_level>=12, "[PerceptionClientImpl] ObjectCb");
 
+        // Markers are filtered at the time the image was taken (if available),
+        // so that late or out-of-order messages are properly accounted for
+        ros::Time stamp = _msg.header.stamp.isZero()? ros::Time::now() : _msg.header.stamp;
+
         if (_msg.markers.size() > 0)
         {
-            available_objects.clear();
+            clearAvailableObjects(stamp);
         }
 
+        bool obj_found = false;
+
         for (size_t i = 0; i < _msg.markers.size(); ++i)
         {
             // ROS_DEBUG("Processing object with id %i",_msg.markers[i].id);
 
-            available_objects.push_back(int(_msg.markers[i].id));
-            objects_found = true;
+            bool is_latest = addObservation(int(_msg.markers[i].id), _msg.markers[i].pose.pose,
+                                            _msg.markers[i].confidence, stamp);
+
+            tracker.update(int(_msg.markers[i].id), _msg.markers[i].pose.pose, stamp);
 
             if (int(_msg.markers[i].id) == getObjectID())
             {
-                curr_object_pos = _msg.markers[i].pose.pose.position;
-                curr_object_ori = _msg.markers[i].pose.pose.orientation;
+                // A late message does not overwrite the position of the object
+                if (is_latest)
+                {
+                    curr_object_pos = _msg.markers[i].pose.pose.position;
+                    curr_object_ori = _msg.markers[i].pose.pose.orientation;
+                }
 
                 ROS_DEBUG("Object is in: %g %g %g", curr_object_pos.x,
                                                     curr_object_pos.y,
@@ -57,11 +74,30 @@ protected:
                 //                                       curr_object_ori.z,
                 //                                       curr_object_ori.w);
 
-                if (!object_found) { object_found = true; }
+                obj_found = true;
             }
         }
 
-        if (not is_ok) { is_ok = true; }
+        // Wakes up whoever is waiting for data (see ClientTemplate::waitForData())
+        notifyData(_msg.markers.size() > 0, obj_found);
+    };
+
+    /**
+     * Predicts the position of the selected object at a given time, through its
+     * Kalman filter. This gives smooth, latency-compensated targets in between
+     * perception updates. If the filter has no recent data, the last position
+     * received from perception is returned.
+     *
+     * @param  _t the time to predict the position at
+     * @return    the position of the object
+     */
+    geometry_msgs::Point getPredictedObjectPos(const ros::Time& _t)
+    {
+        geometry_msgs::Pose pose;
+
+        if (tracker.predict(getObjectID(), _t, pose))    { return pose.position; }
+
+        return getObjectPos();
     };
 
 public:
@@ -0,0 +1,77 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#ifndef __SCRATCH_ARENA_H__
+#define __SCRATCH_ARENA_H__
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Scratch buffers of a single thread of the perception pipeline (i.e. of a worker of
+ * the thread pool of an estimator). The buffers are allocated at the resolution of the
+ * camera, and they are then handed out as views of the requested size (e.g. of a ROI),
+ * so that they are reused across frames whatever the size of the ROIs is. They are
+ * reallocated only if the resolution of the camera changes.
+ *
+ * OpenCV functions that write into a view (e.g. cv::cvtColor, cv::inRange, cv::resize)
+ * do not reallocate it, since the view has already the size and type they expect.
+ */
+class ScratchArena
+{
+private:
+    cv::Size img_size;      // Resolution the buffers are allocated for
+
+    cv::Mat  bgr_buf;       // Buffer for BGR images (CV_8UC3)
+    cv::Mat  hsv_buf;       // Buffer for HSV images (CV_8UC3)
+    cv::Mat  thres_buf;     // Buffer for binary images (CV_8UC1)
+    cv::Mat  tmp_buf;       // Buffer for temporary binary images (CV_8UC1)
+    cv::Mat  labels_buf;    // Buffer for labeled images (CV_32SC1)
+    cv::Mat  ltmp_buf;      // Buffer for temporary labeled images (CV_32SC1)
+
+    /**
+     * Gets a view of a buffer
+     *
+     * @param  _buf  the buffer
+     * @param  _size the size of the view (at most the resolution of the camera)
+     * @return       the view (its data is shared with the buffer)
+     */
+    cv::Mat view(const cv::Mat& _buf, const cv::Size& _size) const;
+
+public:
+    /* CONSTRUCTOR */
+    ScratchArena() {};
+
+    /**
+     * Allocates the buffers for a resolution of the camera. It does nothing if
+     * they are already allocated for it.
+     *
+     * @param  _img_size the resolution of the camera
+     * @return           true/false if the buffers have been (re)allocated or not
+     */
+    bool reserve(const cv::Size& _img_size);
+
+    /* VIEWS (see reserve) */
+    cv::Mat bgr   (const cv::Size& _size) const { return view(   bgr_buf, _size); };
+    cv::Mat hsv   (const cv::Size& _size) const { return view(   hsv_buf, _size); };
+    cv::Mat thres (const cv::Size& _size) const { return view( thres_buf, _size); };
+    cv::Mat tmp   (const cv::Size& _size) const { return view(   tmp_buf, _size); };
+    cv::Mat labels(const cv::Size& _size) const { return view(labels_buf, _size); };
+    cv::Mat ltmp  (const cv::Size& _size) const { return view(  ltmp_buf, _size); };
+
+    /* GETTERS */
+    cv::Size getImgSize() const { return img_size; };
+};
+
+#endif // __SCRATCH_ARENA_H__
@@ -16,13 +16,46 @@
 #ifndef __HIRO_TRAC_IK_H__
 #define __HIRO_TRAC_IK_H__
 
+#include <memory>
+#include <mutex>
+
+#include <Eigen/Dense>
+
 #include <trac_ik/trac_ik.hpp>
 #include <ros/ros.h>
 #include <kdl/chainiksolverpos_nr_jl.hpp>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <kdl/chainiksolvervel_pinv.hpp>
 #include <sensor_msgs/JointState.h>
 #include <baxter_core_msgs/SolvePositionIK.h>
 #include <intera_core_msgs/SolvePositionIK.h>
 #include "robot_interface/gripper.h"
+#include "robot_utils/thread_pool.h"
+
+/**
+ * Result of the IK of a single pose within a batch (see hiroTracIK::solveIKBatch())
+ */
+struct IKResult
+{
+    size_t          idx; // Index of the pose in the batch
+    bool        success; // True if a solution has been found
+    KDL::JntArray  jnts; // Joint solution
+    double         dist; // Distance of the solution from the seed, in joint space
+};
+
+/**
+ * Statistics of the solves of hiroTracIK::solveIK(), i.e. which stage of the
+ * IK engine served them (for diagnostics)
+ */
+struct IKStats
+{
+    unsigned long   cache_hits; // Solves served by the cache
+    unsigned long   local_sols; // Solves served by the local (warm-started) solver
+    unsigned long tracik_calls; // Solves for which the local solver failed, and TRAC_IK was called
+    unsigned long  tracik_sols; // Solves served by TRAC_IK
+
+    IKStats() : cache_hits(0), local_sols(0), tracik_calls(0), tracik_sols(0) {};
+};
 
 class hiroTracIK
 {
@@ -38,6 +71,108 @@ private:
     KDL::Chain _chain;
     KDL::JntArray *_nominal;
 
+    // Names of the joints in the chain (computed once at construction)
+    std::vector<std::string> _jnt_names;
+
+    /**
+     * Warm-started IK engine. A local Newton-Raphson solver (with joint limits)
+     * is seeded with the last solution found, and TRAC_IK is used as a fallback
+     * whenever the local solver does not converge.
+     */
+    std::unique_ptr<KDL::ChainFkSolverPos_recursive> _fk_solver;
+    std::unique_ptr<KDL::ChainIkSolverVel_pinv>     _vel_solver;
+    std::unique_ptr<KDL::ChainIkSolverPos_NR_JL>     _nr_solver;
+
+    // Current joint limits (needed to rebuild the local solver)
+    KDL::JntArray _ll, _ul;
+
+    // Preallocated buffer for the result of the IK (used by the Eigen interface)
+    KDL::JntArray _result;
+
+    // Last valid solution, used to warm start the next solve
+    bool    _has_warm_start;
+    KDL::JntArray _last_sol;
+
+    // Statistics of the solves
+    IKStats _stats;
+
+    /**
+     * Small LRU cache of the latest solutions, keyed by the pose quantized
+     * with a resolution of _cache_res. It is preallocated at construction
+     * time and looked up linearly (it is meant to be small). Its solutions
+     * depend only on the pose and on the joint limits (and not on the state
+     * of the arm), hence it is kept across motions, and it is cleared only
+     * when the joint limits change.
+     */
+    struct IKCacheEntry
+    {
+        bool        valid;
+        long      key[7];
+        unsigned long age;
+        KDL::JntArray sol;
+    };
+
+    std::vector<IKCacheEntry> _cache;
+    unsigned long         _cache_age;
+    double                _cache_res;
+
+    /**
+     * Quantizes a pose into a cache key
+     *
+     * @param _pose the pose to quantize
+     * @param _key  the resulting key
+     */
+    void poseToKey(const KDL::Frame &_pose, long _key[7]);
+
+    /**
+     * Looks up the cache for a solution to the pose identified by a key
+     *
+     * @param  _key the pose key
+     * @param  _sol the cached solution (if found)
+     * @return      true/false if the key was found or not
+     */
+    bool lookupCache(const long _key[7], KDL::JntArray &_sol);
+
+    /**
+     * Stores a solution into the cache, evicting the least recently used entry
+     *
+     * @param _key the pose key
+     * @param _sol the solution to store
+     */
+    void storeCache(const long _key[7], const KDL::JntArray &_sol);
+
+    /**
+     * (Re)creates the local Newton-Raphson solver with the current joint limits
+     */
+    void initLocalSolver();
+
+    /**
+     * Batch IK. The poses are distributed among the workers of a thread pool,
+     * and every worker owns its own TRAC_IK solver, since TRAC_IK is not
+     * thread-safe. Pool and solvers are created the first time they are needed.
+     */
+    size_t                                         _batch_workers;
+    std::unique_ptr<ThreadPool>                       _batch_pool;
+    std::vector<std::unique_ptr<TRAC_IK::TRAC_IK> > _batch_solvers;
+    std::mutex                                          _batch_mtx;
+
+    /**
+     * Creates the thread pool and the per-worker solvers (if needed)
+     */
+    void initBatchSolvers();
+
+    /**
+     * Solves the IK for a batch of poses in parallel. Results are in the same
+     * order as the poses.
+     *
+     * @param _poses the desired poses of the end-effector in the base frame
+     * @param _seeds the seeds, either one per pose or a single one for all of them
+     * @param _res   the results, one per pose
+     */
+    void solveBatch(const std::vector<KDL::Frame>    &_poses,
+                    const std::vector<KDL::JntArray> &_seeds,
+                    std::vector<IKResult>            &_res);
+
 public:
     explicit hiroTracIK(std::string limb, std::string ee_name, bool _use_robot = true);
 
@@ -45,12 +180,104 @@ public:
 
     KDL::JntArray JointState2JntArray(const sensor_msgs::JointState &js);
 
+    /**
+     * Solves the IK for all the poses in the request, in parallel (see solveIKBatch()).
+     * The response has one solution per pose, in the same order as the request.
+     *
+     * @param  ik_srv the IK service (request and response)
+     * @return        true/false if success/failure
+     */
     bool perform_ik(intera_core_msgs::SolvePositionIK &ik_srv);
 
+    /**
+     * Solves the IK for a batch of candidate poses at once, in parallel across
+     * a pool of workers. It does not modify the warm start nor the cache of
+     * solveIK(). Results are ranked by distance from the seed, with the
+     * successful ones first.
+     *
+     * @param  _poses the desired poses of the end-effector in the base frame
+     * @param  _seed  the seed (e.g. the current joint configuration)
+     * @param  _res   the results, one per pose (see IKResult::idx for the pose)
+     * @return        true/false if at least one solution has been found or not
+     */
+    bool solveIKBatch(const std::vector<KDL::Frame> &_poses, const KDL::JntArray &_seed,
+                      std::vector<IKResult> &_res);
+
+    /**
+     * Solves the IK for a desired end-effector pose. The solve is warm started
+     * from the last solution found (or from the seed set with setSeed()), and
+     * the cache of recent solutions is checked first.
+     *
+     * @param  _pose the desired pose of the end-effector in the base frame
+     * @param  _jnts the joint solution (it has to be of the size of the chain)
+     * @return       true/false if success/failure
+     */
+    bool solveIK(const KDL::Frame &_pose, KDL::JntArray &_jnts);
+
+    /**
+     * Solves the IK for a desired end-effector pose.
+     *
+     * @param  _pos  the desired position of the end-effector in the base frame
+     * @param  _ori  the desired orientation of the end-effector in the base frame
+     * @param  _jnts the joint solution (resized only if needed)
+     * @return       true/false if success/failure
+     */
+    bool solveIK(const Eigen::Vector3d &_pos, const Eigen::Quaterniond &_ori,
+                 Eigen::VectorXd &_jnts);
+
+    /**
+     * Sets the seed to warm start the next solve from (e.g. the current joint
+     * configuration of the robot).
+     *
+     * @param  _seed the seed
+     * @return       true/false if success/failure
+     */
+    bool setSeed(const Eigen::VectorXd &_seed);
+
+    /**
+     * Returns if a warm start is available for the next solve
+     */
+    bool hasWarmStart() { return _has_warm_start; };
+
+    /**
+     * Discards the warm start, so that the next solve will start from
+     * the seed set with setSeed() (or the nominal configuration)
+     */
+    void resetWarmStart() { _has_warm_start = false; };
+
+    /**
+     * Clears the cache of recent solutions
+     */
+    void clearCache();
+
+    /**
+     * Returns the number of entries of the cache of recent solutions
+     */
+    size_t getCacheSize() { return _cache.size(); };
+
+    /**
+     * Returns the statistics of the solves of solveIK()
+     */
+    IKStats getStats() { return _stats; };
+
+    /**
+     * Returns the number of joints of the kinematic chain
+     */
+    unsigned int getNrOfJoints() { return _chain.getNrOfJoints(); };
+
     bool getKDLLimits(KDL::JntArray &ll, KDL::JntArray &ul);
     bool setKDLLimits(KDL::JntArray  ll, KDL::JntArray  ul);
 
     void computeFwdKin(KDL::JntArray jointpositions);
+
+    /**
+     * Computes the forward kinematics of the chain
+     *
+     * @param  _jnts the joint configuration
+     * @param  _pose the resulting pose of the end-effector in the base frame
+     * @return       true/false if success/failure
+     */
+    bool computeFwdKin(const KDL::JntArray &_jnts, KDL::Frame &_pose);
 };
 
 #endif
@@ -22,14 +22,23 @@
 #include <Eigen/Dense>
 
 #include "robot_utils/thread_safe.h"
+#include "robot_utils/seqlock.h"
 #include "robot_utils/rviz_publisher.h"
 
 /**
  * Particle Thread object. Abstract class that implements the thread function and
  * all the related members. Needs to be specialized in any derived class.
+ * The particle has a fixed size N (e.g. 3 for a 3D point), so that it can be
+ * updated and read without allocating any memory. Sizes other than 3 need to
+ * be explicitly instantiated at the bottom of particle_thread.cpp.
  */
-class ParticleThread
+template<int N> class ParticleThread
 {
+public:
+    // Position (or orientation) of the particle. It is unaligned so that
+    // particles can be allocated with new regardless of their size.
+    typedef Eigen::Matrix<double, N, 1, Eigen::DontAlign> Point;
+
 private:
     std::string   name; // Name of the object
     std::thread thread; // Thread to update the particle
@@ -38,8 +47,8 @@ private:
     ThreadSafe<bool> is_running; // Thread-safe flag to know if the thread has been started
     ThreadSafe<bool> is_closing; // Thread-safe flag to close the thread entry function
 
-    // Current position (or orientation) of the particle (with thread-safe read and write)
-    ThreadSafe<Eigen::VectorXd> curr_pt;
+    // Current position (or orientation) of the particle (with lock-free read)
+    SeqLock<Point> curr_pt;
 
     bool rviz_visual; // Flag to know if to publish to rviz or not
 
@@ -59,12 +68,24 @@ protected:
     void internalThread();
 
     /**
-     * Updates the particle. To be specialized in derived classes.
+     * Performs one cycle of the thread, i.e. updates the particle
+     * and sets it as the current point. It does not allocate memory
+     * (unless the point is published to rviz).
      *
-     * @param  _new_pt updated point
-     * @return         true/false if success/failure
+     * @return true/false if success/failure
+     */
+    bool cycle();
+
+    /**
+     * Updates the particle. To be specialized in derived classes. It has to be
+     * a pure function of the elapsed time (and of the parameters of the particle),
+     * so that the particle can also be evaluated without the thread (see evaluate()).
+     *
+     * @param  _elap_time time elapsed since the start of the particle, in [s]
+     * @param  _new_pt    updated point
+     * @return            true/false if success/failure
      */
-    virtual bool updateParticle(Eigen::VectorXd& _new_pt) = 0;
+    virtual bool updateParticle(double _elap_time, Point& _new_pt) = 0;
 
     /**
      * Sets the current point as a marker for the RVIZPublisher to publish
@@ -77,7 +98,7 @@ protected:
      * @param  _curr_pt the new position (or orientation) of the particle
      * @return          true/false if success/failure
      */
-    bool setCurrPoint(const Eigen::VectorXd& _curr_pt);
+    bool setCurrPoint(const Point& _curr_pt);
 
 public:
     /**
@@ -105,6 +126,18 @@ public:
      */
     bool stop();
 
+    /**
+     * Evaluates the particle at a given time, without the need of starting the thread.
+     * This allows for the particle to be used as a trajectory generator within an
+     * external control loop, and to be reused across targets by calling the setup
+     * function again. It does not modify the current point.
+     *
+     * @param  _elap_time time elapsed since the start of the particle, in [s]
+     * @param  _pt        the point at that time
+     * @return            true/false if success/failure (e.g. if the particle is not set)
+     */
+    bool evaluate(double _elap_time, Point& _pt);
+
     /**
      * Gets the rate of the thread
      * @return the rate of the thread
@@ -115,7 +148,7 @@ public:
      * Gets the current position (or orientation) of the particle
      * @return the current position (or orientation) of the particle
      */
-    Eigen::VectorXd getCurrPoint();
+    Point getCurrPoint();
 
     /**
      * Gets the name of the object
@@ -144,22 +177,23 @@ public:
     /**
      * Destructor
      */
-    ~ParticleThread();
+    virtual ~ParticleThread();
 };
 
 /**
  * Implementation of ParticleThread object. Does not do much (only for testing purposes)
  */
-class ParticleThreadImpl : public ParticleThread
+class ParticleThreadImpl : public ParticleThread<3>
 {
 protected:
     /**
      * Updates the particle.
      *
-     * @param  _new_pt updated point
-     * @return         true/false if success/failure
+     * @param  _elap_time time elapsed since the start of the particle, in [s]
+     * @param  _new_pt    updated point
+     * @return            true/false if success/failure
      */
-    bool updateParticle(Eigen::VectorXd& _new_pt);
+    bool updateParticle(double _elap_time, Point& _new_pt);
 
 public:
     /**
@@ -182,7 +216,7 @@ public:
 /**
  * ParticleThread for a 3D Point following a straight trajectory from start to end.
  */
-class LinearPointParticle : public ParticleThread
+class LinearPointParticle : public ParticleThread<3>
 {
 private:
     // Start point of the trajectory (with thread-safe read and write)
@@ -198,10 +232,11 @@ protected:
     /**
      * Updates the particle.
      *
-     * @param  _new_pt updated point
-     * @return         true/false if success/failure
+     * @param  _elap_time time elapsed since the start of the particle, in [s]
+     * @param  _new_pt    updated point
+     * @return            true/false if success/failure
      */
-    bool updateParticle(Eigen::VectorXd& _new_pt);
+    bool updateParticle(double _elap_time, Point& _new_pt);
 
     /**
      * Sets the current point and the desired target as markers for the RVIZPublisher to publish
@@ -242,7 +277,7 @@ public:
  * ParticleThread for a 3D Point following a circular trajectory in 3D space.
  * Please be aware that the circular point particle will never stop moving.
  */
-class CircularPointParticle : public ParticleThread
+class CircularPointParticle : public ParticleThread<3>
 {
 private:
     // Center of the circumference (with thread-safe read and write)
@@ -261,10 +296,11 @@ protected:
     /**
      * Updates the particle.
      *
-     * @param  _new_pt updated point
-     * @return         true/false if success/failure
+     * @param  _elap_time time elapsed since the start of the particle, in [s]
+     * @param  _new_pt    updated point
+     * @return            true/false if success/failure
      */
-    bool updateParticle(Eigen::VectorXd& _new_pt);
+    bool updateParticle(double _elap_time, Point& _new_pt);
 
     /**
      * Sets the current point and the desired target as markers for the RVIZPublisher to publish
@@ -52,7 +52,15 @@ protected:
 
     std::mutex mutex_img;
 
-    cv::Mat     curr_img;   // Current image
+    /**
+     * Double buffer of images. The images are shared with the ROS messages they
+     * come from, so that no copies are made in the image callback. The callback
+     * writes into the back buffer, and swaps it with the front one under mutex_img.
+     */
+    cv_bridge::CvImageConstPtr img_buf[2];
+    int                       img_front;   // Index of the front buffer (i.e. the most recent image)
+    unsigned long               img_seq;   // Sequence number of the most recent image (0 if none)
+
     cv::Size    img_size;   // Size of current image
     bool       img_empty;   // Returns true if current image is empty, false otherwise
     std::string encoding;   // Encoding for the image read by the subscriber
@@ -86,6 +94,18 @@ public:
      */
     void imageCb(const sensor_msgs::ImageConstPtr& _msg);
 
+    /**
+     * Gets the most recent image, if it is newer than the last one seen by the caller.
+     * The image is not copied: it is shared with the ROS message it comes from, and
+     * it must not be modified (consumers that need to draw on it should clone it).
+     *
+     * @param  _seq the sequence number of the last image seen by the caller.
+     *              It is set to the sequence number of the returned image.
+     * @param  _img the most recent image
+     * @return      true/false if a new image is available or not
+     */
+    bool getNewImage(unsigned long& _seq, cv_bridge::CvImageConstPtr& _img);
+
     /*
      * Self-explaining "setters"
      */
@@ -102,6 +122,13 @@ public:
      */
     bool startThread();
 
+    /**
+     * Stops the thread, and waits for it to finish its current iteration. Derived classes
+     * should call it at the beginning of their destructor, before the members that
+     * internalThread() uses are destroyed. It does nothing if the thread is not running.
+     */
+    void stopThread();
+
     /**
      * Safely manipulate the boolean needed to kill the thread entry
      */
@@ -0,0 +1,201 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#ifndef __RT_LOOP_H__
+#define __RT_LOOP_H__
+
+#include <array>
+#include <string>
+#include <time.h>
+
+#include <human_robot_collaboration_msgs/CtrlLoopStats.h>
+
+#include "robot_utils/seqlock.h"
+
+#define RT_HIST_BINS             50 // Number of bins of the jitter histogram
+#define RT_HIST_BIN_WIDTH     20e-6 // [s] Width of the bins of the jitter histogram
+
+/**
+ * Timing statistics of a periodic loop. All the times are in seconds, and
+ * all the statistics are since the start of the loop.
+ */
+struct RTLoopStats
+{
+    double               period; // Nominal period of the loop
+
+    unsigned long        cycles; // Number of cycles
+    unsigned long      overruns; // Number of cycles that missed their deadline
+
+    double          jitter_last; // Delay between the deadline of a cycle and its start
+    double          jitter_mean;
+    double           jitter_max;
+
+    // The IK and publishing times are computed only over the cycles that ran them
+    unsigned long     ik_cycles; // Number of cycles that ran the inverse kinematics
+    double         ik_time_last; // Time spent in the inverse kinematics
+    double         ik_time_mean;
+    double          ik_time_max;
+
+    unsigned long    pub_cycles; // Number of cycles that published the commands
+    double        pub_time_last; // Time spent in publishing the commands
+    double        pub_time_mean;
+    double         pub_time_max;
+
+    double      cycle_time_last; // Time spent in the whole cycle (before going to sleep)
+    double      cycle_time_mean;
+    double       cycle_time_max;
+
+    // Histogram of the jitter (the last bin counts everything above)
+    std::array<unsigned long, RT_HIST_BINS> hist;
+
+    /**
+     * Constructor
+     *
+     * @param _period the nominal period of the loop
+     */
+    explicit RTLoopStats(double _period = 0.0);
+
+    /**
+     * Converts the statistics into a ROS message
+     *
+     * @param _msg the message
+     */
+    void toMsg(human_robot_collaboration_msgs::CtrlLoopStats& _msg) const;
+
+    /**
+     * Prints the jitter histogram in a human-readable format (one bin per line)
+     *
+     * @return the histogram as a string
+     */
+    std::string printHistogram() const;
+};
+
+/**
+ * Periodic loop with absolute deadlines, meant to run real-time control loops.
+ * Differently from ros::Rate, it sleeps with clock_nanosleep() on the monotonic
+ * clock until an absolute deadline, so that errors do not accumulate over time,
+ * and it keeps track of the timing of every cycle. If a deadline is missed, the
+ * loop does not try to catch up, but it skips to the next deadline in the future.
+ *
+ * The statistics are updated only by the thread that runs the loop, and can be
+ * read from any other thread without blocking it.
+ */
+class RTLoop
+{
+private:
+    double              period; // [s] Period of the loop
+
+    struct timespec    deadline; // Absolute deadline of the current cycle
+    struct timespec  cycle_start; // When the current cycle has started
+
+    double        ik_time; // Time spent in the IK during the current cycle
+    double       pub_time; // Time spent in publishing during the current cycle
+    bool           has_ik; // True if the current cycle ran the IK
+    bool          has_pub; // True if the current cycle published
+
+
+    RTLoopStats                stats; // Statistics, owned by the loop thread
+    SeqLock<RTLoopStats> shared_stats; // Statistics, shared with the other threads
+
+    /**
+     * Updates the running mean and max of a statistic
+     *
+     * @param _n the number of samples of the statistic, including _val
+     */
+    void updateStat(double _val, unsigned long _n, double& _last, double& _mean, double& _max);
+
+public:
+    /**
+     * Constructor
+     *
+     * @param _freq frequency of the loop, in [Hz]
+     */
+    explicit RTLoop(double _freq);
+
+    /**
+     * Sets the scheduling policy of the calling thread to SCHED_FIFO with the given priority.
+     * It usually needs the CAP_SYS_NICE capability (or a proper rtprio limit).
+     *
+     * @param  _priority the priority [1, 99]
+     * @return           true/false if success/failure
+     */
+    static bool setPriority(int _priority);
+
+    /**
+     * Pins the calling thread to a CPU.
+     *
+     * @param  _cpu the CPU to pin the thread to
+     * @return      true/false if success/failure
+     */
+    static bool setAffinity(int _cpu);
+
+    /**
+     * Returns the current time of the monotonic clock
+     *
+     * @return the current time, in [s]
+     */
+    static double now();
+
+    /**
+     * Starts the loop, i.e. sets the current time as the deadline of the first
+     * cycle. It resets the statistics.
+     */
+    void start();
+
+    /**
+     * Ends the current cycle: it updates the statistics, and sleeps until the
+     * deadline of the next cycle. It does not allocate memory.
+     *
+     * @return true/false if the current cycle met its deadline or not
+     */
+    bool sleep();
+
+    /**
+     * Sets the time spent in the inverse kinematics during the current cycle.
+     * Cycles in which it is not called do not count in the IK statistics.
+     *
+     * @param _ik_time the time in [s]
+     */
+    void setIKTime(double _ik_time)    {  ik_time =  _ik_time;  has_ik = true; };
+
+    /**
+     * Sets the time spent in publishing during the current cycle.
+     * Cycles in which it is not called do not count in the publishing statistics.
+     *
+     * @param _pub_time the time in [s]
+     */
+    void setPubTime(double _pub_time) { pub_time = _pub_time; has_pub = true; };
+
+    /**
+     * Gets the statistics of the loop. It can be called from any thread.
+     *
+     * @return the statistics of the loop
+     */
+    RTLoopStats getStats() { return shared_stats.get(); };
+
+    /**
+     * Gets the period of the loop
+     *
+     * @return the period of the loop, in [s]
+     */
+    double getPeriod() { return period; };
+
+    /**
+     * Destructor
+     */
+    ~RTLoop() {};
+};
+
+#endif
@@ -89,9 +89,17 @@ struct RVIZMarker
     void setPosition(double _x, double _y, double _z);
 };
 
+#define RVIZ_KEEPALIVE  1.0     // [s] Period to republish the markers with if they do not change
+
 /**
  * Class that wraps an object that publishes an array of RVIZMarkers to RVIZ.
  * In incorporates a timer that keep publishing with a constant rate.
+ *
+ * The markers are double-buffered: the setters (usually called by control threads)
+ * only modify the markers under a short lock and flag them as dirty, while the
+ * timer callback copies them into its own buffer only when they are dirty, and
+ * fills a preallocated message outside of the lock. If the markers do not change,
+ * they are republished only every RVIZ_KEEPALIVE seconds (so that they do not expire).
  */
 class RVIZPublisher
 {
@@ -101,8 +109,15 @@ private:
 
     std::string name; // Name of the object
 
-    std::vector<RVIZMarker> markers; // vector of markers to publish to RVIZ
-    std::mutex        markers_mutex; // Mutex to protect access to the marker array
+    std::vector<RVIZMarker>     markers; // vector of markers to publish to RVIZ
+    bool                       is_dirty; // True if the markers changed since the last publish
+    std::mutex            markers_mutex; // Mutex to protect access to the marker array
+
+    // Buffers owned by the timer callback, and reused across callbacks
+    std::vector<RVIZMarker>     pub_markers; // Copy of the markers to publish
+    visualization_msgs::MarkerArray pub_msg; // Message to publish
+    ros::Time                      last_pub; // Time of the last publish
+
     ros::Publisher         rviz_pub; // Publisher to send markers to RVIZ
 
     ros::Timer      timer; // Timer to send messages to rviz with a specific period
@@ -147,6 +162,7 @@ public:
 
     /**
      * Sets the array of markers. The previous markers will be deleted.
+     * The array is moved in, so pass it with std::move() to avoid any copy.
      *
      * @param  _mrkrs The array of markers to set
      * @return        true/false if success/failure
@@ -161,13 +177,15 @@ public:
     std::vector<RVIZMarker> getMarkers();
 
     /**
-     * Sets a marker in the array with a specific index.
+     * Sets a marker in the array with a specific index. This is the cheapest
+     * way to update a marker periodically, since nothing is reallocated.
      *
-     * @param  _idx  The index to set the marker to
-     * @param  _mrkr The marker to set
-     * @return       true/false if success/failure
+     * @param  _idx    The index to set the marker to
+     * @param  _mrkr   The marker to set
+     * @param  _resize If true, the array is enlarged if the index is out of bounds
+     * @return         true/false if success/failure
      */
-    bool setMarker(size_t _idx, RVIZMarker _mrkr);
+    bool setMarker(size_t _idx, RVIZMarker _mrkr, bool _resize = false);
 
     /**
      * Clears the array of markers
@@ -0,0 +1,134 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#ifndef __SEQLOCK_H__
+#define __SEQLOCK_H__
+
+#include <mutex>
+#include <atomic>
+
+/**
+ * Template class that wraps a <DataType> object and implements a set() and
+ * a get() function with a sequence lock. Readers never block: they copy the
+ * data and retry if a writer modified it in the meantime. Writers are
+ * serialized among themselves by a mutex, and never wait for the readers.
+ * This is meant for small, frequently read data that is updated by callbacks.
+ *
+ * DataType needs to be trivially copyable (no pointers, no dynamic memory),
+ * since a reader may copy it while a writer is modifying it.
+ */
+template<class DataType> class SeqLock
+{
+private:
+    // The data to protect
+    DataType    data;
+
+    // Sequence counter. It is odd while a writer is modifying the data.
+    std::atomic<unsigned long> seq;
+
+    // The mutex that serializes the writers.
+    std::mutex mutex;
+
+public:
+    /**
+     * Constructors
+     */
+    SeqLock() : seq(0) {};
+    explicit SeqLock(const DataType& _data) : data(_data), seq(0) {};
+
+    /**
+     * Get function to return a consistent copy of the data stored in the class
+     *
+     * @param  _data the copy of the data
+     * @return       the version of the data (i.e. the number of updates so far)
+     */
+    unsigned long get(DataType& _data) const
+    {
+        unsigned long s0 = 0, s1 = 0;
+
+        do
+        {
+            s0 = seq.load(std::memory_order_acquire);
+
+            if (s0 & 1) { continue; }    // A writer is in progress
+
+            _data = data;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s1 = seq.load(std::memory_order_relaxed);
+        }
+        while ((s0 & 1) || s0 != s1);
+
+        return s0 / 2;
+    };
+
+    /**
+     * Get function to return the data stored in the class
+     * @return the data stored in the class
+     */
+    DataType get() const
+    {
+        DataType res;
+        get(res);
+        return res;
+    };
+
+    /**
+     * Returns the version of the data (i.e. the number of updates so far).
+     * Useful to know if something changed without copying the data.
+     */
+    unsigned long version() const
+    {
+        return seq.load(std::memory_order_acquire) / 2;
+    };
+
+    /**
+     * Modifies the data in place through a function (or lambda) that accepts
+     * a DataType& as argument. Only the fields touched by _f will change.
+     *
+     * @param  _f the function to apply to the data
+     * @return    true/false if success/failure
+     *                          (for now, always true is returned)
+     */
+    template<class Function> bool update(Function _f)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        unsigned long s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        _f(data);
+
+        seq.store(s + 2, std::memory_order_release);
+
+        return true;
+    };
+
+    /**
+     * Set function to set new data in the object
+     * @param  _data the new data
+     * @return       true/false if success/failure
+     *                          (for now, always true is returned)
+     */
+    bool set(const DataType& _data)
+    {
+        return update([&_data](DataType& _d) { _d = _data; });
+    };
+
+    ~SeqLock() {};
+};
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed-size pool of worker threads that run parallel for loops. The workers
+ * are created once and wait on a condition variable in between jobs, so that
+ * the cost of a job is not dominated by the creation of the threads.
+ * Every task is given the index of the worker that runs it, so that any
+ * per-worker resource (e.g. a solver that is not thread-safe, or a scratch
+ * buffer) can be indexed without locks.
+ */
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers; // Worker threads
+
+    std::mutex           run_mtx; // Mutex to serialize the calls to parallelFor()
+    std::mutex               mtx; // Mutex to protect the state of the current job
+    std::condition_variable cv_start; // Signals the workers that a new job is available
+    std::condition_variable  cv_done; // Signals the caller that the job is done
+
+    // Current job. It is type-erased into a pointer to the function object and a function
+    // to call it, rather than into a std::function, so that running a job allocates nothing
+    const void                      *job_ctx; // Function object of the current job
+    void (*job_fn)(const void*, size_t, size_t); // Calls the function object of the current job
+    size_t                        num_tasks; // Number of tasks of the current job
+    std::atomic<size_t>           next_task; // Next task to be picked up by a worker
+    size_t                         num_busy; // Number of workers still working on the job
+    unsigned long                generation; // Incremented at every new job
+    bool                         is_closing; // Flag to close the workers
+
+    /**
+     * Function that is run by every worker thread
+     *
+     * @param _worker the index of the worker
+     */
+    void workerThread(size_t _worker);
+
+    /**
+     * Runs a type-erased job (see parallelFor)
+     *
+     * @param  _num_tasks the number of tasks
+     * @param  _ctx       the function object to run for every task
+     * @param  _fn        the function that calls _ctx for a task and a worker
+     * @return            true/false if success/failure
+     */
+    bool run(size_t _num_tasks, const void* _ctx, void (*_fn)(const void*, size_t, size_t));
+
+public:
+    /**
+     * Constructor
+     *
+     * @param _num_workers the number of worker threads. If 0, the jobs are run
+     *                     by the calling thread.
+     */
+    explicit ThreadPool(size_t _num_workers);
+
+    /**
+     * Runs _f(task, worker) for every task in [0, _num_tasks), distributing the
+     * tasks among the workers. It blocks until all the tasks are done, so _f is
+     * only referenced (and never copied), whatever it captures.
+     *
+     * @param  _num_tasks the number of tasks
+     * @param  _f         the function to run for every task
+     * @return            true/false if success/failure
+     */
+    template<typename F>
+    bool parallelFor(size_t _num_tasks, const F& _f)
+    {
+        return run(_num_tasks, &_f, [](const void* _ctx, size_t _task, size_t _worker)
+                                    {
+                                        (*static_cast<const F*>(_ctx))(_task, _worker);
+                                    });
+    };
+
+    /**
+     * Returns the number of workers (at least 1, i.e. the calling thread)
+     */
+    size_t size() { return workers.empty()? 1 : workers.size(); };
+
+    /**
+     * Destructor
+     */
+    ~ThreadPool();
+};
+
+#endif
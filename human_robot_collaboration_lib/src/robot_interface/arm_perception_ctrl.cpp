@@ -139,8 +139,12 @@ bool ArmPerceptionCtrl::pickUpObject()
     {
         double elap_time = (ros::Time::now() - start_time).toSec();
 
-        double x = getObjectPos().x + offs_x;
-        double y = getObjectPos().y + offs_y;
+        // The object is tracked at the time the command is sent, not at
+        // the (older) time of the last image that perception processed
+        geometry_msgs::Point obj_pos = getPredictedObjectPos(ros::Time::now());
+
+        double x = obj_pos.x + offs_x;
+        double y = obj_pos.y + offs_y;
         double z = z_start - getArmSpeed() * elap_time;
 
         ROS_INFO_COND(print_level>=3, "Time %g Going to: %g %g %g Position: %g %g %g",
@@ -0,0 +1,132 @@
+#include "robot_interface/joint_state_decoder.h"
+
+#include <limits>
+
+using namespace std;
+
+JointStateDecoder::JointStateDecoder() : num_resolves(0)
+{
+
+}
+
+bool JointStateDecoder::addLimb(const string& _limb)
+{
+    lock_guard<mutex> lck(mtx);
+
+    return registerLimb(_limb);
+}
+
+bool JointStateDecoder::registerLimb(const string& _limb)
+{
+    if (limbs.find(_limb) != limbs.end())    { return false; }
+
+    LimbLayout& layout = limbs[_limb];
+    layout.ok        = false;
+    layout.num_found =     0;
+
+    for (size_t i = 0; i < NUM_JOINTS; ++i)
+    {
+        layout.names[i] = _limb + "_j" + to_string(i);
+        layout.idx[i]   = 0;
+        layout.found[i] = 0;
+        lookup[layout.names[i]] = make_pair(&layout, i);
+    }
+
+    return true;
+}
+
+bool JointStateDecoder::isLayoutValid(const sensor_msgs::JointState& _msg,
+                                      const LimbLayout& _layout)
+{
+    if (not _layout.ok)    { return false; }
+
+    for (size_t i = 0; i < NUM_JOINTS; ++i)
+    {
+        if (_layout.idx[i] >= _msg.name.size() ||
+            _msg.name[_layout.idx[i]] != _layout.names[i])    { return false; }
+    }
+
+    return true;
+}
+
+void JointStateDecoder::resolveLayout(const sensor_msgs::JointState& _msg)
+{
+    const size_t NOT_FOUND = numeric_limits<size_t>::max();
+
+    for (auto it = limbs.begin(); it != limbs.end(); ++it)
+    {
+        it->second.found.fill(NOT_FOUND);
+        it->second.num_found = 0;
+    }
+
+    for (size_t j = 0; j < _msg.name.size(); ++j)
+    {
+        auto it = lookup.find(_msg.name[j]);
+
+        if (it != lookup.end())
+        {
+            LimbLayout& layout = *(it->second.first);
+            size_t&      found = layout.found[it->second.second];
+
+            if (found == NOT_FOUND)    { ++layout.num_found; }
+            found = j;
+        }
+    }
+
+    // Limbs that are not entirely in the message keep their layout
+    for (auto it = limbs.begin(); it != limbs.end(); ++it)
+    {
+        LimbLayout& layout = it->second;
+
+        if (layout.num_found == NUM_JOINTS && (not layout.ok || layout.idx != layout.found))
+        {
+            layout.idx = layout.found;
+            layout.ok  =         true;
+            ++num_resolves;
+        }
+    }
+}
+
+bool JointStateDecoder::decode(const sensor_msgs::JointState& _msg, const string& _limb,
+                               array<double, NUM_JOINTS>& _pos,
+                               array<double, NUM_JOINTS>& _vel)
+{
+    lock_guard<mutex> lck(mtx);
+
+    registerLimb(_limb);
+
+    const LimbLayout& layout = limbs.at(_limb);
+
+    if (not isLayoutValid(_msg, layout))
+    {
+        resolveLayout(_msg);
+
+        // Messages that do not carry the full state of this limb
+        // (e.g. the ones coming from the grippers) are not decoded
+        if (not isLayoutValid(_msg, layout))    { return false; }
+    }
+
+    for (size_t i = 0; i < NUM_JOINTS; ++i)
+    {
+        size_t j = layout.idx[i];
+
+        if (j >= _msg.position.size())    { return false; }
+
+        _pos[i] = _msg.position[j];
+        _vel[i] = j < _msg.velocity.size()? _msg.velocity[j] : 0.0;
+    }
+
+    return true;
+}
+
+unsigned long JointStateDecoder::getNumResolves()
+{
+    lock_guard<mutex> lck(mtx);
+
+    return num_resolves;
+}
+
+JointStateDecoder::~JointStateDecoder()
+{
+
+}
@@ -1,22 +1,46 @@
 #include "robot_interface/robot_interface.h"
 
 #include <tf/transform_datatypes.h>
+#include <boost/make_shared.hpp>
 
 using namespace              std;
 using namespace            Eigen;
 using namespace intera_core_msgs;
 
+#define IK_WARM_START_TIMEOUT   0.1 // [s]
+#define CTRL_STATS_PERIOD       1.0 // [s]
+#define CMD_KEEPALIVE_RATE    100.0 // [Hz]
+
+/**************************************************************************/
+/*                           RobotState                                   */
+/**************************************************************************/
+RobotState::RobotState() : jnts_ok(false), ir_ok(false), range(0.0), min_range(0.0),
+                           max_range(0.0), is_coll_av_on(false), is_coll_det_on(false)
+{
+    pos.fill(0.0);
+    ori.fill(0.0);
+    force.fill(0.0);
+    torque.fill(0.0);
+    filt_force.fill(0.0);
+    jnts_pos.fill(0.0);
+    jnts_vel.fill(0.0);
+}
+
 /**************************************************************************/
 /*                         RobotInterface                                 */
 /**************************************************************************/
+JointStateDecoder RobotInterface::jnts_decoder;
+
 RobotInterface::RobotInterface(string _name, string _limb, bool _use_robot, bool _use_simulator, double _ctrl_freq,
                                bool _use_forces, bool _use_trac_ik, bool _use_cart_ctrl, bool _is_experimental) :
                                nh(_name), name(_name), limb(_limb), state(START), spinner(8), use_robot(_use_robot), use_simulator(_use_simulator),
-                               use_forces(_use_forces), ir_ok(false), curr_range(0.0), curr_min_range(0.0), curr_max_range(0.0),
+                               use_forces(_use_forces), motion_seq(0), cmd_keepalive_rate(CMD_KEEPALIVE_RATE),
                                ik_solver(_limb, "stp_021808TP00080", _use_robot), use_trac_ik(_use_trac_ik), ctrl_freq(_ctrl_freq),
+                               rt_ctrl(false), rt_priority(0), rt_cpu(-1), ctrl_loop(_ctrl_freq),
                                filt_force(0.0, 0.0, 0.0), filt_change(0.0, 0.0, 0.0), time_filt_last_updated(ros::Time::now()),
-                               is_coll_av_on(false), is_coll_det_on(false), is_closing(false), use_cart_ctrl(_use_cart_ctrl),
+                               is_closing(false), use_cart_ctrl(_use_cart_ctrl),
                                is_ctrl_running(false), is_experimental(_is_experimental), ctrl_track_mode(false),
+                               use_inline_traj(false),
                                ctrl_mode(human_robot_collaboration_msgs::GoToPose::POSITION_MODE),
                                ctrl_check_mode("strict"), ctrl_type("pose"), print_level(0), rviz_pub(_name)
 {
@@ -36,17 +60,42 @@ RobotInterface::RobotInterface(string _name, string _limb, bool _use_robot, bool
     }
 
     nh.param<int> ("/print_level", print_level, 0);
+    nh.param<bool>("inline_trajectory", use_inline_traj, false);
+    nh.param<bool>("rt_ctrl",                   rt_ctrl, false);
+    nh.param<int> ("rt_priority",           rt_priority,     0);
+    nh.param<int> ("rt_cpu",                     rt_cpu,    -1);
+    nh.param<double>("cmd_keepalive_rate", cmd_keepalive_rate, CMD_KEEPALIVE_RATE);
+
+    if (cmd_keepalive_rate <= 0.0)
+    {
+        ROS_WARN("[%s] Invalid cmd_keepalive_rate %g. Using %g [Hz] instead.",
+                   getLimb().c_str(), cmd_keepalive_rate, CMD_KEEPALIVE_RATE);
+        cmd_keepalive_rate = CMD_KEEPALIVE_RATE;
+    }
 
     ROS_INFO_COND(print_level>=0, "[%s] Print Level set to %i", getLimb().c_str(), print_level);
     ROS_INFO_COND(print_level>=1, "[%s] Cartesian Controller %s enabled", getLimb().c_str(), use_cart_ctrl?"is":"is NOT");
     ROS_INFO_COND(print_level>=1 && use_cart_ctrl, "[%s] ctrlFreq set to %g [Hz]", getLimb().c_str(), getCtrlFreq());
+    ROS_INFO_COND(print_level>=1 && use_cart_ctrl, "[%s] Inline trajectory %s enabled", getLimb().c_str(), use_inline_traj?"is":"is NOT");
     ROS_INFO_COND(print_level>=3, "[%s] Force Threshold : %g", getLimb().c_str(), force_thres);
     ROS_INFO_COND(print_level>=3, "[%s] Force Filter Variance: %g", getLimb().c_str(), filt_variance);
     ROS_INFO_COND(print_level>=3, "[%s] Relative Force Threshold: %g", getLimb().c_str(), rel_force_thres);
+    ROS_INFO_COND(print_level>=3, "[%s] Command keep-alive rate: %g [Hz]", getLimb().c_str(), cmd_keepalive_rate);
 
     joint_cmd_pub  = nh.advertise<JointCommand>("/robot/limb/" + getLimb() + "/joint_command", 200);
     coll_av_pub    = nh.advertise<std_msgs::Empty>("/robot/limb/" + getLimb() + "/suppress_collision_avoidance", 200);
 
+    // The joint names and the joint command are formatted once, and only the
+    // payload of the command is updated at every cycle of the controller
+    for (int i = 0; i < NUM_JOINTS; ++i)
+    {
+        jnt_names.push_back(getLimb() + "_j" + toString(i));
+    }
+
+    jnt_cmd = boost::make_shared<JointCommand>();
+    jnt_cmd->names = jnt_names;
+    jnt_cmd->position.reserve(NUM_JOINTS);
+
     endpt_sub      = nh.subscribe("/robot/limb/" + getLimb() + "/endpoint_state",
                                    SUBSCRIBER_BUFFER, &RobotInterface::endpointCb, this);
 
@@ -59,6 +108,7 @@ RobotInterface::RobotInterface(string _name, string _limb, bool _use_robot, bool
     cuff_sub_upper = nh.subscribe("/robot/digital_io/" + getLimb() + "_upper_button/state",
                                    SUBSCRIBER_BUFFER, &RobotInterface::cuffUpperCb, this);
 
+    jnts_decoder.addLimb(getLimb());
     jntstate_sub   = nh.subscribe("/robot/joint_states",
                                    SUBSCRIBER_BUFFER, &RobotInterface::jointStatesCb, this);
 
@@ -80,6 +130,16 @@ RobotInterface::RobotInterface(string _name, string _limb, bool _use_robot, bool
         string topic = "/" + getName() + "/" + getLimb() + "/go_to_pose";
         ctrl_sub     = nh.subscribe(topic, SUBSCRIBER_BUFFER, &RobotInterface::ctrlMsgCb, this);
         ROS_INFO_COND(print_level>=1, "[%s] Created cartesian controller that listens to : %s", getLimb().c_str(), topic.c_str());
+
+        if (rt_ctrl)
+        {
+            topic            = "/" + getName() + "/" + getLimb() + "/ctrl_stats";
+            ctrl_stats_pub   = nh.advertise<human_robot_collaboration_msgs::CtrlLoopStats>(topic, SUBSCRIBER_BUFFER);
+            ctrl_stats_timer = nh.createTimer(ros::Duration(CTRL_STATS_PERIOD),
+                                              &RobotInterface::publishCtrlStatsCb, this);
+            ROS_INFO_COND(print_level>=1, "[%s] Real-time control loop enabled. Priority: %i CPU: %i Stats: %s",
+                                          getLimb().c_str(), rt_priority, rt_cpu, topic.c_str());
+        }
     }
 
     if (not use_trac_ik)
@@ -111,6 +171,22 @@ void RobotInterface::ThreadEntry()
 {
     ros::Rate r(ctrl_freq);
 
+    if (rt_ctrl)
+    {
+        if (rt_priority > 0 && not RTLoop::setPriority(rt_priority))
+        {
+            ROS_WARN("[%s] Could not set the priority of the control loop to %i. "
+                     "Does the process have the rights to do so?", getLimb().c_str(), rt_priority);
+        }
+
+        if (rt_cpu >= 0 && not RTLoop::setAffinity(rt_cpu))
+        {
+            ROS_WARN("[%s] Could not pin the control loop to CPU %i", getLimb().c_str(), rt_cpu);
+        }
+
+        ctrl_loop.start();
+    }
+
     while (ros::ok() && not isClosing())
     {
         // ROS_INFO("Time: %g", (ros::Time::now() - initTime).toSec());
@@ -133,7 +209,13 @@ void RobotInterface::ThreadEntry()
                 pose_curr = pose_des;
 
                 /* POSITIONAL PART */
-                Eigen::Vector3d pos_curr = particle->getCurrPoint();
+                ParticleThread<3>::Point pos_curr = particle->getCurrPoint();
+
+                // If the particle thread is not running, the trajectory is evaluated here
+                if (not particle->isRunning())
+                {
+                    particle->evaluate(time_elap, pos_curr);
+                }
 
                 geometry_msgs::Point p_c;
                 p_c.x = pos_curr[0];
@@ -164,7 +246,17 @@ void RobotInterface::ThreadEntry()
                 // ROS_INFO("[%s] Current Pose: %s Time %g/%g", getLimb().c_str(), print(pose_curr).c_str(),
                 //                                                                    time_elap, traj_time);
 
-                if (!goToPoseNoCheck(pose_curr))
+                // IK and publishing are timed separately, so that they can be told
+                // apart from the scheduling jitter in the statistics of the control loop
+                VectorXd joint_angles;
+                double t_ik  = RTLoop::now();
+                bool res     = computeIK(pose_curr, joint_angles);
+                double t_pub = RTLoop::now();
+                res          = res && goToJointConfNoCheck(joint_angles);
+                ctrl_loop.setIKTime(t_pub - t_ik);
+                ctrl_loop.setPubTime(RTLoop::now() - t_pub);
+
+                if (!res)
                 {
                     ROS_WARN("[%s] desired configuration could not be reached.", getLimb().c_str());
                     setCtrlRunning(false);
@@ -187,11 +279,26 @@ void RobotInterface::ThreadEntry()
             }
         }
 
-        r.sleep();
+        if (rt_ctrl)    { ctrl_loop.sleep(); }
+        else            {         r.sleep(); }
     }
+
+    ROS_INFO_COND(print_level>=1 && rt_ctrl, "[%s] Control loop jitter histogram:\n%s",
+                  getLimb().c_str(), ctrl_loop.getStats().printHistogram().c_str());
+
     return;
 }
 
+void RobotInterface::publishCtrlStatsCb(const ros::TimerEvent&)
+{
+    human_robot_collaboration_msgs::CtrlLoopStats msg;
+
+    ctrl_loop.getStats().toMsg(msg);
+    msg.header.stamp = ros::Time::now();
+
+    ctrl_stats_pub.publish(msg);
+}
+
 void RobotInterface::setIsClosing(bool arg)
 {
     std::lock_guard<std::mutex> lck(mtx_is_closing);
@@ -228,7 +335,13 @@ bool RobotInterface::initCtrlParams()
     time_start = ros::Time::now();
     pose_start = getPose();
 
-    particle.reset(new LinearPointParticle(getName()+"/"+getLimb(), THREAD_FREQ, true));
+    // In inline mode, the particle is created only once (without rviz visualization
+    // since it would need its own thread) and then reused for every target
+    if (not use_inline_traj || not particle || particle->isRunning())
+    {
+        particle.reset(new LinearPointParticle(getName()+"/"+getLimb(), THREAD_FREQ,
+                                               not use_inline_traj));
+    }
 
     Eigen::Vector3d ps(pose_start.position.x, pose_start.position.y, pose_start.position.z);
     Eigen::Vector3d pd(  pose_des.position.x,   pose_des.position.y,   pose_des.position.z);
@@ -236,6 +349,8 @@ bool RobotInterface::initCtrlParams()
     LinearPointParticle *derived = dynamic_cast<LinearPointParticle*>(particle.get());
     derived->setupParticle(ps, pd, ARM_SPEED);
 
+    if (use_inline_traj)    { return particle->isSet(); }
+
     return particle->isSet() && particle->start();
 }
 
@@ -384,7 +499,9 @@ void RobotInterface::setCtrlRunning(bool _flag)
     else
     {
         rviz_pub.stop();
-        particle.reset();
+
+        // In inline mode the particle is kept, so that it can be reused
+        if (not use_inline_traj)    { particle.reset(); }
         // setState(   CTRL_DONE);
     }
 
@@ -403,10 +520,18 @@ bool RobotInterface::isCtrlRunning()
 
 void RobotInterface::collAvCb(const intera_core_msgs::CollisionAvoidanceState& _msg)
 {
-    if (_msg.collision_object.size()!=0)
+    bool coll_av_on = _msg.collision_object.size()!=0;
+
+    robot_state.update([coll_av_on](RobotState& _s)
     {
-        is_coll_av_on =  true;
+        _s.coll_av_stamp = ros::Time::now();
+        _s.is_coll_av_on =        coll_av_on;
+    });
+
+    notifyMotionUpdate();
 
+    if (coll_av_on)
+    {
         string objects = "";
         for (size_t i = 0; i < _msg.collision_object.size(); ++i)
         {
@@ -417,56 +542,44 @@ void RobotInterface::collAvCb(const intera_core_msgs::CollisionAvoidanceState& _
         ROS_WARN_THROTTLE(1, "[%s] Collision avoidance with: %s",
                              getLimb().c_str(), objects.c_str());
     }
-    else is_coll_av_on = false;
 
     return;
 }
 
 void RobotInterface::collDetCb(const intera_core_msgs::CollisionDetectionState& _msg)
 {
-    if (_msg.collision_state==true)
+    bool coll_det_on = _msg.collision_state;
+
+    robot_state.update([coll_det_on](RobotState& _s)
     {
-        is_coll_det_on = true;
+        _s.coll_det_stamp = ros::Time::now();
+        _s.is_coll_det_on =       coll_det_on;
+    });
 
+    if (coll_det_on)
+    {
         ROS_WARN_THROTTLE(1, "[%s] Collision detected!", getLimb().c_str());
     }
-    else is_coll_det_on = false;
 
     return;
 }
 
 void RobotInterface::jointStatesCb(const sensor_msgs::JointState& _msg)
 {
-    JointCommand joint_cmd;
-    setJointNames(joint_cmd);
+    // ROS_INFO("[%s] jointStatesCb", getLimb().c_str());
+    std::array<double, NUM_JOINTS> jnts_pos;
+    std::array<double, NUM_JOINTS> jnts_vel;
 
-    if (_msg.name.size() >= joint_cmd.names.size())
+    // Messages that do not carry the full state of this limb are discarded
+    if (jnts_decoder.decode(_msg, limb, jnts_pos, jnts_vel))
     {
-        // ROS_INFO("[%s] jointStatesCb", getLimb().c_str());
-        std::lock_guard<std::mutex> lck(mtx_jnts);
-
-        // cout << "Joint state ";
-        // for (size_t i = 9; i < 16; ++i)
-        // {
-        //     cout << "[" << i << "] " << _msg.name[i] << " " << _msg.position[i] << "\t";
-        // }
-        // cout << endl;
-        curr_jnts.name.clear();
-        curr_jnts.position.clear();
-        curr_jnts.velocity.clear();
-
-        for (size_t i = 0; i < joint_cmd.names.size(); ++i)
+        robot_state.update([&jnts_pos, &jnts_vel](RobotState& _s)
         {
-            for (size_t j = 0; j < _msg.name.size(); ++j)
-            {
-                if (joint_cmd.names[i] == _msg.name[j])
-                {
-                    curr_jnts.name.push_back(_msg.name[j]);
-                    curr_jnts.position.push_back(_msg.position[j]);
-                    curr_jnts.velocity.push_back(_msg.velocity[j]);
-                }
-            }
-        }
+            _s.jnts_stamp = ros::Time::now();
+            _s.jnts_ok    =             true;
+            _s.jnts_pos   =         jnts_pos;
+            _s.jnts_vel   =         jnts_vel;
+        });
     }
 
     return;
@@ -507,43 +620,47 @@ void RobotInterface::cuffUpperCb(const intera_core_msgs::DigitalIOState& _msg)
 void RobotInterface::endpointCb(const intera_core_msgs::EndpointState& _msg)
 {
     ROS_INFO_COND(print_level>=12, "endpointCb");
-    tf::StampedTransform _transform;
-    if (1)
+
+    geometry_msgs::Pose pose = _msg.pose;
+
+    try
     {
-        try
-        {
-            tf_listener.lookupTransform("/base", "/stp_021808TP00080_tip", ros::Time(0), _transform);
-            curr_pos.x = _transform.getOrigin().x();
-            curr_pos.y = _transform.getOrigin().y();
-            curr_pos.z = _transform.getOrigin().z();
-            curr_ori.x = _transform.getRotation().x();
-            curr_ori.y = _transform.getRotation().y();
-            curr_ori.z = _transform.getRotation().z();
-            curr_ori.w = _transform.getRotation().w();
-        }
-        catch (tf::TransformException ex)
-        {
-            //ROS_ERROR("%s", ex.what());
-            curr_pos = _msg.pose.position;
-            curr_ori = _msg.pose.orientation;
-        }
-        if (use_forces == true)
-        {
-            curr_wrench = _msg.wrench;
-            filterForces();
-        }
+        tf::StampedTransform _transform;
+        tf_listener.lookupTransform("/base", "/stp_021808TP00080_tip", ros::Time(0), _transform);
+        pose.position.x    = _transform.getOrigin().x();
+        pose.position.y    = _transform.getOrigin().y();
+        pose.position.z    = _transform.getOrigin().z();
+        pose.orientation.x = _transform.getRotation().x();
+        pose.orientation.y = _transform.getRotation().y();
+        pose.orientation.z = _transform.getRotation().z();
+        pose.orientation.w = _transform.getRotation().w();
     }
-    else
+    catch (tf::TransformException ex)
     {
-        curr_pos = _msg.pose.position;
-        curr_ori = _msg.pose.orientation;
+        //ROS_ERROR("%s", ex.what());
+    }
+
+    if (use_forces == true)
+    {
+        filterForces(_msg.wrench.force);
+    }
+
+    robot_state.update([&](RobotState& _s)
+    {
+        _s.endpt_stamp = ros::Time::now();
+        _s.pos = {{pose.position.x, pose.position.y, pose.position.z}};
+        _s.ori = {{pose.orientation.x, pose.orientation.y,
+                   pose.orientation.z, pose.orientation.w}};
 
         if (use_forces == true)
         {
-            curr_wrench = _msg.wrench;
-            filterForces();
+            _s.force      = {{_msg.wrench.force.x,  _msg.wrench.force.y,  _msg.wrench.force.z}};
+            _s.torque     = {{_msg.wrench.torque.x, _msg.wrench.torque.y, _msg.wrench.torque.z}};
+            _s.filt_force = {{filt_force[0], filt_force[1], filt_force[2]}};
         }
-    }
+    });
+
+    notifyMotionUpdate();
 
     return;
 }
@@ -551,19 +668,20 @@ void RobotInterface::endpointCb(const intera_core_msgs::EndpointState& _msg)
 void RobotInterface::IRCb(const sensor_msgs::Range& _msg)
 {
     ROS_INFO_COND(print_level>=12, "IRCb");
-    curr_range     = _msg.range;
-    curr_max_range = _msg.max_range;
-    curr_min_range = _msg.min_range;
 
-    if (!ir_ok)
+    robot_state.update([&_msg](RobotState& _s)
     {
-        ir_ok = true;
-    }
+        _s.ir_stamp  =  ros::Time::now();
+        _s.ir_ok     =              true;
+        _s.range     =        _msg.range;
+        _s.max_range =    _msg.max_range;
+        _s.min_range =    _msg.min_range;
+    });
 
     return;
 }
 
-void RobotInterface::filterForces()
+void RobotInterface::filterForces(const geometry_msgs::Vector3& _force)
 {
     double time_elap = ros::Time::now().toSec() - time_filt_last_updated.toSec();
 
@@ -572,9 +690,9 @@ void RobotInterface::filterForces()
 
     // initial attempt to update filter using a running average of
     // the forces on the arm (exponential moving average)
-    new_filt[0] = (1 - FORCE_ALPHA) * filt_force[0] + FORCE_ALPHA * curr_wrench.force.x;
-    new_filt[1] = (1 - FORCE_ALPHA) * filt_force[1] + FORCE_ALPHA * curr_wrench.force.y;
-    new_filt[2] = (1 - FORCE_ALPHA) * filt_force[2] + FORCE_ALPHA * curr_wrench.force.z;
+    new_filt[0] = (1 - FORCE_ALPHA) * filt_force[0] + FORCE_ALPHA * _force.x;
+    new_filt[1] = (1 - FORCE_ALPHA) * filt_force[1] + FORCE_ALPHA * _force.y;
+    new_filt[2] = (1 - FORCE_ALPHA) * filt_force[2] + FORCE_ALPHA * _force.z;
 
     for (int i = 0; i < 3; ++i)
     {
@@ -631,22 +749,35 @@ bool RobotInterface::goToPoseNoCheck(double px, double py, double pz,
     return goToJointConfNoCheck(joint_angles);
 }
 
-bool RobotInterface::goToJointConfNoCheck(VectorXd joint_values)
+bool RobotInterface::goToJointConfNoCheck(const VectorXd& joint_values)
 {
-    JointCommand     joint_cmd;
-    joint_cmd.mode = ctrl_mode;
+    std::lock_guard<std::mutex> lck(mtx_jnt_cmd);
+
+    // The command is updated in place, unless the previous one is still being
+    // held by an intra-process subscriber: in that case it cannot be modified
+    // under its feet, and a new one is created out of it
+    if (jnt_cmd.use_count() > 1)
+    {
+        jnt_cmd = boost::make_shared<JointCommand>(*jnt_cmd);
+    }
 
-    setJointNames(joint_cmd);
+    jnt_cmd->mode = ctrl_mode;
 
-    if (joint_cmd.mode == human_robot_collaboration_msgs::GoToPose::POSITION_MODE)
+    if (jnt_cmd->mode == human_robot_collaboration_msgs::GoToPose::POSITION_MODE)
     {
+        jnt_cmd->position.resize(joint_values.size());
+
         for (int i = 0; i < joint_values.size(); ++i)
         {
-            joint_cmd.position.push_back(joint_values[i]);
+            jnt_cmd->position[i] = joint_values[i];
         }
     }
+    else
+    {
+        jnt_cmd->position.clear();
+    }
 
-    publishJointCmd(joint_cmd);
+    publishJointCmd(jnt_cmd);
 
     return true;
 }
@@ -658,30 +789,38 @@ bool RobotInterface::goToPose(double px, double py, double pz,
     VectorXd joint_angles;
     if (!computeIK(px, py, pz, ox, oy, oz, ow, joint_angles)) return false;
 
-    ros::Rate r(800);
+    // The pose is checked every time the state of the robot is updated, while the
+    // command (and the suppression of the collision avoidance) is only republished
+    // at the keep-alive rate of the robot. Waits are bounded by the keep-alive period,
+    // so that closing or killing the robot interface is handled in time.
+    double        keepalive = 1.0 / cmd_keepalive_rate;
+    double         next_pub =            RTLoop::now();
+    unsigned long       seq =                        0;
+
     while (RobotInterface::ok() && not isClosing())
     {
-        if (disable_coll_av)
+        if (not disable_coll_av && getRobotState().is_coll_av_on == true)
         {
-            suppressCollisionAv();
+            ROS_ERROR("Collision Occurred! Stopping.");
+            return false;
         }
-        else
+
+        double now = RTLoop::now();
+        if (now >= next_pub)
         {
-            if (is_coll_av_on == true)
-            {
-                ROS_ERROR("Collision Occurred! Stopping.");
-                return false;
-            }
-        }
+            if (disable_coll_av)    { suppressCollisionAv(); }
+
+            if (!goToJointConfNoCheck(joint_angles))   return false;
 
-        if (!goToJointConfNoCheck(joint_angles))   return false;
+            next_pub = now + keepalive;
+        }
 
         if (isPoseReached(px, py, pz, ox, oy, oz, ow, mode))
         {
             return true;
         }
 
-        r.sleep();
+        waitForMotionUpdate(seq, next_pub - RTLoop::now());
     }
 
     return false;
@@ -702,80 +841,69 @@ bool RobotInterface::computeIK(double px, double py, double pz,
                                double ox, double oy, double oz, double ow,
                                VectorXd& j)
 {
-    geometry_msgs::PoseStamped pose_stamp;
-    pose_stamp.header.frame_id = "base";
-    pose_stamp.header.stamp    = ros::Time::now();
+    // The IK engine is warm started from its last solution. If there is none,
+    // or if it is too old to be trusted (i.e. the arm may have moved in the
+    // meantime), the engine is re-seeded with the current joint configuration.
+    // The cache of recent solutions is not cleared, since they do not depend
+    // on the state of the arm: it is thus shared across motions (e.g. a pose
+    // that is reached over and over again is solved only once).
+    if (not ik_solver.hasWarmStart() ||
+        (ros::Time::now() - time_last_ik).toSec() > IK_WARM_START_TIMEOUT)
+    {
+        RobotState rs = getRobotState();
 
-    setPosition(   pose_stamp.pose, px, py, pz);
-    setOrientation(pose_stamp.pose, ox, oy, oz, ow);
+        ik_solver.resetWarmStart();
+
+        if (rs.jnts_ok)
+        {
+            ik_solver.setSeed(Map<VectorXd>(rs.jnts_pos.data(), rs.jnts_pos.size()));
+        }
+    }
+
+    Vector3d    pos(px, py, pz);
+    Quaterniond ori(ow, ox, oy, oz);
 
-    j.resize(0);
     ros::Time start = ros::Time::now();
-    float thresh_z = pose_stamp.pose.position.z + 0.01;
+    double thresh_z = pz + 0.01;
 
     while (RobotInterface::ok())
     {
-        SolvePositionIK ik_srv;
-
-        pose_stamp.header.stamp=ros::Time::now();
-
-        //ik_srv.request.seed_mode=2;       // i.e. SEED_CURRENT
-        ik_srv.request.seed_mode=0;         // i.e. SEED_AUTO
-
-        ik_srv.request.pose_stamp.push_back(pose_stamp);
-        ik_srv.request.seed_angles.push_back(getJointStates());
-
         ros::Time tn = ros::Time::now();
 
-        //bool result = use_trac_ik?ik_solver.perform_ik(ik_srv):ik_client.call(ik_srv);
-        bool result = ik_solver.perform_ik(ik_srv);
-
-        if(result)
+        if (ik_solver.solveIK(pos, ori, j))
         {
-            double te  = ros::Time::now().toSec()-tn.toSec();;
+            time_last_ik = ros::Time::now();
+
+            double te  = time_last_ik.toSec()-tn.toSec();
             if (te>0.010)
             {
                 ROS_WARN_ONCE("\t\t\tTime elapsed in computing IK: %g",te);
             }
 
-            if (ik_srv.response.result_type[0])
-            {
-                ROS_INFO_COND(print_level>=6, "Got solution!");
-
-                j.resize(ik_srv.response.joints[0].position.size());
-
-                for (size_t i = 0; i < ik_srv.response.joints[0].position.size(); ++i)
-                {
-                    j[i] = ik_srv.response.joints[0].position[i];
-                }
-                return true;
-            }
-            else
-            {
-                // if position cannot be reached, try a position with the same x-y coordinates
-                // but higher z (useful when placing tokens)
-                ROS_INFO_COND(print_level>=4, "[%s] IK solution not valid: %g %g %g",
-                                                                   getLimb().c_str(),
-                                                          pose_stamp.pose.position.x,
-                                                          pose_stamp.pose.position.y,
-                                                          pose_stamp.pose.position.z);
-                pose_stamp.pose.position.z += 0.001;
-            }
+            ROS_INFO_COND(print_level>=6, "Got solution!");
+            return true;
+        }
+        else
+        {
+            // if position cannot be reached, try a position with the same x-y coordinates
+            // but higher z (useful when placing tokens)
+            ROS_INFO_COND(print_level>=4, "[%s] IK solution not valid: %g %g %g",
+                                        getLimb().c_str(), pos[0], pos[1], pos[2]);
+            pos[2] += 0.001;
         }
 
         // if no solution is found within 50 milliseconds or no solution within the acceptable
         // z-coordinate threshold is found, then no solution exists and exit out of loop
-        if ((ros::Time::now() - start).toSec() > 0.05 || pose_stamp.pose.position.z > thresh_z)
+        if ((ros::Time::now() - start).toSec() > 0.05 || pos[2] > thresh_z)
         {
             ROS_WARN("[%s] Did not find a suitable IK solution! Final Position %g %g %g",
-                                                                       getLimb().c_str(),
-                                                              pose_stamp.pose.position.x,
-                                                              pose_stamp.pose.position.y,
-                                                              pose_stamp.pose.position.z);
+                                          getLimb().c_str(), pos[0], pos[1], pos[2]);
+            j.resize(0);
             return false;
         }
     }
 
+    j.resize(0);
     return false;
 }
 
@@ -798,16 +926,18 @@ bool RobotInterface::hasCollidedIR(string mode)
         return false;
     }
 
-    if (curr_range <= curr_max_range &&
-        curr_range >= curr_min_range &&
-        curr_range <= thres             ) return true;
+    RobotState rs = getRobotState();
+
+    if (rs.range <= rs.max_range &&
+        rs.range >= rs.min_range &&
+        rs.range <= thres          ) return true;
 
     return false;
 }
 
 bool RobotInterface::hasCollidedCD()
 {
-    return is_coll_det_on;
+    return getRobotState().is_coll_det_on;
 }
 
 bool RobotInterface::isPoseReached(geometry_msgs::Pose p, string mode, string type)
@@ -856,17 +986,19 @@ bool RobotInterface::isPositionReached(double px, double py, double pz, string m
     // ROS_INFO("[%s] Checking %s position. Error: %g %g %g", getLimb().c_str(),
     //               mode.c_str(), px-getPos().x, py-getPos().y, pz-getPos().z);
 
+    RobotState rs = getRobotState();
+
     if (mode == "strict")
     {
-        if (abs(getPos().x-px) > 0.003) { return false; }
-        if (abs(getPos().y-py) > 0.003) { return false; }
-        if (abs(getPos().z-pz) > 0.003) { return false; }
+        if (abs(rs.pos[0]-px) > 0.003) { return false; }
+        if (abs(rs.pos[1]-py) > 0.003) { return false; }
+        if (abs(rs.pos[2]-pz) > 0.003) { return false; }
     }
     else if (mode == "loose")
     {
-        if (abs(getPos().x-px) > 0.010) { return false; }
-        if (abs(getPos().y-py) > 0.010) { return false; }
-        if (abs(getPos().z-pz) > 0.010) { return false; }
+        if (abs(rs.pos[0]-px) > 0.010) { return false; }
+        if (abs(rs.pos[1]-py) > 0.010) { return false; }
+        if (abs(rs.pos[2]-pz) > 0.010) { return false; }
     }
     else
     {
@@ -885,9 +1017,10 @@ bool RobotInterface::isOrientationReached(geometry_msgs::Quaternion q, string mo
 
 bool RobotInterface::isOrientationReached(double ox, double oy, double oz, double ow, string mode)
 {
+    RobotState rs = getRobotState();
+
     tf::Quaternion des(ox, oy, oz, ow);
-    tf::Quaternion cur;
-    tf::quaternionMsgToTF(getOri(), cur);
+    tf::Quaternion cur(rs.ori[0], rs.ori[1], rs.ori[2], rs.ori[3]);
 
     // ROS_INFO("[%s] Checking %s orientation. Curr %g %g %g %g Des %g %g %g %g Dot %g",
     //                                   getLimb().c_str(), mode.c_str(),
@@ -912,49 +1045,48 @@ bool RobotInterface::isOrientationReached(double ox, double oy, double oz, doubl
     return true;
 }
 
-bool RobotInterface::isConfigurationReached(VectorXd _dj, string _mode)
+bool RobotInterface::isConfigurationReached(const VectorXd& _dj, const string& _mode)
 {
-    if (_dj.size() < 7) { return false; }
+    if (_dj.size() < NUM_JOINTS) { return false; }
 
-    intera_core_msgs::JointCommand des_jnts;
-    setJointNames(des_jnts);
-    setJointCommands(_dj[0], _dj[1], _dj[2],
-                     _dj[3], _dj[4], _dj[5], _dj[6], des_jnts);
+    // The joint states are stored in the same order as the joint names,
+    // so there is no need to go through a JointCommand and match the names
+    RobotState rs = getRobotState();
 
-    return isConfigurationReached(des_jnts, _mode);
-}
-
-bool RobotInterface::isConfigurationReached(intera_core_msgs::JointCommand _dj, string _mode)
-{
-    sensor_msgs::JointState cj = getJointStates();
-
-    if (cj.position.size() < 7)    { return false; }
+    if (not rs.jnts_ok)    { return false; }
 
     ROS_INFO_COND(print_level>=6, "[%s] Checking configuration: Current %g %g %g %g %g %g %g"
                                                              "\tDesired %g %g %g %g %g %g %g",
                                                                             getLimb().c_str(),
-                               cj.position[0], cj.position[1], cj.position[2], cj.position[3],
-                                               cj.position[4], cj.position[5], cj.position[6],
-                               _dj.position[0], _dj.position[1], _dj.position[2], _dj.position[3],
-                                                _dj.position[4], _dj.position[5], _dj.position[6]);
+                        rs.jnts_pos[0], rs.jnts_pos[1], rs.jnts_pos[2], rs.jnts_pos[3],
+                                        rs.jnts_pos[4], rs.jnts_pos[5], rs.jnts_pos[6],
+                                 _dj[0],         _dj[1],         _dj[2],         _dj[3],
+                                                 _dj[4],         _dj[5],         _dj[6]);
+
+    for (int i = 0; i < NUM_JOINTS; ++i)
+    {
+        if (not isJointReached(_dj[i], rs.jnts_pos[i], _mode))    { return false; }
+    }
+
+    return true;
+}
+
+bool RobotInterface::isConfigurationReached(const intera_core_msgs::JointCommand& _dj,
+                                            const string& _mode)
+{
+    RobotState rs = getRobotState();
+
+    if (not rs.jnts_ok)                             { return false; }
+    if (_dj.position.size() < _dj.names.size())     { return false; }
 
     for (size_t i = 0; i < _dj.names.size(); ++i)
     {
         bool res = false;
-        for (size_t j = 0; j < cj.name.size(); ++j)
+        for (size_t j = 0; j < jnt_names.size(); ++j)
         {
-            if (_dj.names[i] == cj.name[j])
+            if (_dj.names[i] == jnt_names[j])
             {
-                if (_mode == "strict")
-                {
-                    // It's approximatively half a degree
-                    if (abs(_dj.position[i]-cj.position[j]) > 0.010) return false;
-                }
-                else if (_mode == "loose")
-                {
-                    // It's approximatively a degree
-                    if (abs(_dj.position[i]-cj.position[j]) > 0.020) return false;
-                }
+                if (not isJointReached(_dj.position[i], rs.jnts_pos[j], _mode))    { return false; }
                 res = true;
             }
         }
@@ -964,11 +1096,32 @@ bool RobotInterface::isConfigurationReached(intera_core_msgs::JointCommand _dj,
     return true;
 }
 
+bool RobotInterface::isJointReached(double _des, double _curr, const string& _mode)
+{
+    if (_mode == "strict")
+    {
+        // It's approximatively half a degree
+        return abs(_des - _curr) <= 0.010;
+    }
+    else if (_mode == "loose")
+    {
+        // It's approximatively a degree
+        return abs(_des - _curr) <= 0.020;
+    }
+
+    return true;
+}
+
 void RobotInterface::setTracIK(bool _use_trac_ik)
 {
     use_trac_ik = _use_trac_ik;
 };
 
+void RobotInterface::setInlineTraj(bool _use_inline_traj)
+{
+    use_inline_traj = _use_inline_traj;
+};
+
 bool RobotInterface::setCtrlType(const std::string &_ctrl_type)
 {
     if (_ctrl_type != "pose" && _ctrl_type != "position" && _ctrl_type != "orientation")
@@ -987,26 +1140,22 @@ bool RobotInterface::setCtrlType(const std::string &_ctrl_type)
 
 void RobotInterface::setJointNames(JointCommand& joint_cmd)
 {
-    joint_cmd.names.push_back(getLimb() + "_j0");
-    joint_cmd.names.push_back(getLimb() + "_j1");
-    joint_cmd.names.push_back(getLimb() + "_j2");
-    joint_cmd.names.push_back(getLimb() + "_j3");
-    joint_cmd.names.push_back(getLimb() + "_j4");
-    joint_cmd.names.push_back(getLimb() + "_j5");
-    joint_cmd.names.push_back(getLimb() + "_j6");
+    joint_cmd.names = jnt_names;
 }
 
 void RobotInterface::setJointCommands(double s0, double s1, double e0, double e1,
                                                  double w0, double w1, double w2,
                                       intera_core_msgs::JointCommand& joint_cmd)
 {
-    joint_cmd.position.push_back(s0);
-    joint_cmd.position.push_back(s1);
-    joint_cmd.position.push_back(e0);
-    joint_cmd.position.push_back(e1);
-    joint_cmd.position.push_back(w0);
-    joint_cmd.position.push_back(w1);
-    joint_cmd.position.push_back(w2);
+    joint_cmd.position.resize(NUM_JOINTS);
+
+    joint_cmd.position[0] = s0;
+    joint_cmd.position[1] = s1;
+    joint_cmd.position[2] = e0;
+    joint_cmd.position[3] = e1;
+    joint_cmd.position[4] = w0;
+    joint_cmd.position[5] = w1;
+    joint_cmd.position[6] = w2;
 }
 
 double RobotInterface::relativeDiff(double a, double b)
@@ -1022,12 +1171,13 @@ bool RobotInterface::detectForceInteraction()
 
     // compare the current force to the filter force. if the relative difference is above a
     // threshold defined in utils.h, return true
+    RobotState rs = getRobotState();
 
-    if (relativeDiff(curr_wrench.force.x, filt_force[0]) > rel_force_thres ||
-        relativeDiff(curr_wrench.force.y, filt_force[1]) > rel_force_thres ||
-        relativeDiff(curr_wrench.force.z, filt_force[2]) > rel_force_thres)
+    if (relativeDiff(rs.force[0], rs.filt_force[0]) > rel_force_thres ||
+        relativeDiff(rs.force[1], rs.filt_force[1]) > rel_force_thres ||
+        relativeDiff(rs.force[2], rs.filt_force[2]) > rel_force_thres)
     {
-        ROS_INFO("Interaction: %g %g %g", curr_wrench.force.x, curr_wrench.force.y, curr_wrench.force.z);
+        ROS_INFO("Interaction: %g %g %g", rs.force[0], rs.force[1], rs.force[2]);
         return true;
     }
     else
@@ -1065,8 +1215,7 @@ bool RobotInterface::waitForJointAngles(double _wait_time)
     ros::Rate r(100);
     while (RobotInterface::ok())
     {
-        sensor_msgs::JointState _jnt_state = getJointStates();
-        if (_jnt_state.position.size() > 0)      return true;
+        if (getRobotState().jnts_ok)      return true;
 
         r.sleep();
 
@@ -1083,19 +1232,65 @@ bool RobotInterface::waitForJointAngles(double _wait_time)
 sensor_msgs::JointState RobotInterface::getJointStates()
 {
     sensor_msgs::JointState cj;
+    RobotState rs = getRobotState();
 
-    std::lock_guard<std::mutex> lck(mtx_jnts);
-    cj = curr_jnts;
+    if (rs.jnts_ok)
+    {
+        cj.header.stamp = rs.jnts_stamp;
+        cj.name         = jnt_names;
+        cj.position.assign(rs.jnts_pos.begin(), rs.jnts_pos.end());
+        cj.velocity.assign(rs.jnts_vel.begin(), rs.jnts_vel.end());
+    }
 
     return   cj;
 }
 
+geometry_msgs::Point RobotInterface::getPos()
+{
+    RobotState rs = getRobotState();
+
+    geometry_msgs::Point res;
+    res.x = rs.pos[0];
+    res.y = rs.pos[1];
+    res.z = rs.pos[2];
+
+    return res;
+}
+
+geometry_msgs::Quaternion RobotInterface::getOri()
+{
+    RobotState rs = getRobotState();
+
+    geometry_msgs::Quaternion res;
+    quaternionFromDoubles(res, rs.ori[0], rs.ori[1], rs.ori[2], rs.ori[3]);
+
+    return res;
+}
+
+geometry_msgs::Wrench RobotInterface::getWrench()
+{
+    RobotState rs = getRobotState();
+
+    geometry_msgs::Wrench res;
+    res.force.x  =  rs.force[0];
+    res.force.y  =  rs.force[1];
+    res.force.z  =  rs.force[2];
+    res.torque.x = rs.torque[0];
+    res.torque.y = rs.torque[1];
+    res.torque.z = rs.torque[2];
+
+    return res;
+}
+
 geometry_msgs::Pose RobotInterface::getPose()
 {
-    geometry_msgs::Pose res;
+    RobotState rs = getRobotState();
 
-    res.position    = getPos();
-    res.orientation = getOri();
+    geometry_msgs::Pose res;
+    res.position.x = rs.pos[0];
+    res.position.y = rs.pos[1];
+    res.position.z = rs.pos[2];
+    quaternionFromDoubles(res.orientation, rs.ori[0], rs.ori[1], rs.ori[2], rs.ori[3]);
 
     return res;
 }
@@ -1132,7 +1327,29 @@ bool RobotInterface::publishState()
     return true;
 }
 
-void RobotInterface::publishJointCmd(intera_core_msgs::JointCommand _cmd)
+void RobotInterface::notifyMotionUpdate()
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx_motion);
+        ++motion_seq;
+    }
+
+    cv_motion.notify_all();
+}
+
+bool RobotInterface::waitForMotionUpdate(unsigned long& _seq, double _timeout)
+{
+    std::unique_lock<std::mutex> lck(mtx_motion);
+
+    bool res = cv_motion.wait_for(lck, std::chrono::duration<double>(std::max(0.0, _timeout)),
+                                  [&]{ return motion_seq != _seq; });
+
+    _seq = motion_seq;
+
+    return res;
+}
+
+void RobotInterface::publishJointCmd(const intera_core_msgs::JointCommandConstPtr& _cmd)
 {
     // cout << "Joint Command: " << _cmd << endl;
     joint_cmd_pub.publish(_cmd);
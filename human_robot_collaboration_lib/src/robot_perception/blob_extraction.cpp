@@ -0,0 +1,166 @@
+#include "robot_perception/blob_extraction.h"
+
+#include <cstring>
+
+using namespace std;
+
+int BlobExtractor::findRoot(int _run)
+{
+    while (parents[_run] != _run)
+    {
+        parents[_run] = parents[parents[_run]];
+        _run          = parents[_run];
+    }
+
+    return _run;
+}
+
+template<typename T>
+void BlobExtractor::extractRuns(const cv::Mat& _src, T _bits)
+{
+    runs.clear();
+    parents.clear();
+    blobs.clear();
+
+    // Runs of the previous row that may still touch the runs of the current one
+    size_t prev_first = 0, prev_last = 0;
+
+    for (int y = 0; y < _src.rows; ++y)
+    {
+        const T *row = _src.ptr<T>(y);
+
+        size_t curr_first = runs.size();
+
+        int x = 0;
+
+        while (x < _src.cols)
+        {
+            while (x < _src.cols && not (row[x] & _bits))    { ++x; }
+            if (x == _src.cols)    { break; }
+
+            Run run;
+            run.y       = y;
+            run.x_start = x;
+
+            while (x < _src.cols &&     (row[x] & _bits))    { ++x; }
+
+            run.x_end = x - 1;
+            run.blob  =    -1;
+
+            int curr = int(runs.size());
+            runs.push_back(run);
+            parents.push_back(curr);
+
+            // With 8-connectivity, runs touch if they overlap once extended by one pixel.
+            // Runs of the previous row that end before this one cannot touch the next ones either
+            for (size_t p = prev_first; p < prev_last; ++p)
+            {
+                if (runs[p].x_end + 1 < run.x_start)
+                {
+                    prev_first = p + 1;
+                    continue;
+                }
+
+                if (runs[p].x_start > run.x_end + 1)    { break; }
+
+                // The root with the lowest index is kept, so that roots come first
+                int root_p = findRoot(int(p)), root_c = findRoot(curr);
+
+                if      (root_p < root_c)    { parents[root_c] = root_p; }
+                else if (root_c < root_p)    { parents[root_p] = root_c; }
+            }
+        }
+
+        prev_first = curr_first;
+        prev_last  = runs.size();
+    }
+
+    // Roots come before the other runs of their blob, so blobs are resolved in a single pass
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        int root = findRoot(int(i));
+        Run &run = runs[i];
+
+        cv::Rect box(run.x_start, run.y, run.x_end - run.x_start + 1, 1);
+
+        if (root == int(i))
+        {
+            run.blob = int(blobs.size());
+
+            Blob blob;
+            blob.area = box.width;
+            blob.bbox =       box;
+            blobs.push_back(blob);
+        }
+        else
+        {
+            run.blob = runs[root].blob;
+
+            blobs[run.blob].area += box.width;
+            blobs[run.blob].bbox |=       box;
+        }
+    }
+}
+
+void BlobExtractor::extract(const cv::Mat& _mask)
+{
+    CV_Assert(_mask.type() == CV_8UC1);
+
+    extractRuns<uchar>(_mask, uchar(0xFF));
+}
+
+void BlobExtractor::extract(const cv::Mat& _labels, int _idx)
+{
+    CV_Assert(_labels.type() == CV_32SC1);
+
+    extractRuns<uint32_t>(_labels, uint32_t(1) << _idx);
+}
+
+size_t BlobExtractor::countBlobs(int _min_area) const
+{
+    size_t res = 0;
+
+    for (size_t i = 0; i < blobs.size(); ++i)
+    {
+        if (blobs[i].area > _min_area)    { ++res; }
+    }
+
+    return res;
+}
+
+void BlobExtractor::draw(int _min_area, cv::Mat& _dst) const
+{
+    CV_Assert(_dst.type() == CV_8UC1);
+
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const Run &run = runs[i];
+
+        if (blobs[run.blob].area > _min_area)
+        {
+            memset(_dst.ptr<uchar>(run.y) + run.x_start, 255, run.x_end - run.x_start + 1);
+        }
+    }
+}
+
+const vector<cv::Point>& BlobExtractor::getHullPoints(int _min_area, const cv::Point& _offset)
+{
+    hull_pts.clear();
+
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const Run &run = runs[i];
+
+        if (blobs[run.blob].area > _min_area)
+        {
+            hull_pts.push_back(cv::Point(run.x_start, run.y) + _offset);
+
+            if (run.x_end != run.x_start)
+            {
+                hull_pts.push_back(cv::Point(run.x_end, run.y) + _offset);
+            }
+        }
+    }
+
+    return hull_pts;
+}
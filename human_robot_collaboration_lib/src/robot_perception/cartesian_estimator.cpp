@@ -1,23 +1,27 @@
 #include "robot_perception/cartesian_estimator.h"
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 using namespace std;
 
 #define FONT_FACE     cv::FONT_HERSHEY_SIMPLEX
+#define NUM_WORKERS   4     // Default number of workers of the thread pool
+#define THREAD_RATE   50.0  // [Hz] Default rate of the thread
+#define DRAW_NICENESS 10    // Niceness of the drawing thread
 
 /************************************************************************************/
 /*                                 SEGMENTED OBJECT                                 */
 /************************************************************************************/
 SegmentedObj::SegmentedObj(vector<double> _size) :
-                           name(""), is_there(false), id(-1), size(_size),
-                           area_threshold(AREA_THRES), rect(cv::Point2f(0,0), cv::Size2f(0,0), 0.0)
+                           name(""), is_there(false), roi_tracking(false), roi_margin(ROI_MARGIN),
+                           roi_refresh(ROI_REFRESH), roi_frames(0), pyr_levels(0), has_pose(false),
+                           id(-1), size(_size), area_threshold(AREA_THRES),
+                           rect(cv::Point2f(0,0), cv::Size2f(0,0), 0.0),
+                           rot(cv::Matx33d::eye()), tran(0.0, 0.0, 0.0)
 {
-    Rvec.create(3,1,CV_32FC1);
-    Tvec.create(3,1,CV_32FC1);
 
-    for (int i=0; i<3; ++i)
-    {
-        Tvec.at<float>(i,0)=Rvec.at<float>(i,0)=-999999;
-    }
 }
 
 SegmentedObj::SegmentedObj(string _name, int _id, vector<double> _size,
@@ -40,22 +44,148 @@ bool SegmentedObj::detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out
     return false;
 }
 
-bool SegmentedObj::drawBox(cv::Mat &_img)
+bool SegmentedObj::detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres,
+                                ScratchArena& _arena)
 {
-    if (isThere())
+    return detectObject(_in, _out, _out_thres);
+}
+
+bool SegmentedObj::getSearchROI(const cv::Size& _img_size, cv::Rect& _roi)
+{
+    cv::Rect img_rect(cv::Point(0, 0), _img_size);
+
+    if (roi_tracking && isThere() && roi_frames < roi_refresh)
     {
-        cv::Scalar color = cv::Scalar::all(255);
+        cv::Rect box = rect.boundingRect();
 
-        cv::Point2f rect_points[4];
-        rect.points(rect_points);
+        _roi = cv::Rect(box.x - roi_margin, box.y - roi_margin,
+                        box.width + 2 * roi_margin, box.height + 2 * roi_margin) & img_rect;
 
-        for( int j = 0; j < 4; ++j )
+        if (_roi.area() > 0)
         {
-            cv::line   (_img, rect_points[j], rect_points[(j+1)%4], color, 2, 8 );
-            // cv::putText(_img, toString(j), rect_points[j],
-            //              FONT_FACE, 1, cv::Scalar::all(255), 2, CV_AA);
+            ++roi_frames;
+            return true;
         }
+    }
+
+    roi_frames = 0;
+    _roi       = img_rect;
+
+    return false;
+}
+
+void SegmentedObj::setROITracking(bool _roi_tracking, int _roi_margin, int _roi_refresh)
+{
+    roi_tracking = _roi_tracking;
+    roi_margin   =   _roi_margin;
+    roi_refresh  =  _roi_refresh;
+    roi_frames   =             0;
+}
+
+bool SegmentedObj::getCoarseROI(const cv::Mat& _coarse_mask, const cv::Size& _img_size,
+                                cv::Rect& _roi)
+{
+    blobs.extract(_coarse_mask);
+
+    return getCoarseROIFromBlobs(pyr_levels, _img_size, _roi);
+}
+
+bool SegmentedObj::getCoarseROI(const cv::Mat& _coarse_labels, int _idx, int _pyr_levels,
+                                const cv::Size& _img_size, cv::Rect& _roi)
+{
+    blobs.extract(_coarse_labels, _idx);
+
+    return getCoarseROIFromBlobs(_pyr_levels, _img_size, _roi);
+}
+
+bool SegmentedObj::getCoarseROIFromBlobs(int _pyr_levels, const cv::Size& _img_size,
+                                         cv::Rect& _roi)
+{
+    // Areas scale with the square of the scale of the pyramid
+    int area_thres = area_threshold >> (2 * _pyr_levels);
+    cv::Rect box;
+
+    const vector<Blob>& bl = blobs.getBlobs();
+
+    for (size_t i = 0; i < bl.size(); ++i)
+    {
+        if (bl[i].area > area_thres)
+        {
+            box = box.area() == 0? bl[i].bbox : (box | bl[i].bbox);
+        }
+    }
 
+    if (box.area() == 0)    { return false; }
+
+    // Every coarse pixel covers 2^pyr_levels full-resolution pixels per side
+    int scale  = 1 << _pyr_levels;
+    int margin = scale + PYR_MARGIN;
+
+    _roi = cv::Rect(box.x * scale - margin, box.y * scale - margin,
+                    box.width  * scale + 2 * margin,
+                    box.height * scale + 2 * margin) & cv::Rect(cv::Point(0, 0), _img_size);
+
+    return _roi.area() > 0;
+}
+
+void SegmentedObj::setPyrLevels(int _pyr_levels)
+{
+    pyr_levels = max(0, min(PYR_MAX_LEVELS, _pyr_levels));
+}
+
+/**
+ * Draws a rotated rectangle into an image
+ */
+static void drawRect(cv::Mat &_img, const cv::RotatedRect& _rect)
+{
+    cv::Scalar color = cv::Scalar::all(255);
+
+    cv::Point2f rect_points[4];
+    _rect.points(rect_points);
+
+    for( int j = 0; j < 4; ++j )
+    {
+        cv::line   (_img, rect_points[j], rect_points[(j+1)%4], color, 2, 8 );
+        // cv::putText(_img, toString(j), rect_points[j],
+        //              FONT_FACE, 1, cv::Scalar::all(255), 2, CV_AA);
+    }
+}
+
+/**
+ * Draws a 3D axis into an image, given its pose with respect to the camera
+ */
+static void drawAxis(cv::Mat &_img, const cv::Matx33d& _rot, const cv::Vec3d& _tran,
+                     const cv::Mat& _cam_mat, const cv::Mat& _dist_mat)
+{
+    float size=0.15;
+
+    cv::Mat obj_points (4,3,CV_32FC1);
+    obj_points.at<float>(0,0)=   0; obj_points.at<float>(0,1)=   0; obj_points.at<float>(0,2)=   0;
+    obj_points.at<float>(1,0)=size; obj_points.at<float>(1,1)=   0; obj_points.at<float>(1,2)=   0;
+    obj_points.at<float>(2,0)=   0; obj_points.at<float>(2,1)=size; obj_points.at<float>(2,2)=   0;
+    obj_points.at<float>(3,0)=   0; obj_points.at<float>(3,1)=   0; obj_points.at<float>(3,2)=size;
+
+    // The rotation vector is computed only here, i.e. in the drawing thread
+    cv::Vec3d rvec;
+    cv::Rodrigues(_rot, rvec);
+
+    vector<cv::Point2f> img_points;
+    cv::projectPoints( obj_points, rvec, _tran, _cam_mat, _dist_mat, img_points);
+
+    //draw lines of different colours
+    cv::line(_img, img_points[0], img_points[1], cv::Scalar(0,0,255,255), 1, CV_AA);
+    cv::line(_img, img_points[0], img_points[2], cv::Scalar(0,255,0,255), 1, CV_AA);
+    cv::line(_img, img_points[0], img_points[3], cv::Scalar(255,0,0,255), 1, CV_AA);
+    cv::putText(_img, "x", img_points[1], FONT_FACE, 0.6, cv::Scalar(0,0,255,255), 2);
+    cv::putText(_img, "y", img_points[2], FONT_FACE, 0.6, cv::Scalar(0,255,0,255), 2);
+    cv::putText(_img, "z", img_points[3], FONT_FACE, 0.6, cv::Scalar(255,0,0,255), 2);
+}
+
+bool SegmentedObj::drawBox(cv::Mat &_img)
+{
+    if (isThere())
+    {
+        drawRect(_img, rect);
         return true;
     }
 
@@ -78,25 +208,7 @@ bool SegmentedObj::draw3dAxis(cv::Mat &_img, const cv::Mat& _cam_mat,
 {
     if (isThere())
     {
-        float size=0.15;
-
-        cv::Mat obj_points (4,3,CV_32FC1);
-        obj_points.at<float>(0,0)=   0; obj_points.at<float>(0,1)=   0; obj_points.at<float>(0,2)=   0;
-        obj_points.at<float>(1,0)=size; obj_points.at<float>(1,1)=   0; obj_points.at<float>(1,2)=   0;
-        obj_points.at<float>(2,0)=   0; obj_points.at<float>(2,1)=size; obj_points.at<float>(2,2)=   0;
-        obj_points.at<float>(3,0)=   0; obj_points.at<float>(3,1)=   0; obj_points.at<float>(3,2)=size;
-
-        vector<cv::Point2f> img_points;
-        cv::projectPoints( obj_points, Rvec, Tvec, _cam_mat, _dist_mat, img_points);
-
-        //draw lines of different colours
-        cv::line(_img, img_points[0], img_points[1], cv::Scalar(0,0,255,255), 1, CV_AA);
-        cv::line(_img, img_points[0], img_points[2], cv::Scalar(0,255,0,255), 1, CV_AA);
-        cv::line(_img, img_points[0], img_points[3], cv::Scalar(255,0,0,255), 1, CV_AA);
-        cv::putText(_img, "x", img_points[1], FONT_FACE, 0.6, cv::Scalar(0,0,255,255), 2);
-        cv::putText(_img, "y", img_points[2], FONT_FACE, 0.6, cv::Scalar(0,255,0,255), 2);
-        cv::putText(_img, "z", img_points[3], FONT_FACE, 0.6, cv::Scalar(255,0,0,255), 2);
-
+        drawAxis(_img, rot, tran, _cam_mat, _dist_mat);
         return true;
     }
 
@@ -115,6 +227,25 @@ bool SegmentedObj::draw(cv::Mat &_img, const cv::Mat& _cam_mat,
     return res;
 }
 
+void SegmentedObj::snapshot(SegmentedObjSnapshot& _snap) const
+{
+    // The name is assigned in place, so that the storage of the snapshot is reused
+    _snap.name.assign(name);
+    _snap.rect = rect;
+    _snap.rot  =  rot;
+    _snap.tran = tran;
+}
+
+void SegmentedObjSnapshot::draw(cv::Mat &_img, const cv::Mat& _cam_mat,
+                                               const cv::Mat& _dist_mat) const
+{
+    drawAxis(_img, rot, tran, _cam_mat, _dist_mat);
+    drawRect(_img, rect);
+
+    cv::putText(_img, name.c_str(), rect.center,
+                FONT_FACE, 0.7, cv::Scalar::all(255), 0.7, CV_AA);
+}
+
 SegmentedObj::operator string()
 {
     return string(name + " [" + toString(size[0]) + " "
@@ -126,10 +257,137 @@ SegmentedObj::~SegmentedObj()
 
 }
 
+/************************************************************************************/
+/*                                PARALLEL DETECTION                                */
+/************************************************************************************/
+bool detectObjectsParallel(const vector<SegmentedObj*>& _objs, ThreadPool& _pool,
+                           const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres,
+                           vector<cv::Mat>& _worker_thres, vector<ScratchArena>& _arenas)
+{
+    resetWorkerThres(_worker_thres, _pool.size(), _in.size());
+    reserveArenas(_arenas, _pool.size(), _in.size());
+
+    std::atomic<bool> res(true);
+
+    _pool.parallelFor(_objs.size(), [&](size_t i, size_t w)
+    {
+        if (_objs[i] && not _objs[i]->detectObject(_in, _out, _worker_thres[w], _arenas[w]))
+        {
+            res = false;
+        }
+    });
+
+    mergeWorkerThres(_worker_thres, _out_thres);
+
+    return res;
+}
+
+void resetWorkerThres(vector<cv::Mat>& _worker_thres, size_t _num_workers, cv::Size _size)
+{
+    _worker_thres.resize(_num_workers);
+
+    for (size_t w = 0; w < _worker_thres.size(); ++w)
+    {
+        _worker_thres[w].create(_size, CV_8UC1);
+        _worker_thres[w].setTo(cv::Scalar::all(0));
+    }
+}
+
+void reserveArenas(vector<ScratchArena>& _arenas, size_t _num_workers, cv::Size _size)
+{
+    if (_arenas.size() != _num_workers)    { _arenas.resize(_num_workers); }
+
+    for (size_t w = 0; w < _arenas.size(); ++w)
+    {
+        _arenas[w].reserve(_size);
+    }
+}
+
+void mergeWorkerThres(const vector<cv::Mat>& _worker_thres, cv::Mat& _out_thres)
+{
+    for (size_t w = 0; w < _worker_thres.size(); ++w)
+    {
+        cv::bitwise_or(_out_thres, _worker_thres[w], _out_thres);
+    }
+}
+
+/************************************************************************************/
+/*                                   PLANAR POSE                                    */
+/************************************************************************************/
+bool planarRectPose(const cv::Point2f _img_pts[4], double _w, double _h,
+                    const cv::Matx33d& _cam_mat, cv::Matx33d& _rot, cv::Vec3d& _tran,
+                    bool _use_guess)
+{
+    const double obj_pts[4][2] = {{-_w/2, -_h/2}, {-_w/2, +_h/2},
+                                  {+_w/2, +_h/2}, {+_w/2, -_h/2}};
+
+    cv::Matx33d cam_mat_inv = _cam_mat.inv();
+
+    // Homography from the plane of the rectangle to the normalized image plane,
+    // with h33 = 1 (i.e. 8 unknowns, and two equations per corner)
+    cv::Matx<double, 8, 8> A;
+    cv::Vec<double, 8>     b, h;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        cv::Vec3d p = cam_mat_inv * cv::Vec3d(_img_pts[i].x, _img_pts[i].y, 1.0);
+
+        double u = p[0] / p[2], v = p[1] / p[2];
+        double X = obj_pts[i][0], Y = obj_pts[i][1];
+
+        A(2*i  , 0) = X; A(2*i  , 1) = Y; A(2*i  , 2) = 1.0; A(2*i  , 6) = -u*X; A(2*i  , 7) = -u*Y;
+        A(2*i+1, 3) = X; A(2*i+1, 4) = Y; A(2*i+1, 5) = 1.0; A(2*i+1, 6) = -v*X; A(2*i+1, 7) = -v*Y;
+
+        b[2*i] = u; b[2*i+1] = v;
+    }
+
+    if (not cv::solve(A, b, h, cv::DECOMP_LU))    { return false; }
+
+    // The columns of the homography are [r1 r2 t] up to a scale, which is positive
+    // since h33 = 1 (i.e. the rectangle is in front of the camera)
+    cv::Vec3d h1(h[0], h[3], h[6]), h2(h[1], h[4], h[7]), h3(h[2], h[5], 1.0);
+
+    double n1 = cv::norm(h1), n2 = cv::norm(h2);
+
+    if (n1 < 1e-9 || n2 < 1e-9)    { return false; }
+
+    double scale = 2.0 / (n1 + n2);
+
+    cv::Vec3d r1 = scale * h1, r2 = scale * h2, r3 = r1.cross(r2);
+
+    cv::Matx33d R(r1[0], r2[0], r3[0],
+                  r1[1], r2[1], r3[1],
+                  r1[2], r2[2], r3[2]);
+
+    // r1 and r2 are not exactly orthonormal because of the noise,
+    // so R is projected onto the closest rotation matrix
+    cv::Matx31d sv;
+    cv::Matx33d U, Vt;
+    cv::SVD::compute(R, sv, U, Vt);
+    R = U * Vt;
+
+    if (_use_guess)
+    {
+        cv::Matx33d R_flip = R * cv::Matx33d(-1.0,  0.0, 0.0,
+                                              0.0, -1.0, 0.0,
+                                              0.0,  0.0, 1.0);
+
+        if (cv::trace(_rot.t() * R_flip) > cv::trace(_rot.t() * R))    { R = R_flip; }
+    }
+
+    _rot  =            R;
+    _tran = scale *   h3;
+
+    return true;
+}
+
 /************************************************************************************/
 /*                               CARTESIAN ESTIMATOR                                */
 /************************************************************************************/
-CartesianEstimator::CartesianEstimator(string _name) : ROSThreadImage(_name)
+CartesianEstimator::CartesianEstimator(string _name) : ROSThreadImage(_name),
+                                                       is_cam2ref_valid(false),
+                                                       draw_pending(false), draw_closing(false),
+                                                       num_draw_objs(0)
 {
     img_pub        = img_trp.advertise(      "/"+getName()+"/image_result", SUBSCRIBER_BUFFER);
     img_pub_thres  = img_trp.advertise("/"+getName()+"/image_result_thres", SUBSCRIBER_BUFFER);
@@ -137,11 +395,38 @@ CartesianEstimator::CartesianEstimator(string _name) : ROSThreadImage(_name)
 
     nh.param<string>("/"+getName()+"/reference_frame", reference_frame,         "");
     nh.param<string>("/"+getName()+   "/camera_frame",    camera_frame,         "");
+    nh.param<bool>  ("/"+getName()+  "/static_camera",   static_camera,      false);
     nh.param<int>   ("/"+getName()+ "/area_threshold",  area_threshold, AREA_THRES);
+    nh.param<int>   ("/"+getName()+    "/num_workers",     num_workers,
+                     min(NUM_WORKERS, int(std::thread::hardware_concurrency())));
+    nh.param<bool>  ("/"+getName()+   "/roi_tracking",    roi_tracking,      false);
+    nh.param<int>   ("/"+getName()+     "/roi_margin",      roi_margin, ROI_MARGIN);
+    nh.param<int>   ("/"+getName()+    "/roi_refresh",     roi_refresh, ROI_REFRESH);
+    nh.param<int>   ("/"+getName()+ "/pyramid_levels",      pyr_levels,          0);
+    nh.param<bool>  ("/"+getName()+      "/use_aruco",       use_aruco,      false);
+    nh.param<double>("/"+getName()+    "/marker_size",     marker_size, MARKER_SIZE);
+
+    pyr_levels = max(0, min(PYR_MAX_LEVELS, pyr_levels));
+
+    // With the tracking mode, the estimator can keep up with the rate of the camera
+    double rate;
+    nh.param<double>("/"+getName()+           "/rate",            rate,  THREAD_RATE);
+    r = ros::Rate(rate);
+
+    num_workers = max(0, num_workers);
+    pool.reset(new ThreadPool(num_workers));
 
     ROS_INFO("Reference Frame: %s", reference_frame.c_str());
-    ROS_INFO("Camera Frame   : %s",    camera_frame.c_str());
+    ROS_INFO("Camera Frame   : %s [%s]",    camera_frame.c_str(),
+                                  static_camera?"static":"moving");
     ROS_INFO("Area Threshold : %i",  area_threshold        );
+    ROS_INFO("Num Workers    : %i",     num_workers        );
+    ROS_INFO("ROI Tracking   : %s [margin %i px, refresh %i frames]",
+              roi_tracking?"enabled":"disabled", roi_margin, roi_refresh);
+    ROS_INFO("Pyramid Levels : %i",      pyr_levels        );
+    ROS_INFO("ArUco Markers  : %s [size %g m]",
+                 use_aruco?"enabled":"disabled", marker_size);
+    ROS_INFO("Rate           : %g Hz",             rate        );
 
     ROS_ASSERT_MSG(not camera_frame.empty(), "Camera frame is empty!");
 
@@ -154,8 +439,14 @@ CartesianEstimator::CartesianEstimator(string _name) : ROSThreadImage(_name)
     // For now, we'll assume images that are always rectified
     cam_param = aruco_ros::rosCameraInfo2ArucoCamParams(*msg, true);
 
+    cv::Mat cam_mat_64f;
+    cam_param.CameraMatrix.convertTo(cam_mat_64f, CV_64F);
+    cam_mat = cam_mat_64f;
+
     markers_msg.header.frame_id = reference_frame;
     markers_msg.header.seq      = 0;
+
+    draw_thread = std::thread(&CartesianEstimator::drawThread, this);
     startThread();
 }
 
@@ -168,12 +459,13 @@ CartesianEstimator::CartesianEstimator(string _name, vector<string> _objs_name,
     addObjects(_objs_name, _objs_id, _objs_size);
 }
 
-bool CartesianEstimator::publishObjects()
+bool CartesianEstimator::publishObjects(const ros::Time& _stamp)
 {
-    ros::Time curr_stamp(ros::Time::now());
+    // Objects are stamped with the time of the image they have been detected in
+    ros::Time curr_stamp = _stamp.isZero()? ros::Time::now() : _stamp;
 
     markers_msg.markers.clear();
-    markers_msg.markers.resize(getNumValidObjects());
+    markers_msg.markers.resize(getNumValidObjects() + aruco_markers.size());
     markers_msg.header.stamp = curr_stamp;
     ++markers_msg.header.seq;
 
@@ -208,6 +500,33 @@ bool CartesianEstimator::publishObjects()
         }
     }
 
+    // The markers follow the objects, so that a single array describes the whole frame
+    for(size_t i = 0; i < aruco_markers.size(); ++i)
+    {
+        aruco_msgs::Marker &marker_cnt = markers_msg.markers.at(cnt);
+        marker_cnt.pose.pose = aruco_poses[i];
+        marker_cnt.id        = aruco_markers[i].id;
+
+        cv::Point2f center = aruco_markers[i].getCenter();
+
+        geometry_msgs::Point cent;
+        cent.x = center.x;
+        cent.y = center.y;
+
+        marker_cnt.center = cent;
+
+        for(size_t j = 0; j < aruco_markers[i].size(); j++)
+        {
+            geometry_msgs::Point pixel;
+            pixel.x = aruco_markers[i][j].x;
+            pixel.y = aruco_markers[i][j].y;
+
+            marker_cnt.corners.push_back(pixel);
+        }
+
+        ++cnt;
+    }
+
     objs_pub.publish(markers_msg);
 
     return true;
@@ -219,37 +538,125 @@ void CartesianEstimator::internalThread()
     // before the derived class finishes initialization
     ros::Duration(0.2).sleep();
 
+    // Sequence number of the last processed image, in order to skip stale frames
+    unsigned long img_in_seq = 0;
+    cv_bridge::CvImageConstPtr img_ptr;
+
     while(ros::ok() && not isClosing())
     {
         // ROS_INFO_THROTTLE(120, "I'm running, and everything is fine..."
         //                        " Number of objects: %i", getNumValidObjects());
-        cv::Mat img_in;
-        cv::Mat img_out;
-        if (!img_empty)
+        if (getNewImage(img_in_seq, img_ptr))
         {
-            {
-                lock_guard<mutex> lock(mutex_img);
-                img_in  = curr_img;
-            }
-            img_out = img_in.clone();
+            // The input image is shared with the ROS message, and nothing is drawn
+            // while detecting the objects, so there is no need to copy it here
+            cv::Mat img_out;
+
+            // Objects are stamped with the time of the image they have been detected in
+            ros::Time stamp = img_ptr->header.stamp.isZero()? ros::Time::now() :
+                                                              img_ptr->header.stamp;
 
-            detectObjects(img_in, img_out);
-            draw(img_out);
-            poseRootRF();
+            detectObjects(img_ptr->image, img_out);
 
-            if (objs_pub.getNumSubscribers() > 0)    publishObjects();
+            // The markers are detected in the same (already decoded) frame
+            if (use_aruco)    { detectMarkers(img_ptr->image); }
 
-            if (img_pub.getNumSubscribers() > 0)
+            // Without the transform to the reference frame, the poses are not published
+            if (poseRootRF(stamp) && objs_pub.getNumSubscribers() > 0)
             {
-                sensor_msgs::ImagePtr msg = cv_bridge::CvImage(std_msgs::Header(),
-                                                    "bgr8", img_out).toImageMsg();
-                img_pub.publish(msg);
+                publishObjects(stamp);
             }
+
+            // The debug image is drawn (by the drawing thread) only if somebody wants it
+            if (img_pub.getNumSubscribers() > 0)     queueDraw(img_ptr);
         }
         r.sleep();
     }
 }
 
+void CartesianEstimator::queueDraw(const cv_bridge::CvImageConstPtr& _img)
+{
+    std::lock_guard<std::mutex> lck(mtx_draw);
+
+    // Only what is needed to draw the objects is copied, into snapshots that are reused
+    // across frames (they are never shrunk, so that their names keep their storage)
+    num_draw_objs = 0;
+
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        if (objs[i] && objs[i]->isThere())
+        {
+            if (draw_objs.size() <= num_draw_objs)    { draw_objs.resize(num_draw_objs + 1); }
+
+            objs[i]->snapshot(draw_objs[num_draw_objs]);
+            ++num_draw_objs;
+        }
+    }
+
+    // The detector overwrites the pose vectors of the markers in place, so they are cloned
+    draw_markers = aruco_markers;
+
+    for (size_t i = 0; i < draw_markers.size(); ++i)
+    {
+        draw_markers[i].Rvec = aruco_markers[i].Rvec.clone();
+        draw_markers[i].Tvec = aruco_markers[i].Tvec.clone();
+    }
+
+    draw_img     = _img;
+    draw_pending = true;
+
+    cv_draw.notify_one();
+}
+
+void CartesianEstimator::drawThread()
+{
+    // The debug image is secondary, so the thread gives way to everything else
+    if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), DRAW_NICENESS) != 0)
+    {
+        ROS_WARN("Unable to lower the priority of the drawing thread");
+    }
+
+    cv_bridge::CvImageConstPtr img;
+    vector<SegmentedObjSnapshot> objs_to_draw;
+    size_t                   num_objs_to_draw = 0;
+    vector<aruco::Marker>     markers_to_draw;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx_draw);
+            cv_draw.wait(lck, [&]{ return draw_closing || draw_pending; });
+
+            if (draw_closing)    { return; }
+
+            // The snapshot is swapped out, so that the lock is held only for a moment
+            img = draw_img;
+            draw_img.reset();
+            objs_to_draw.swap(draw_objs);
+            num_objs_to_draw = num_draw_objs;
+            markers_to_draw.swap(draw_markers);
+            draw_pending = false;
+        }
+
+        cv::Mat img_out = img->image.clone();
+
+        for (size_t i = 0; i < num_objs_to_draw; ++i)
+        {
+            objs_to_draw[i].draw(img_out, cam_param.CameraMatrix, cam_param.Distorsion);
+        }
+
+        for (size_t i = 0; i < markers_to_draw.size(); ++i)
+        {
+            markers_to_draw[i].draw(img_out, cv::Scalar(0, 0, 255), 2);
+            aruco::CvDrawingUtils::draw3dAxis(img_out, markers_to_draw[i], cam_param);
+        }
+
+        sensor_msgs::ImagePtr msg = cv_bridge::CvImage(std_msgs::Header(),
+                                                "bgr8", img_out).toImageMsg();
+        img_pub.publish(msg);
+    }
+}
+
 bool CartesianEstimator::addObject(string _name, int _id, double _h, double _w)
 {
     vector<double> size;
@@ -267,6 +674,8 @@ bool CartesianEstimator::addObject(string _name, int _id, double _h, double _w)
     }
 
     objs.push_back(new SegmentedObj(_name, _id, size, getAreaThreshold()));
+    objs.back()->setROITracking(roi_tracking, roi_margin, roi_refresh);
+    objs.back()->setPyrLevels(pyr_levels);
 
     return true;
 }
@@ -330,28 +739,26 @@ bool CartesianEstimator::addObjects(XmlRpc::XmlRpcValue _params)
 
 bool CartesianEstimator::detectObjects(const cv::Mat& _in, cv::Mat& _out)
 {
-    cv::Mat out_thres(_in.rows, _in.cols, CV_8U, 0.0);
-
-    bool res = true;
+    // The thresholded image is reallocated only if the size of the image changes
+    img_thres.create(_in.size(), CV_8UC1);
+    img_thres.setTo(cv::Scalar::all(0));
 
-    for (size_t i = 0; i < objs.size(); ++i)
-    {
-        if (objs[i])
-        {
-            res = res & objs[i]->detectObject(_in, _out, out_thres);
-        }
-    }
+    bool res = detectObjects(_in, _out, img_thres);
 
     if (img_pub_thres.getNumSubscribers() > 0)
     {
         sensor_msgs::ImagePtr msg = cv_bridge::CvImage(std_msgs::Header(),
-                                          "mono8", out_thres).toImageMsg();
+                                          "mono8", img_thres).toImageMsg();
         img_pub_thres.publish(msg);
     }
 
     return res;
 }
 
+bool CartesianEstimator::detectObjects(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres)
+{
+    return detectObjectsParallel(objs, *pool, _in, _out, _out_thres, worker_thres, arenas);
+}
 
 void CartesianEstimator::printObjectDB()
 {
@@ -375,28 +782,84 @@ string CartesianEstimator::objectDBToString()
     return res;
 }
 
-bool CartesianEstimator::poseRootRF()
+bool CartesianEstimator::poseRootRF(const ros::Time& _stamp)
 {
-    bool res = true;
+    // The camera transform is resolved once, and shared by all the objects
+    if (not updateCameraToReference(_stamp))    { return false; }
 
+    obj_tfs.resize(objs.size());
+
+    // A pose takes only a few microseconds, so they are computed serially
+    // (dispatching them to the thread pool would cost more than it saves)
     for (size_t i = 0; i < objs.size(); ++i)
     {
-        if (objs[i])
+        if (not objs[i])    { continue; }
+
+        if (not objs[i]->isThere())
         {
-            if (objs[i]->isThere())
-            {
-                res = res & poseRootRF(i);
-            }
+            // Lost objects have no guess for their pose when they are found again
+            objs[i]->setHasPose(false);
+        }
+        else if (not poseRootRF(i, _stamp))
+        {
+            // Objects without a pose (e.g. a degenerate rectangle out of a thin blob) are
+            // dropped from this frame, so that they are neither broadcast nor published
+            // with a stale transform, while the other objects are
+            objs[i]->setIsThere(false);
         }
     }
 
-    return res;
+    // All the transforms of the objects are sent at once
+    send_tfs.clear();
+
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        if (objs[i] && objs[i]->isThere())    { send_tfs.push_back(obj_tfs[i]); }
+    }
+
+    if (send_tfs.size() > 0)    { tfBroadcaster_.sendTransform(send_tfs); }
+
+    if (use_aruco)    { poseMarkersRootRF(); }
+
+    return true;
 }
 
-bool CartesianEstimator::poseRootRF(int idx)
+bool CartesianEstimator::detectMarkers(const cv::Mat& _in)
+{
+    try
+    {
+        // The markers of the previous frame are overwritten, so that their storage is reused
+        aruco_detector.detect(_in, aruco_markers, cam_param, marker_size, false);
+    }
+    catch (const cv::Exception& e)
+    {
+        ROS_ERROR_THROTTLE(1, "[%s] Unable to detect the ArUco markers: %s",
+                                    getName().c_str(), e.what());
+        aruco_markers.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void CartesianEstimator::poseMarkersRootRF()
+{
+    aruco_poses.resize(aruco_markers.size());
+
+    for (size_t i = 0; i < aruco_markers.size(); ++i)
+    {
+        // Same convention as aruco_ros, so that the markers are interchangeable with its ones
+        tf::Transform transform = cameraToReference *
+                                  aruco_ros::arucoMarker2Tf(aruco_markers[i]);
+
+        tf::poseTFToMsg(transform, aruco_poses[i]);
+    }
+}
+
+bool CartesianEstimator::poseRootRF(int idx, const ros::Time& _stamp)
 {
     bool res = poseCameraRF(idx);
-    res = res && cameraRFtoRootRF(idx);
+    res = res && cameraRFtoRootRF(idx, _stamp);
 
     return res;
 }
@@ -413,78 +876,81 @@ bool CartesianEstimator::poseCameraRF(int idx)
         objs[idx]->rect.size.width  = tmp;
     }
 
-    // Set image points from the rotated rectangle that defines the segmented object
-    cv::Mat ImgPoints(4,2,CV_32FC1);
-
     cv::Point2f obj_segm_pts[4];
     objs[idx]->rect.points(obj_segm_pts);
 
-    for (int j=0; j<4; ++j)
-    {
-        ImgPoints.at<float>(j,0)=obj_segm_pts[j].x;
-        ImgPoints.at<float>(j,1)=obj_segm_pts[j].y;
-    }
+    // The pose in the previous frame (if any) is used to keep the orientation consistent
+    bool res = planarRectPose(obj_segm_pts, objs[idx]->size[0], objs[idx]->size[1], cam_mat,
+                              objs[idx]->rot, objs[idx]->tran, objs[idx]->hasPose());
 
-    double h_w = objs[idx]->size[0]/2;
-    double h_h = objs[idx]->size[1]/2;
+    objs[idx]->setHasPose(res);
 
-    // Matrix representing the points relative to the objects.
-    // The convention used is to have 0 in the bottom left,
-    // with the others organized in a clockwise manner
-    cv::Mat ObjPoints(4,3,CV_32FC1);
-    ObjPoints.at<float>(0,0)=-h_w;   ObjPoints.at<float>(0,1)=-h_h;   ObjPoints.at<float>(0,2)=0;
-    ObjPoints.at<float>(1,0)=-h_w;   ObjPoints.at<float>(1,1)=+h_h;   ObjPoints.at<float>(1,2)=0;
-    ObjPoints.at<float>(2,0)=+h_w;   ObjPoints.at<float>(2,1)=+h_h;   ObjPoints.at<float>(2,2)=0;
-    ObjPoints.at<float>(3,0)=+h_w;   ObjPoints.at<float>(3,1)=-h_h;   ObjPoints.at<float>(3,2)=0;
+    return res;
+}
+
+bool CartesianEstimator::cameraRFtoRootRF(int idx, const ros::Time& _stamp)
+{
+    // Now find the transform the detected object
+    tf::Transform transform = object2Tf(idx);
+    transform = static_cast<tf::Transform>(cameraToReference) * transform;
+    tf::poseTFToMsg(transform, objs[idx]->pose);
 
-    cv::Mat raux,taux;
-    cv::solvePnP(ObjPoints, ImgPoints, cam_param.CameraMatrix, cv::Mat(), raux, taux);
-    raux.convertTo(objs[idx]->Rvec, CV_32F);
-    taux.convertTo(objs[idx]->Tvec, CV_32F);
+    obj_tfs[idx] = tf::StampedTransform(transform, _stamp, reference_frame,
+                                        objs[idx]->getName());
 
     return true;
 }
 
-bool CartesianEstimator::cameraRFtoRootRF(int idx)
+bool CartesianEstimator::updateCameraToReference(const ros::Time& _stamp)
 {
-    // Get the current transform from the camera frame to output ref frame
-    tf::StampedTransform cameraToReference;
-    cameraToReference.setIdentity();
-
-    if ( reference_frame != camera_frame )
+    if (reference_frame == camera_frame)
     {
-        getTransform(reference_frame, camera_frame, cameraToReference);
+        cameraToReference.setIdentity();
+        is_cam2ref_valid = true;
+
+        return true;
     }
 
-    // Now find the transform the detected object
+    // Static mounts are resolved only once
+    if (static_camera && is_cam2ref_valid)    { return true; }
 
-    tf::Transform transform = object2Tf(idx);
-    transform = static_cast<tf::Transform>(cameraToReference) * transform;
-    tf::TransformBroadcaster br;
-    tf::poseTFToMsg(transform, objs[idx]->pose);
-    br.sendTransform(tf::StampedTransform(transform, ros::Time::now(), reference_frame,
-                                                        objs[idx]->getName().c_str()));
+    // For static mounts any time is good, otherwise the time of the image is used
+    ros::Time stamp = static_camera? ros::Time(0) : _stamp;
 
-    return true;
+    if (getTransform(reference_frame, camera_frame, stamp, cameraToReference))
+    {
+        is_cam2ref_valid = true;
+        return true;
+    }
+
+    if (is_cam2ref_valid)
+    {
+        ROS_WARN_THROTTLE(1, "[%s] Using the last transform from %s to %s", getName().c_str(),
+                                          camera_frame.c_str(), reference_frame.c_str());
+        return true;
+    }
+
+    return false;
 }
 
 bool CartesianEstimator::getTransform(const string& refFrame,
                                       const string& childFrame,
+                                      const ros::Time& stamp,
                                       tf::StampedTransform& transform)
 {
     string errMsg;
 
-    if(!tfListener_.waitForTransform(refFrame, childFrame, ros::Time(0),
-                                     ros::Duration(0.5), ros::Duration(0.01), &errMsg))
+    if(!tfListener_.waitForTransform(refFrame, childFrame, stamp,
+                                     ros::Duration(TF_TIMEOUT), ros::Duration(0.005), &errMsg))
     {
-        ROS_ERROR("Unable to get pose from TF: %s", errMsg.c_str());
+        ROS_ERROR_THROTTLE(1, "Unable to get pose from TF: %s", errMsg.c_str());
         return false;
     }
     else
     {
         try
         {
-            tfListener_.lookupTransform(refFrame, childFrame, ros::Time(0), transform);
+            tfListener_.lookupTransform(refFrame, childFrame, stamp, transform);
         }
         catch ( const tf::TransformException& e)
         {
@@ -498,26 +964,20 @@ bool CartesianEstimator::getTransform(const string& refFrame,
 
 tf::Transform CartesianEstimator::object2Tf(int idx)
 {
-    cv::Mat rot(3, 3, CV_32FC1);
-    cv::Rodrigues(objs[idx]->Rvec, rot);
-    cv::Mat tran = objs[idx]->Tvec;
-
     // This transforms from the RF of the object to the RF of the end-effector
     // in order to be able to properly align the end-effector with the object itself
-    cv::Mat obj2EE(3, 3, CV_32FC1);
-    //  0 -1  0
-    // -1  0  0
-    //  0  0 -1
-    obj2EE.at<float>(0,0) =  0.0; obj2EE.at<float>(0,1) = -1.0; obj2EE.at<float>(0,2) =  0.0;
-    obj2EE.at<float>(1,0) = -1.0; obj2EE.at<float>(1,1) =  0.0; obj2EE.at<float>(1,2) =  0.0;
-    obj2EE.at<float>(2,0) =  0.0; obj2EE.at<float>(2,1) =  0.0; obj2EE.at<float>(2,2) = -1.0;
-    rot = rot*obj2EE.t();
+    const cv::Matx33d obj2EE( 0.0, -1.0,  0.0,
+                             -1.0,  0.0,  0.0,
+                              0.0,  0.0, -1.0);
+
+    cv::Matx33d rot  = objs[idx]->rot * obj2EE.t();
+    cv::Vec3d   tran = objs[idx]->tran;
 
-    tf::Matrix3x3 tf_rot(rot.at<float>(0,0), rot.at<float>(0,1), rot.at<float>(0,2),
-                         rot.at<float>(1,0), rot.at<float>(1,1), rot.at<float>(1,2),
-                         rot.at<float>(2,0), rot.at<float>(2,1), rot.at<float>(2,2));
+    tf::Matrix3x3 tf_rot(rot(0,0), rot(0,1), rot(0,2),
+                         rot(1,0), rot(1,1), rot(1,2),
+                         rot(2,0), rot(2,1), rot(2,2));
 
-    tf::Vector3 tf_orig(tran.at<float>(0,0), tran.at<float>(1,0), tran.at<float>(2,0));
+    tf::Vector3 tf_orig(tran[0], tran[1], tran[2]);
 
     return tf::Transform(tf_rot, tf_orig);
 }
@@ -576,5 +1036,18 @@ void CartesianEstimator::clearObjs()
 
 CartesianEstimator::~CartesianEstimator()
 {
+    // The estimator thread is stopped before anything it uses (the thread pool,
+    // the objects, the scratch buffers) is destroyed
+    stopThread();
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_draw);
+        draw_closing = true;
+    }
+
+    cv_draw.notify_one();
+
+    if (draw_thread.joinable())    { draw_thread.join(); }
+
     clearObjs();
 }
@@ -2,100 +2,162 @@
 
 using namespace std;
 
+/**
+ * Scales the number of iterations of a morphological operation to a level of the pyramid,
+ * so that the coarse images are cleaned up like the full-resolution ones
+ */
+static int scaleIterations(int _iterations, int _pyr_levels)
+{
+    return max(1, _iterations >> _pyr_levels);
+}
+
 /************************************************************************************/
 /*                               SEGMENTED OBJECT HSV                               */
 /************************************************************************************/
 SegmentedObjHSV::SegmentedObjHSV(vector<double> _size, hsvColorRange _col) :
-                                 SegmentedObj(_size), col(_col)
+                                 SegmentedObj(_size), morphology(false), col(_col)
 {
 
 }
 
 SegmentedObjHSV::SegmentedObjHSV(string _name, int _id, vector<double> _size,
                                  int _area_thres, hsvColorRange _col) :
-                                 SegmentedObj(_name, _id, _size, _area_thres), col(_col)
+                                 SegmentedObj(_name, _id, _size, _area_thres),
+                                 morphology(false), col(_col)
 {
 
 }
 
 bool SegmentedObjHSV::detectObject(const cv::Mat& _in, cv::Mat& _out)
 {
-    cv::Mat out_thres(_in.rows, _in.cols, CV_32FC1, 0.0);
+    cv::Mat out_thres(_in.rows, _in.cols, CV_8UC1, cv::Scalar::all(0));
     return detectObject(_in, _out, out_thres);
 }
 
 bool SegmentedObjHSV::detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres)
+{
+    // Without the buffers of the caller, they are allocated for this call only
+    ScratchArena arena;
+    arena.reserve(_in.size());
+
+    return detectObject(_in, _out, _out_thres, arena);
+}
+
+bool SegmentedObjHSV::detectObject(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres,
+                                   ScratchArena& _arena)
 {
     // ROS_INFO("Detecting object: %s", toString().c_str());
 
-    cv::Mat img_hsv;
-    cv::cvtColor(_in, img_hsv, CV_BGR2HSV); //Convert the captured frame from BGR to HSV
+    // If the object is tracked, only the ROI around its last position is searched,
+    // and the whole image is searched again only if it is not found there
+    cv::Rect roi;
+    if (getSearchROI(_in.size(), roi) && detectObjectInROI(_in, roi, _out_thres, _arena))
+    {
+        return true;
+    }
 
-    Contours           contours;
-    Contours      filt_contours;
-    vector<cv::Vec4i> hierarchy;
+    // Otherwise, the whole image is searched (at a coarser scale first, in the pyramid mode)
+    if (not findCandidateROI(_in, roi, _arena))
+    {
+        setIsThere(false);
+        return false;
+    }
 
-    cv::Mat img_thres = hsvThreshold(img_hsv, col);
+    return detectObjectInROI(_in, roi, _out_thres, _arena);
+}
 
-    // Some morphological operations to remove noise and clean up the image
-    for (int i = 0; i < 2; ++i)  erode(img_thres, img_thres, cv::Mat());
-    for (int i = 0; i < 4; ++i) dilate(img_thres, img_thres, cv::Mat());
-    for (int i = 0; i < 2; ++i)  erode(img_thres, img_thres, cv::Mat());
+bool SegmentedObjHSV::findCandidateROI(const cv::Mat& _in, cv::Rect& _roi, ScratchArena& _arena)
+{
+    if (getPyrLevels() == 0)
+    {
+        _roi = cv::Rect(cv::Point(0, 0), _in.size());
+        return true;
+    }
+
+    double scale = 1.0 / (1 << getPyrLevels());
+
+    // The size is the one cv::resize would compute, so that the views are not reallocated
+    cv::Size coarse_size(cvRound(_in.cols * scale), cvRound(_in.rows * scale));
 
-    // Find contours
-    cv::findContours(img_thres, contours, hierarchy, CV_RETR_TREE,
-                     CV_CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+    cv::Mat img_coarse = _arena.bgr  (coarse_size);
+    cv::Mat img_hsv    = _arena.hsv  (coarse_size);
+    cv::Mat img_thres  = _arena.thres(coarse_size);
+    cv::Mat img_tmp    = _arena.tmp  (coarse_size);
 
-    // Let's filter out contours that are too small to be an object
-    for(size_t i = 0; i < contours.size(); ++i)
+    // Nearest neighbor interpolation does not blend the colors of the objects
+    cv::resize(_in, img_coarse, coarse_size, 0, 0, cv::INTER_NEAREST);
+    cv::cvtColor(img_coarse, img_hsv, CV_BGR2HSV);
+
+    hsvThreshold(img_hsv, col, img_thres, img_tmp);
+
+    if (morphology)
     {
-        // ROS_INFO("IDX %lu Col %s Contour area %g", i, col.toString().c_str(),
-        //                                            contourArea(contours[i], false));
-        if( int(contourArea(contours[i], false)) > area_threshold )
-        {
-            filt_contours.push_back(contours[i]);
-        }
+        int n_e = scaleIterations(MORPH_ERODE_ITERATIONS,  getPyrLevels());
+        int n_d = scaleIterations(MORPH_DILATE_ITERATIONS, getPyrLevels());
+
+        for (int i = 0; i < n_e; ++i)  erode(img_thres, img_thres, cv::Mat());
+        for (int i = 0; i < n_d; ++i) dilate(img_thres, img_thres, cv::Mat());
+        for (int i = 0; i < n_e; ++i)  erode(img_thres, img_thres, cv::Mat());
     }
 
-    img_thres = cv::Mat::zeros(_in.size(), CV_8UC1);
-    cv::drawContours(img_thres, filt_contours, -1, cv::Scalar::all(255), CV_FILLED, 8);
+    return getCoarseROI(img_thres, _in.size(), _roi);
+}
+
+bool SegmentedObjHSV::detectObjectInROI(const cv::Mat& _in, const cv::Rect& _roi,
+                                        cv::Mat& _out_thres, ScratchArena& _arena)
+{
+    cv::Mat img_hsv   = _arena.hsv  (_roi.size());
+    cv::Mat img_thres = _arena.thres(_roi.size());
+    cv::Mat img_tmp   = _arena.tmp  (_roi.size());
 
-    cv::bitwise_or(_out_thres, img_thres.clone(), _out_thres);
+    cv::cvtColor(_in(_roi), img_hsv, CV_BGR2HSV); //Convert the captured frame from BGR to HSV
 
-    // If there no contours any more, the object is not there
-    if (filt_contours.size() == 0)
+    hsvThreshold(img_hsv, col, img_thres, img_tmp);
+
+    // Some morphological operations to remove noise and clean up the image
+    if (morphology)
     {
-        setIsThere(false);
-        return false;
+        for (int i = 0; i < MORPH_ERODE_ITERATIONS;  ++i)  erode(img_thres, img_thres, cv::Mat());
+        for (int i = 0; i < MORPH_DILATE_ITERATIONS; ++i) dilate(img_thres, img_thres, cv::Mat());
+        for (int i = 0; i < MORPH_ERODE_ITERATIONS;  ++i)  erode(img_thres, img_thres, cv::Mat());
     }
 
-    Contour detected_obj;
+    cv::Mat out_thres_roi = _out_thres(_roi);
 
-    // At this stage, there should be only a contour in the vector of contours.
-    // Strategy 1: If this is not the case, let's merge all the available contours
-        for (size_t i = 0; i < filt_contours.size(); ++i)
-        {
-            detected_obj.insert(detected_obj.end(), filt_contours[i].begin(), filt_contours[i].end());
-        }
+    return detectObjectFromMask(img_thres, out_thres_roi, _roi.tl());
+}
+
+bool SegmentedObjHSV::detectObjectFromMask(const cv::Mat& _mask, cv::Mat& _out_thres,
+                                           const cv::Point& _offset)
+{
+    blobs.extract(_mask);
+
+    return detectObjectFromBlobs(_out_thres, _offset);
+}
 
-    // Strategy 2: If this is not the case, let's pick the contour with the biggest area
-        // int largest_area=0;
-        // int largest_contour_idx=-1;
+bool SegmentedObjHSV::detectObjectFromLabels(const cv::Mat& _labels, int _idx,
+                                             cv::Mat& _out_thres, const cv::Point& _offset)
+{
+    blobs.extract(_labels, _idx);
 
-        // for(size_t i = 0; i< filt_contours.size(); ++i)
-        // {
-        //     double a = contourArea(filt_contours[i], false);  //  Find the area of contour
+    return detectObjectFromBlobs(_out_thres, _offset);
+}
 
-        //     if( a > largest_area )
-        //     {
-        //         largest_area = a;
-        //         largest_contour_idx = i;                // Store the index of largest contour
-        //     }
-        // }
+bool SegmentedObjHSV::detectObjectFromBlobs(cv::Mat& _out_thres, const cv::Point& _offset)
+{
+    // Only the blobs that are big enough to be an object are added to the thresholded image
+    blobs.draw(area_threshold, _out_thres);
 
-        // detected_obj = filt_contours[largest_contour_idx];
+    // If there no blobs any more, the object is not there
+    if (blobs.countBlobs(area_threshold) == 0)
+    {
+        setIsThere(false);
+        return false;
+    }
 
-    rect = minAreaRect(cv::Mat(detected_obj));
+    // There should be only a blob. If this is not the case, let's merge all of them
+    // (i.e. the rectangle encloses the convex hull of their union)
+    rect = cv::minAreaRect(blobs.getHullPoints(area_threshold, _offset));
     setIsThere(true);
 
     return true;
@@ -118,11 +180,200 @@ SegmentedObjHSV::~SegmentedObjHSV()
 
 }
 
+/************************************************************************************/
+/*                                 JOINT DETECTION                                  */
+/************************************************************************************/
+bool setLabelingColors(const vector<SegmentedObj*>& _objs, hsvLabeling& _labeling)
+{
+    bool res = true;
+
+    // Every object is a bit of the label, so objects are split in groups of HSV_MAX_LABELS
+    size_t num_grps = (_objs.size() + HSV_MAX_LABELS - 1) / HSV_MAX_LABELS;
+
+    if (_labeling.labelers.size() != num_grps)    { _labeling.labelers.resize(num_grps); }
+
+    for (size_t grp = 0; grp < num_grps; ++grp)
+    {
+        size_t first = grp * HSV_MAX_LABELS;
+        size_t last  = min(_objs.size(), first + HSV_MAX_LABELS);
+
+        // Objects that are not HSV objects get an empty color range (S.min > S.max)
+        _labeling.obj_cols.assign(last - first, hsvColorRange(colorRange(0, 0), colorRange(1, 0),
+                                                                                 colorRange(1, 0)));
+
+        for (size_t i = first; i < last; ++i)
+        {
+            SegmentedObjHSV *obj = dynamic_cast<SegmentedObjHSV*>(_objs[i]);
+            if (obj)    { _labeling.obj_cols[i - first] = obj->col; }
+        }
+
+        res = _labeling.labelers[grp].setColorRanges(_labeling.obj_cols, _labeling.use_bgr_lut) && res;
+    }
+
+    return res;
+}
+
+/**
+ * Detects an object in a region of the image from its labels. The labels of the
+ * whole image are used if they are at full resolution, otherwise the region is
+ * labeled at full resolution. It uses only the given scratch buffers.
+ *
+ * @param _obj       the object to detect
+ * @param _labeler   the labeler of the group of the object
+ * @param _idx       the index of the object in its group (i.e. its bit in the labels)
+ * @param _in        the full-resolution input image
+ * @param _roi       the region of the image to search into
+ * @param _out_thres the thresholded image of the worker (same size as _in)
+ * @param _arena     the scratch buffers of the worker
+ * @param _labeling  the parameters and the shared buffers
+ *
+ * @return true/false if the object has been detected or not
+ */
+static bool detectObjectInROI(SegmentedObjHSV& _obj, hsvLabeler& _labeler, size_t _idx,
+                              const cv::Mat& _in, const cv::Rect& _roi, cv::Mat& _out_thres,
+                              ScratchArena& _arena, const hsvLabeling& _labeling)
+{
+    cv::Mat out_thres_roi = _out_thres(_roi);
+
+    if (_labeling.pyr_levels == 0)
+    {
+        // The labels of the whole image are already at full resolution
+        return _obj.detectObjectFromLabels(_labeling.img_labels(_roi), _idx,
+                                           out_thres_roi, _roi.tl());
+    }
+
+    // Otherwise, the ROI is labeled at full resolution. The lookup tables of the labeler
+    // have already been built by the coarse labeling, so this is thread-safe
+    cv::Mat roi_labels = _arena.labels(_roi.size());
+
+    if (_labeling.use_bgr_lut)
+    {
+        _labeler.labelBGR(_in(_roi), roi_labels);
+    }
+    else
+    {
+        cv::Mat roi_hsv = _arena.hsv(_roi.size());
+        cv::cvtColor(_in(_roi), roi_hsv, CV_BGR2HSV);
+        _labeler.label(roi_hsv, roi_labels);
+    }
+
+    if (_labeling.use_morphology)
+    {
+        cv::Mat roi_tmp = _arena.ltmp(_roi.size());
+
+        erodeLabels (roi_labels, roi_tmp, MORPH_ERODE_ITERATIONS);
+        dilateLabels(roi_labels, roi_tmp, MORPH_DILATE_ITERATIONS);
+        erodeLabels (roi_labels, roi_tmp, MORPH_ERODE_ITERATIONS);
+    }
+
+    return _obj.detectObjectFromLabels(roi_labels, _idx, out_thres_roi, _roi.tl());
+}
+
+bool detectObjectsHSV(const vector<SegmentedObj*>& _objs, ThreadPool& _pool,
+                      const cv::Mat& _in, cv::Mat& _out_thres,
+                      vector<cv::Mat>& _worker_thres, vector<ScratchArena>& _arenas,
+                      hsvLabeling& _labeling)
+{
+    int pyr_levels = _labeling.pyr_levels;
+
+    // In the pyramid mode, the whole image is labeled only at a coarser scale,
+    // and the objects are then detected at full resolution around the candidate blobs
+    if (pyr_levels > 0)
+    {
+        double scale = 1.0 / (1 << pyr_levels);
+        cv::resize(_in, _labeling.img_coarse, cv::Size(), scale, scale, cv::INTER_NEAREST);
+    }
+
+    const cv::Mat& img_search = pyr_levels > 0? _labeling.img_coarse : _in;
+
+    // A single HSV conversion per frame, shared by all the objects
+    // (if the BGR lookup table is used, there is no need for it)
+    if (not _labeling.use_bgr_lut)    { cv::cvtColor(img_search, _labeling.img_hsv, CV_BGR2HSV); }
+
+    // The lookup tables are rebuilt only if the color ranges have changed
+    // (they are usually built beforehand, when the objects are added)
+    setLabelingColors(_objs, _labeling);
+
+    std::atomic<bool> res(true);
+
+    resetWorkerThres(_worker_thres, _pool.size(), _in.size());
+    reserveArenas(_arenas, _pool.size(), _in.size());
+
+    for (size_t grp = 0; grp < _labeling.labelers.size(); ++grp)
+    {
+        size_t first = grp * HSV_MAX_LABELS;
+        size_t last  = min(_objs.size(), first + HSV_MAX_LABELS);
+
+        hsvLabeler &labeler = _labeling.labelers[grp];
+
+        if (_labeling.use_bgr_lut)    { labeler.labelBGR(img_search, _labeling.img_labels); }
+        else                          { labeler.label(_labeling.img_hsv, _labeling.img_labels); }
+
+        // Same morphological operations as SegmentedObjHSV::detectObject, on all the labels at once
+        if (_labeling.use_morphology)
+        {
+            erodeLabels (_labeling.img_labels, _labeling.img_tmp,
+                         scaleIterations(MORPH_ERODE_ITERATIONS,  pyr_levels));
+            dilateLabels(_labeling.img_labels, _labeling.img_tmp,
+                         scaleIterations(MORPH_DILATE_ITERATIONS, pyr_levels));
+            erodeLabels (_labeling.img_labels, _labeling.img_tmp,
+                         scaleIterations(MORPH_ERODE_ITERATIONS,  pyr_levels));
+        }
+
+        // The labels are then shared (read-only) by the objects, which are processed in parallel
+        _pool.parallelFor(last - first, [&](size_t t, size_t w)
+        {
+            SegmentedObjHSV *obj = dynamic_cast<SegmentedObjHSV*>(_objs[first + t]);
+            if (not obj)    { return; }
+
+            // Tracked objects are searched only in the ROI around their last position,
+            // and in the whole image only if they are not found there
+            cv::Rect roi;
+            if (obj->getSearchROI(_in.size(), roi) &&
+                detectObjectInROI(*obj, labeler, t, _in, roi, _worker_thres[w], _arenas[w], _labeling))
+            {
+                return;
+            }
+
+            if (pyr_levels > 0)
+            {
+                // The labels are at the level of the labeling, whatever the one of the object
+                if (not obj->getCoarseROI(_labeling.img_labels, t, pyr_levels, _in.size(), roi))
+                {
+                    obj->setIsThere(false);
+                    res = false;
+                    return;
+                }
+            }
+            else
+            {
+                roi = cv::Rect(cv::Point(0, 0), _in.size());
+            }
+
+            if (not detectObjectInROI(*obj, labeler, t, _in, roi, _worker_thres[w], _arenas[w], _labeling))
+            {
+                res = false;
+            }
+        });
+    }
+
+    mergeWorkerThres(_worker_thres, _out_thres);
+
+    return res;
+}
+
 /************************************************************************************/
 /*                             CARTESIAN ESTIMATOR HSV                              */
 /************************************************************************************/
 CartesianEstimatorHSV::CartesianEstimatorHSV(string  _name) : CartesianEstimator(_name)
 {
+    nh.param<bool>("/"+getName()+"/use_bgr_lut",    labeling.use_bgr_lut,     true);
+    nh.param<bool>("/"+getName()+ "/morphology", labeling.use_morphology,    false);
+    ROS_INFO("BGR Lookup Table: %s", labeling.use_bgr_lut?"enabled":"disabled");
+    ROS_INFO("Morphology      : %s", labeling.use_morphology?"enabled":"disabled");
+
+    labeling.pyr_levels = pyr_levels;
+
     XmlRpc::XmlRpcValue objects_db;
     if(!nh.getParam("/"+getName()+"/objects_db", objects_db))
     {
@@ -154,6 +405,9 @@ bool CartesianEstimatorHSV::addObject(string _name, int _id,
     }
 
     objs.push_back(new SegmentedObjHSV(_name, _id, size, getAreaThreshold(), _hsv));
+    objs.back()->setROITracking(roi_tracking, roi_margin, roi_refresh);
+    objs.back()->setPyrLevels(pyr_levels);
+    static_cast<SegmentedObjHSV*>(objs.back())->setMorphology(labeling.use_morphology);
 
     return true;
 }
@@ -182,7 +436,8 @@ bool CartesianEstimatorHSV::addObjects(vector<string> _names, vector<int> _ids,
         res = res & addObject(_names[i], _ids[i], _o.at<float>(i, 0), _o.at<float>(i, 1), _hsvs[i]);
     }
 
-    return res;
+    // The lookup tables are built here, rather than at the first frame
+    return setLabelingColors(objs, labeling) && res;
 }
 
 bool CartesianEstimatorHSV::addObjects(XmlRpc::XmlRpcValue _params)
@@ -234,10 +489,17 @@ bool CartesianEstimatorHSV::addObjects(XmlRpc::XmlRpcValue _params)
                               hsvColorRange(i->second["HSV"]["H"], i->second["HSV"]["S"], i->second["HSV"]["V"]));
     }
 
-    return res;
+    // The lookup tables are built here, rather than at the first frame
+    return setLabelingColors(objs, labeling) && res;
 }
 
-CartesianEstimatorHSV::~CartesianEstimatorHSV()
+bool CartesianEstimatorHSV::detectObjects(const cv::Mat& _in, cv::Mat& _out, cv::Mat& _out_thres)
 {
+    return detectObjectsHSV(objs, *pool, _in, _out_thres, worker_thres, arenas, labeling);
+}
 
+CartesianEstimatorHSV::~CartesianEstimatorHSV()
+{
+    // The labeling is destroyed before the base class stops the estimator thread
+    stopThread();
 }
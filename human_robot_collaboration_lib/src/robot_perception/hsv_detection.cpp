@@ -3,35 +3,290 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include <functional>
+
 using namespace std;
 
 cv::Mat hsvThreshold(const cv::Mat& _src, hsvColorRange _hsv)
 {
-    cv::Mat res = _src.clone();
+    // No need to initialize the output images, since inRange allocates them
+    cv::Mat res, tmp;
+
+    hsvThreshold(_src, _hsv, res, tmp);
+
+    return res;
+}
 
+void hsvThreshold(const cv::Mat& _src, hsvColorRange _hsv, cv::Mat& _dst, cv::Mat& _tmp)
+{
     // If H.lower is higher than H.upper it means that we would like to
     // detect something in the range [0-upper] & [lower-180] (i.e. the red)
     // So the thresholded image will be made with two opencv calls to inRange
     // and then the two will be merged into one
     if (_hsv.H.min > _hsv.H.max)
     {
-        cv::Mat resA = _src.clone();
-        cv::Mat resB = _src.clone();
-
         cv::inRange(_src, cv::Scalar(         0, _hsv.S.min, _hsv.V.min),
-                          cv::Scalar(_hsv.H.max, _hsv.S.max, _hsv.V.max), resA);
+                          cv::Scalar(_hsv.H.max, _hsv.S.max, _hsv.V.max), _dst);
         cv::inRange(_src, cv::Scalar(_hsv.H.min, _hsv.S.min, _hsv.V.min),
-                          cv::Scalar(       180, _hsv.S.max, _hsv.V.max), resB);
+                          cv::Scalar(       180, _hsv.S.max, _hsv.V.max), _tmp);
 
-        cv::bitwise_or(resA,resB,res);
+        cv::bitwise_or(_dst, _tmp, _dst);
     }
     else
     {
         cv::inRange(_src, cv::Scalar(_hsv.get_hsv_min()),
-                          cv::Scalar(_hsv.get_hsv_max()), res);
+                          cv::Scalar(_hsv.get_hsv_max()), _dst);
     }
+}
 
-    return res;
+/**************************************************************************/
+/**                        HSV_LABELER                                   **/
+/**************************************************************************/
+
+hsvLabeler::hsvLabeler() : is_lut_bgr_ok(false)
+{
+    lut_h.fill(0);
+    lut_s.fill(0);
+    lut_v.fill(0);
+}
+
+/**
+ * Checks if a value is within a color range (extremes included, as in cv::inRange)
+ */
+static bool isInRange(int _val, const colorRange& _cr)
+{
+    return _cr.min <= _val && _val <= _cr.max;
+}
+
+bool hsvLabeler::setColorRanges(const vector<hsvColorRange>& _hsvs, bool _build_bgr)
+{
+    if (_hsvs.size() > HSV_MAX_LABELS)
+    {
+        ROS_ERROR("Too many color ranges: %lu. At most %i are allowed.",
+                                           _hsvs.size(), HSV_MAX_LABELS);
+        return false;
+    }
+
+    if (_hsvs == ranges)
+    {
+        if (_build_bgr && not is_lut_bgr_ok)    { buildBGRLUT(); }
+        return true;
+    }
+
+    ranges = _hsvs;
+    is_lut_bgr_ok = false;
+
+    lut_h.fill(0);
+    lut_s.fill(0);
+    lut_v.fill(0);
+
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        uint32_t bit = uint32_t(1) << i;
+        const hsvColorRange &hsv = ranges[i];
+
+        for (int v = 0; v < 256; ++v)
+        {
+            // Same as hsvThreshold: if H.min is higher than H.max,
+            // the range is [0-H.max] & [H.min-180] (i.e. the red)
+            bool in_h = hsv.H.min > hsv.H.max?
+                        isInRange(v, colorRange(0, hsv.H.max)) || isInRange(v, colorRange(hsv.H.min, 180)):
+                        isInRange(v, hsv.H);
+
+            if (in_h)                  { lut_h[v] |= bit; }
+            if (isInRange(v, hsv.S))   { lut_s[v] |= bit; }
+            if (isInRange(v, hsv.V))   { lut_v[v] |= bit; }
+        }
+    }
+
+    if (_build_bgr)    { buildBGRLUT(); }
+
+    return true;
+}
+
+void hsvLabeler::label(const cv::Mat& _src, cv::Mat& _labels) const
+{
+    CV_Assert(_src.type() == CV_8UC3);
+
+    _labels.create(_src.size(), CV_32SC1);
+
+    for (int r = 0; r < _src.rows; ++r)
+    {
+        const uchar *src = _src.ptr<uchar>(r);
+        uint32_t    *dst = _labels.ptr<uint32_t>(r);
+
+        for (int c = 0; c < _src.cols; ++c, src += 3)
+        {
+            dst[c] = lut_h[src[0]] & lut_s[src[1]] & lut_v[src[2]];
+        }
+    }
+}
+
+void hsvLabeler::buildBGRLUT()
+{
+    lut_bgr.resize((ranges.size() + 7) / 8);
+    is_lut_bgr_ok = true;
+
+    if (lut_bgr.empty())    { return; }
+
+    for (size_t t = 0; t < lut_bgr.size(); ++t)
+    {
+        lut_bgr[t].resize(256 * 256 * 256);
+    }
+
+    // The BGR colors are converted one slice (i.e. one value of B) at a time
+    cv::Mat bgr(256, 256, CV_8UC3);
+    cv::Mat hsv;
+
+    for (int b = 0; b < 256; ++b)
+    {
+        for (int g = 0; g < 256; ++g)
+        {
+            uchar *dst = bgr.ptr<uchar>(g);
+
+            for (int r = 0; r < 256; ++r, dst += 3)
+            {
+                dst[0] = b; dst[1] = g; dst[2] = r;
+            }
+        }
+
+        cv::cvtColor(bgr, hsv, CV_BGR2HSV);
+
+        for (int g = 0; g < 256; ++g)
+        {
+            const uchar *src = hsv.ptr<uchar>(g);
+
+            for (int r = 0; r < 256; ++r, src += 3)
+            {
+                uint32_t mask = lut_h[src[0]] & lut_s[src[1]] & lut_v[src[2]];
+                size_t    idx = (size_t(b) << 16) | (size_t(g) << 8) | size_t(r);
+
+                for (size_t t = 0; t < lut_bgr.size(); ++t)
+                {
+                    lut_bgr[t][idx] = uint8_t(mask >> (8 * t));
+                }
+            }
+        }
+    }
+}
+
+void hsvLabeler::labelBGR(const cv::Mat& _src, cv::Mat& _labels)
+{
+    CV_Assert(_src.type() == CV_8UC3);
+
+    if (not is_lut_bgr_ok)    { buildBGRLUT(); }
+
+    _labels.create(_src.size(), CV_32SC1);
+
+    if (lut_bgr.empty())
+    {
+        _labels.setTo(cv::Scalar::all(0));
+        return;
+    }
+
+    for (int r = 0; r < _src.rows; ++r)
+    {
+        const uchar *src = _src.ptr<uchar>(r);
+        uint32_t    *dst = _labels.ptr<uint32_t>(r);
+
+        for (int c = 0; c < _src.cols; ++c, src += 3)
+        {
+            size_t   idx = (size_t(src[0]) << 16) | (size_t(src[1]) << 8) | size_t(src[2]);
+            uint32_t res = lut_bgr[0][idx];
+
+            for (size_t t = 1; t < lut_bgr.size(); ++t)
+            {
+                res |= uint32_t(lut_bgr[t][idx]) << (8 * t);
+            }
+
+            dst[c] = res;
+        }
+    }
+}
+
+void hsvLabeler::extract(const cv::Mat& _labels, int _idx, cv::Mat& _dst)
+{
+    CV_Assert(_labels.type() == CV_32SC1);
+
+    _dst.create(_labels.size(), CV_8UC1);
+
+    uint32_t bit = uint32_t(1) << _idx;
+
+    for (int r = 0; r < _labels.rows; ++r)
+    {
+        const uint32_t *src = _labels.ptr<uint32_t>(r);
+        uchar          *dst =    _dst.ptr<uchar>(r);
+
+        for (int c = 0; c < _labels.cols; ++c)
+        {
+            dst[c] = (src[c] & bit)? 255 : 0;
+        }
+    }
+}
+
+/**
+ * Applies a 3x3 morphological operation to a labeled image. Pixels outside of
+ * the image are ignored, which is equivalent to the default border of cv::erode
+ * and cv::dilate. The operation is separable, so it is done in two passes
+ * (rows into _tmp, and then columns back into _labels).
+ */
+template<typename Op>
+static void morphLabels(cv::Mat& _labels, cv::Mat& _tmp, Op _op)
+{
+    CV_Assert(_labels.type() == CV_32SC1);
+
+    _tmp.create(_labels.size(), CV_32SC1);
+
+    int rows = _labels.rows;
+    int cols = _labels.cols;
+
+    if (rows == 0 || cols == 0)    { return; }
+
+    for (int r = 0; r < rows; ++r)
+    {
+        const uint32_t *src = _labels.ptr<uint32_t>(r);
+        uint32_t       *dst =    _tmp.ptr<uint32_t>(r);
+
+        if (cols == 1)    { dst[0] = src[0]; continue; }
+
+        dst[0] = _op(src[0], src[1]);
+
+        for (int c = 1; c < cols - 1; ++c)
+        {
+            dst[c] = _op(_op(src[c-1], src[c]), src[c+1]);
+        }
+
+        dst[cols-1] = _op(src[cols-2], src[cols-1]);
+    }
+
+    for (int r = 0; r < rows; ++r)
+    {
+        const uint32_t *up  = _tmp.ptr<uint32_t>(r > 0?        r - 1 : r);
+        const uint32_t *mid = _tmp.ptr<uint32_t>(r);
+        const uint32_t *dwn = _tmp.ptr<uint32_t>(r < rows - 1? r + 1 : r);
+        uint32_t       *dst = _labels.ptr<uint32_t>(r);
+
+        for (int c = 0; c < cols; ++c)
+        {
+            dst[c] = _op(_op(up[c], mid[c]), dwn[c]);
+        }
+    }
+}
+
+void erodeLabels(cv::Mat& _labels, cv::Mat& _tmp, int _iterations)
+{
+    for (int i = 0; i < _iterations; ++i)
+    {
+        morphLabels(_labels, _tmp, std::bit_and<uint32_t>());
+    }
+}
+
+void dilateLabels(cv::Mat& _labels, cv::Mat& _tmp, int _iterations)
+{
+    for (int i = 0; i < _iterations; ++i)
+    {
+        morphLabels(_labels, _tmp, std::bit_or<uint32_t>());
+    }
 }
 
 /**************************************************************************/
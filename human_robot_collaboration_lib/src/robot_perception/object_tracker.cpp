@@ -0,0 +1,181 @@
+#include "robot_perception/object_tracker.h"
+
+using namespace std;
+
+/************************************************************************************/
+/*                                     OBJECT KF                                    */
+/************************************************************************************/
+ObjectKF::ObjectKF(double _acc_noise, double _meas_noise) :
+                   acc_noise(_acc_noise), meas_noise(_meas_noise)
+{
+
+}
+
+void ObjectKF::predict(State& _s, const ros::Time& _t) const
+{
+    double dt = (_t - _s.stamp).toSec();
+
+    // x = F x, with F = [1 dt; 0 1] (applied to every axis)
+    _s.x.col(0) += dt * _s.x.col(1);
+
+    // P = F P F' + Q, with Q the discretized white acceleration noise
+    Eigen::Matrix2d F;
+    F << 1.0,  dt,
+         0.0, 1.0;
+
+    Eigen::Matrix2d Q;
+    Q << dt*dt*dt/3.0, dt*dt/2.0,
+            dt*dt/2.0,        dt;
+
+    _s.P     = F * _s.P * F.transpose() + acc_noise * Q;
+    _s.stamp = _t;
+}
+
+void ObjectKF::correct(State& _s, const Measurement& _m) const
+{
+    // Only the position is measured, so H = [1 0] and the gain is a 2x1 vector
+    double            S = _s.P(0, 0) + meas_noise;
+    Eigen::Vector2d   K = _s.P.col(0) / S;
+
+    Eigen::Vector3d innov = _m.pos - _s.x.col(0);
+
+    _s.x.col(0) += K(0) * innov;
+    _s.x.col(1) += K(1) * innov;
+
+    _s.P = (Eigen::Matrix2d::Identity() - K * Eigen::RowVector2d(1.0, 0.0)) * _s.P;
+
+    _s.ori = _s.ori.slerp(OBJ_KF_ORI_GAIN, _m.ori);
+}
+
+bool ObjectKF::update(const geometry_msgs::Pose& _pose, const ros::Time& _stamp)
+{
+    Measurement m;
+    m.stamp = _stamp;
+    m.pos   = Eigen::Vector3d(_pose.position.x, _pose.position.y, _pose.position.z);
+    m.ori   = Eigen::Quaterniond(_pose.orientation.w, _pose.orientation.x,
+                                 _pose.orientation.y, _pose.orientation.z).normalized();
+
+    // If the filter is empty, or too old, it is (re)initialized with the measurement
+    if (history.empty() || (_stamp - history.back().stamp).toSec() > OBJ_KF_TIMEOUT)
+    {
+        history.clear();
+
+        m.posterior.stamp = _stamp;
+        m.posterior.x.col(0) = m.pos;
+        m.posterior.x.col(1).setZero();
+        m.posterior.P << meas_noise,                 0.0,
+                                0.0, OBJ_KF_VEL_VAR_INIT;
+        m.posterior.ori = m.ori;
+
+        history.push_back(m);
+
+        return true;
+    }
+
+    // Find where the measurement goes in the history (it is usually at the end)
+    size_t idx = history.size();
+    while (idx > 0 && history[idx - 1].stamp >= _stamp)    { --idx; }
+
+    // Measurements older than the whole history, or duplicates, are discarded
+    if (idx == 0 || (idx < history.size() && history[idx].stamp == _stamp))
+    {
+        return false;
+    }
+
+    history.insert(history.begin() + idx, m);
+
+    // The filter is re-run from the state before the new measurement
+    State s = history[idx - 1].posterior;
+
+    for (size_t i = idx; i < history.size(); ++i)
+    {
+        predict(s, history[i].stamp);
+        correct(s, history[i]);
+        history[i].posterior = s;
+    }
+
+    while (history.size() > OBJ_KF_HISTORY)    { history.pop_front(); }
+
+    return true;
+}
+
+bool ObjectKF::predict(const ros::Time& _t, geometry_msgs::Pose& _pose) const
+{
+    if (history.empty())    { return false; }
+
+    const State& s = history.back().posterior;
+
+    double dt = (_t - s.stamp).toSec();
+
+    if (dt > OBJ_KF_TIMEOUT)    { return false; }
+
+    // The pose is not extrapolated backwards, nor too far in the future
+    dt = max(0.0, min(OBJ_KF_MAX_PREDICTION, dt));
+
+    Eigen::Vector3d pos = s.x.col(0) + dt * s.x.col(1);
+
+    _pose.position.x    = pos[0];
+    _pose.position.y    = pos[1];
+    _pose.position.z    = pos[2];
+    _pose.orientation.x = s.ori.x();
+    _pose.orientation.y = s.ori.y();
+    _pose.orientation.z = s.ori.z();
+    _pose.orientation.w = s.ori.w();
+
+    return true;
+}
+
+Eigen::Vector3d ObjectKF::getVelocity() const
+{
+    if (history.empty())    { return Eigen::Vector3d::Zero(); }
+
+    return history.back().posterior.x.col(1);
+}
+
+ros::Time ObjectKF::getLastStamp() const
+{
+    if (history.empty())    { return ros::Time(0); }
+
+    return history.back().stamp;
+}
+
+/************************************************************************************/
+/*                                  OBJECT TRACKER                                  */
+/************************************************************************************/
+ObjectTracker::ObjectTracker(double _acc_noise, double _meas_noise) :
+                             acc_noise(_acc_noise), meas_noise(_meas_noise)
+{
+
+}
+
+bool ObjectTracker::update(int _id, const geometry_msgs::Pose& _pose, const ros::Time& _stamp)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    auto it = filters.find(_id);
+
+    if (it == filters.end())
+    {
+        it = filters.insert(make_pair(_id, ObjectKF(acc_noise, meas_noise))).first;
+    }
+
+    return it->second.update(_pose, _stamp);
+}
+
+bool ObjectTracker::predict(int _id, const ros::Time& _t, geometry_msgs::Pose& _pose) const
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    auto it = filters.find(_id);
+
+    if (it == filters.end())    { return false; }
+
+    return it->second.predict(_t, _pose);
+}
+
+void ObjectTracker::clear()
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    filters.clear();
+}
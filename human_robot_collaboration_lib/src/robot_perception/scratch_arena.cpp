@@ -0,0 +1,24 @@
+#include "robot_perception/scratch_arena.h"
+
+bool ScratchArena::reserve(const cv::Size& _img_size)
+{
+    if (_img_size == img_size)    { return false; }
+
+    img_size = _img_size;
+
+    bgr_buf.create   (img_size, CV_8UC3);
+    hsv_buf.create   (img_size, CV_8UC3);
+    thres_buf.create (img_size, CV_8UC1);
+    tmp_buf.create   (img_size, CV_8UC1);
+    labels_buf.create(img_size, CV_32SC1);
+    ltmp_buf.create  (img_size, CV_32SC1);
+
+    return true;
+}
+
+cv::Mat ScratchArena::view(const cv::Mat& _buf, const cv::Size& _size) const
+{
+    CV_Assert(_size.width <= img_size.width && _size.height <= img_size.height);
+
+    return _buf(cv::Rect(cv::Point(0, 0), _size));
+}
@@ -1,8 +1,19 @@
 #include "robot_utils/hiro_trac_ik.h"
 
+#include <cmath>
+#include <algorithm>
+
+#define IK_CACHE_SIZE        16
+#define IK_CACHE_RES       1e-4 // [m] for the position, [-] for the quaternion
+#define IK_NR_MAX_ITER       50
+#define IK_BATCH_WORKERS      4 // Max number of workers for the batch IK
+
 hiroTracIK::hiroTracIK(std::string limb, std::string ee_name, bool _use_robot) :
                 _limb(limb), _urdf_param("/robot_description"),
-                _timeout(0.005), _eps(1e-6), _num_steps(4)
+                _timeout(0.005), _eps(1e-6), _num_steps(4),
+                _has_warm_start(false), _cache_age(0), _cache_res(IK_CACHE_RES),
+                _batch_workers(std::max(1u, std::min(std::thread::hardware_concurrency(),
+                                                     unsigned(IK_BATCH_WORKERS))))
 {
     if (not _use_robot)
     {
@@ -43,6 +54,26 @@ hiroTracIK::hiroTracIK(std::string limb, std::string ee_name, bool _use_robot) :
         exit(EXIT_FAILURE);
     }
 
+    for(size_t i=0; i<_chain.getNrOfSegments(); ++i)
+    {
+        KDL::Joint joint = _chain.getSegment(i).getJoint();
+        if(joint.getType()!=KDL::Joint::None)
+        {
+            _jnt_names.push_back(joint.getName());
+        }
+    }
+
+    // Preallocate the buffers used by solveIK()
+    _result.resize(_chain.getNrOfJoints());
+    _last_sol.resize(_chain.getNrOfJoints());
+
+    _cache.resize(IK_CACHE_SIZE);
+    for (size_t i = 0; i < _cache.size(); ++i)
+    {
+        _cache[i].sol.resize(_chain.getNrOfJoints());
+    }
+    clearCache();
+
     double s1l = -1.35;
     double s1u =  1.0;
     ROS_INFO("[%s] Setting custom joint limits for %s_s1: [%g %g]",
@@ -69,9 +100,38 @@ bool hiroTracIK::getKDLLimits(KDL::JntArray &ll, KDL::JntArray &ul)
 bool hiroTracIK::setKDLLimits(KDL::JntArray ll, KDL::JntArray ul)
 {
     _tracik_solver->setKDLLimits(ll,ul);
+
+    _ll = ll;
+    _ul = ul;
+
+    // The local solver and the cached solutions
+    // depend on the joint limits, so they need to be reset
+    initLocalSolver();
+    clearCache();
+
+    // The batch solvers will be recreated with the new limits when needed
+    std::lock_guard<std::mutex> lck(_batch_mtx);
+    _batch_solvers.clear();
+
     return true;
 }
 
+void hiroTracIK::initLocalSolver()
+{
+    if (not _fk_solver)
+    {
+        _fk_solver.reset(new KDL::ChainFkSolverPos_recursive(_chain));
+    }
+
+    if (not _vel_solver)
+    {
+        _vel_solver.reset(new KDL::ChainIkSolverVel_pinv(_chain));
+    }
+
+    _nr_solver.reset(new KDL::ChainIkSolverPos_NR_JL(_chain, _ll, _ul, *_fk_solver, *_vel_solver,
+                                                     IK_NR_MAX_ITER, _eps));
+}
+
 hiroTracIK::~hiroTracIK()
 {
     if (_tracik_solver)
@@ -99,58 +159,254 @@ KDL::JntArray hiroTracIK::JointState2JntArray(const sensor_msgs::JointState &js)
 
 bool hiroTracIK::perform_ik(intera_core_msgs::SolvePositionIK &ik_srv)
 {
-    int rc = -1;
-    KDL::JntArray result;
-    sensor_msgs::JointState joint_state;
+    if (not _tracik_solver) { return false; }
 
-    for(size_t i=0; i<_chain.getNrOfSegments(); ++i)
+    std::vector<KDL::Frame>    poses;
+    std::vector<KDL::JntArray> seeds;
+
+    for (size_t i = 0; i < ik_srv.request.pose_stamp.size(); ++i)
     {
-        KDL::Joint joint = _chain.getSegment(i).getJoint();
-        if(joint.getType()!=KDL::Joint::None)
+        const geometry_msgs::Pose &p = ik_srv.request.pose_stamp[i].pose;
+
+        poses.push_back(KDL::Frame(KDL::Rotation::Quaternion(p.orientation.x, p.orientation.y,
+                                                             p.orientation.z, p.orientation.w),
+                                   KDL::Vector(p.position.x, p.position.y, p.position.z)));
+
+        bool seed_provided = i < ik_srv.request.seed_angles.size() &&
+                             ik_srv.request.seed_angles[i].name.size() == _jnt_names.size();
+
+        seeds.push_back(seed_provided? JointState2JntArray(ik_srv.request.seed_angles[i]) : *(_nominal));
+    }
+
+    std::vector<IKResult> res;
+    solveBatch(poses, seeds, res);
+
+    for (size_t i = 0; i < res.size(); ++i)
+    {
+        sensor_msgs::JointState joint_state;
+        joint_state.name = _jnt_names;
+
+        for(size_t j=0; j<_chain.getNrOfJoints(); ++j)
         {
-            joint_state.name.push_back(joint.getName());
+            joint_state.position.push_back(res[i].jnts(j));
         }
+
+        ik_srv.response.joints.push_back(joint_state);
+        ik_srv.response.result_type.push_back(res[i].success);
     }
 
-    bool seeds_provided = ik_srv.request.seed_angles[0].name.size() == joint_state.name.size();
+    return true;
+}
 
-    joint_state.position.clear();
-    KDL::Frame ee_pose(KDL::Rotation::Quaternion(ik_srv.request.pose_stamp[0].pose.orientation.x,
-                                                 ik_srv.request.pose_stamp[0].pose.orientation.y,
-                                                 ik_srv.request.pose_stamp[0].pose.orientation.z,
-                                                 ik_srv.request.pose_stamp[0].pose.orientation.w),
-                       KDL::Vector(ik_srv.request.pose_stamp[0].pose.position.x,
-                                   ik_srv.request.pose_stamp[0].pose.position.y,
-                                   ik_srv.request.pose_stamp[0].pose.position.z));
+void hiroTracIK::initBatchSolvers()
+{
+    if (not _batch_pool)
+    {
+        _batch_pool.reset(new ThreadPool(_batch_workers));
+    }
 
-    KDL::JntArray seed(_chain.getNrOfJoints());
+    while (_batch_solvers.size() < _batch_pool->size())
+    {
+        _batch_solvers.push_back(std::unique_ptr<TRAC_IK::TRAC_IK>(
+                                 new TRAC_IK::TRAC_IK(_chain, _ll, _ul, _timeout, _eps, TRAC_IK::Distance)));
+    }
+}
+
+void hiroTracIK::solveBatch(const std::vector<KDL::Frame>    &_poses,
+                            const std::vector<KDL::JntArray> &_seeds,
+                                  std::vector<IKResult>      &_res)
+{
+    _res.resize(_poses.size());
+
+    if (_poses.empty() || _seeds.empty()) { return; }
 
-    if(seeds_provided)   seed = JointState2JntArray(ik_srv.request.seed_angles[0]);
+    std::lock_guard<std::mutex> lck(_batch_mtx);
+    initBatchSolvers();
 
-    for(int num_attempts=0; num_attempts<_num_steps; ++num_attempts)
+    _batch_pool->parallelFor(_poses.size(), [&](size_t _task, size_t _worker)
     {
-        if (num_attempts>0)
+        const KDL::JntArray &seed = _seeds.size() == _poses.size()? _seeds[_task] : _seeds[0];
+        IKResult            &res  = _res[_task];
+
+        res.idx     =                 _task;
+        res.success =                 false;
+        res.dist    =              INFINITY;
+        res.jnts.resize(_chain.getNrOfJoints());
+
+        int rc = -1;
+
+        for(int num_attempts=0; rc<0 && num_attempts<_num_steps; ++num_attempts)
         {
-            ROS_DEBUG("Attempt num %i with tolerance %g", num_attempts, _eps);
+            rc = _batch_solvers[_worker]->CartToJnt(seed, _poses[_task], res.jnts);
         }
 
-        rc = _tracik_solver->CartToJnt(seeds_provided? seed: *(_nominal), ee_pose, result);
+        if (rc >= 0)
+        {
+            res.success = true;
+            res.dist    = (res.jnts.data - seed.data).norm();
+        }
+    });
+}
+
+bool hiroTracIK::solveIKBatch(const std::vector<KDL::Frame> &_poses, const KDL::JntArray &_seed,
+                              std::vector<IKResult> &_res)
+{
+    if (not _tracik_solver || _seed.rows() != _chain.getNrOfJoints()) { return false; }
+
+    solveBatch(_poses, std::vector<KDL::JntArray>(1, _seed), _res);
+
+    // Successful solutions first, ranked by distance from the seed
+    std::stable_sort(_res.begin(), _res.end(), [](const IKResult &_a, const IKResult &_b)
+    {
+        if (_a.success != _b.success) { return _a.success; }
+
+        return _a.dist < _b.dist;
+    });
+
+    return not _res.empty() && _res[0].success;
+}
+
+bool hiroTracIK::solveIK(const KDL::Frame &_pose, KDL::JntArray &_jnts)
+{
+    if (not _tracik_solver) { return false; }
 
-        // computeFwdKin(result);
-        if(rc>=0) break;
+    if (_jnts.rows() != _chain.getNrOfJoints())
+    {
+        _jnts.resize(_chain.getNrOfJoints());
     }
 
-    for(size_t j=0; j<_chain.getNrOfJoints(); ++j)
+    long key[7];
+    poseToKey(_pose, key);
+
+    if (lookupCache(key, _jnts))
     {
-        joint_state.position.push_back(result(j));
+        ++_stats.cache_hits;
+
+        _last_sol       = _jnts;
+        _has_warm_start = true;
+        return true;
+    }
+
+    const KDL::JntArray &seed = _has_warm_start? _last_sol : *(_nominal);
+
+    // Along a smooth trajectory the warm start is very close to the solution,
+    // hence the local solver converges in a handful of iterations. TRAC_IK
+    // is used only if this is not the case.
+    int rc = _nr_solver->CartToJnt(seed, _pose, _jnts);
+
+    if (rc >= 0)
+    {
+        ++_stats.local_sols;
     }
+    else
+    {
+        ++_stats.tracik_calls;
+
+        for(int num_attempts=0; rc<0 && num_attempts<_num_steps; ++num_attempts)
+        {
+            rc = _tracik_solver->CartToJnt(seed, _pose, _jnts);
+        }
+
+        if (rc < 0) { return false; }
+
+        ++_stats.tracik_sols;
+    }
+
+    storeCache(key, _jnts);
+
+    _last_sol       = _jnts;
+    _has_warm_start = true;
+
+    return true;
+}
+
+bool hiroTracIK::solveIK(const Eigen::Vector3d &_pos, const Eigen::Quaterniond &_ori,
+                         Eigen::VectorXd &_jnts)
+{
+    KDL::Frame pose(KDL::Rotation::Quaternion(_ori.x(), _ori.y(), _ori.z(), _ori.w()),
+                    KDL::Vector(_pos[0], _pos[1], _pos[2]));
+
+    if (!solveIK(pose, _result)) { return false; }
+
+    _jnts = _result.data;
 
-    ik_srv.response.joints.push_back(joint_state);
-    ik_srv.response.result_type.push_back(rc>=0);
+    return true;
+}
+
+bool hiroTracIK::setSeed(const Eigen::VectorXd &_seed)
+{
+    if (not _tracik_solver || _seed.size() != _last_sol.data.size()) { return false; }
+
+    _last_sol.data  = _seed;
+    _has_warm_start = true;
 
     return true;
 }
 
+void hiroTracIK::poseToKey(const KDL::Frame &_pose, long _key[7])
+{
+    double x, y, z, w;
+    _pose.M.GetQuaternion(x, y, z, w);
+
+    // q and -q represent the same orientation
+    if (w < 0) { x = -x; y = -y; z = -z; w = -w; }
+
+    _key[0] = lround(_pose.p.x() / _cache_res);
+    _key[1] = lround(_pose.p.y() / _cache_res);
+    _key[2] = lround(_pose.p.z() / _cache_res);
+    _key[3] = lround(x / _cache_res);
+    _key[4] = lround(y / _cache_res);
+    _key[5] = lround(z / _cache_res);
+    _key[6] = lround(w / _cache_res);
+}
+
+bool hiroTracIK::lookupCache(const long _key[7], KDL::JntArray &_sol)
+{
+    for (size_t i = 0; i < _cache.size(); ++i)
+    {
+        if (_cache[i].valid && std::equal(_key, _key + 7, _cache[i].key))
+        {
+            _cache[i].age = ++_cache_age;
+            _sol          = _cache[i].sol;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void hiroTracIK::storeCache(const long _key[7], const KDL::JntArray &_sol)
+{
+    // Pick either an empty entry or the least recently used one
+    size_t idx = 0;
+    for (size_t i = 0; i < _cache.size(); ++i)
+    {
+        if (not _cache[i].valid)                { idx = i; break; }
+        if (_cache[i].age < _cache[idx].age)    { idx = i;        }
+    }
+
+    std::copy(_key, _key + 7, _cache[idx].key);
+    _cache[idx].sol   =         _sol;
+    _cache[idx].age   = ++_cache_age;
+    _cache[idx].valid =         true;
+}
+
+void hiroTracIK::clearCache()
+{
+    for (size_t i = 0; i < _cache.size(); ++i)
+    {
+        _cache[i].valid = false;
+        _cache[i].age   =     0;
+    }
+}
+
+bool hiroTracIK::computeFwdKin(const KDL::JntArray &_jnts, KDL::Frame &_pose)
+{
+    if (not _fk_solver || _jnts.rows() != _chain.getNrOfJoints()) { return false; }
+
+    return _fk_solver->JntToCart(_jnts, _pose) >= 0;
+}
+
 #include <iostream>
 #include <kdl/chainfksolver.hpp>
 #include <kdl/chainfksolverpos_recursive.hpp>
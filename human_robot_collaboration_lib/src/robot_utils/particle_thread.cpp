@@ -18,7 +18,8 @@
 /*****************************************************************************/
 /*                             ParticleThread                                */
 /*****************************************************************************/
-ParticleThread::ParticleThread(std::string _name, double _thread_rate, bool _rviz_visual) :
+template<int N>
+ParticleThread<N>::ParticleThread(std::string _name, double _thread_rate, bool _rviz_visual) :
                                name(_name), r(_thread_rate), is_running(false), is_closing(false),
                                rviz_visual(_rviz_visual), start_time(ros::Time::now()),
                                is_set(false), rviz_pub(_name)
@@ -26,17 +27,15 @@ ParticleThread::ParticleThread(std::string _name, double _thread_rate, bool _rvi
 
 }
 
-void ParticleThread::internalThread()
+template<int N>
+void ParticleThread<N>::internalThread()
 {
     start_time = ros::Time::now();
 
     while(ros::ok() && not is_closing.get())
     {
         // ROS_INFO("Running..");
-        Eigen::VectorXd new_pt;
-
-        updateParticle(new_pt);
-        setCurrPoint(new_pt);
+        cycle();
 
         // ROS_INFO_STREAM("New particle position: " << getCurrPoint().transpose());
 
@@ -44,12 +43,33 @@ void ParticleThread::internalThread()
     }
 }
 
-bool ParticleThread::start()
+template<int N>
+bool ParticleThread<N>::cycle()
+{
+    Point new_pt;
+
+    updateParticle((ros::Time::now() - start_time).toSec(), new_pt);
+
+    return setCurrPoint(new_pt);
+}
+
+template<int N>
+bool ParticleThread<N>::evaluate(double _elap_time, Point& _pt)
+{
+    if (not is_set.get())    { return false; }
+
+    updateParticle(_elap_time, _pt);
+
+    return true;
+}
+
+template<int N>
+bool ParticleThread<N>::start()
 {
     if (is_set.get() && not is_running.get())
     {
         is_closing.set(false);
-        thread = std::thread(&ParticleThread::internalThread, this);
+        thread = std::thread(&ParticleThread<N>::internalThread, this);
         is_running.set(true);
 
         if (rviz_visual) { rviz_pub.start(); };
@@ -62,7 +82,8 @@ bool ParticleThread::start()
     }
 }
 
-bool ParticleThread::stop()
+template<int N>
+bool ParticleThread<N>::stop()
 {
     is_closing.set(true);
     is_running.set(false);
@@ -80,18 +101,21 @@ bool ParticleThread::stop()
     return true;
 }
 
-double ParticleThread::getRate()
+template<int N>
+double ParticleThread<N>::getRate()
 {
     return 1/r.expectedCycleTime().toSec();
 }
 
-void ParticleThread::setMarker()
+template<int N>
+void ParticleThread<N>::setMarker()
 {
-    if (getCurrPoint().size() == 3)
+    if (N == 3)
     {
-        rviz_pub.setMarkers(std::vector<RVIZMarker>{RVIZMarker(getCurrPoint(),
-                                                               ColorRGBA(0.0, 1.0, 1.0),
-                                                               0.015)});
+        Point pt = getCurrPoint();
+        // The marker is updated in place, so that nothing is reallocated at every cycle
+        rviz_pub.setMarker(0, RVIZMarker(Eigen::Map<Eigen::Vector3d>(pt.data()),
+                                         ColorRGBA(0.0, 1.0, 1.0), 0.015), true);
     }
     else
     {
@@ -100,12 +124,14 @@ void ParticleThread::setMarker()
     }
 }
 
-Eigen::VectorXd ParticleThread::getCurrPoint()
+template<int N>
+typename ParticleThread<N>::Point ParticleThread<N>::getCurrPoint()
 {
     return curr_pt.get();
 }
 
-bool ParticleThread::setCurrPoint(const Eigen::VectorXd& _curr_pt)
+template<int N>
+bool ParticleThread<N>::setCurrPoint(const Point& _curr_pt)
 {
     bool res = curr_pt.set(_curr_pt);
 
@@ -114,21 +140,24 @@ bool ParticleThread::setCurrPoint(const Eigen::VectorXd& _curr_pt)
     return res;
 }
 
-ParticleThread::~ParticleThread()
+template<int N>
+ParticleThread<N>::~ParticleThread()
 {
     stop();
 }
 
+template class ParticleThread<3>;
+
 /*****************************************************************************/
 /*                           ParticleThreadImpl                              */
 /*****************************************************************************/
 ParticleThreadImpl::ParticleThreadImpl(std::string _name, double _thread_rate, bool _rviz_visual) :
-                                       ParticleThread(_name, _thread_rate, _rviz_visual)
+                                       ParticleThread<3>(_name, _thread_rate, _rviz_visual)
 {
     is_set.set(true);
 }
 
-bool ParticleThreadImpl::updateParticle(Eigen::VectorXd& _new_pt)
+bool ParticleThreadImpl::updateParticle(double _elap_time, Point& _new_pt)
 {
     _new_pt = Eigen::Vector3d(1.0, 1.0, 1.0);
 
@@ -139,22 +168,20 @@ bool ParticleThreadImpl::updateParticle(Eigen::VectorXd& _new_pt)
 /*                          LinearPointParticle                              */
 /*****************************************************************************/
 LinearPointParticle::LinearPointParticle(std::string _name, double _thread_rate, bool _rviz_visual) :
-                                         ParticleThread(_name, _thread_rate, _rviz_visual),
+                                         ParticleThread<3>(_name, _thread_rate, _rviz_visual),
                                          start_pt(Eigen::Vector3d(0.0, 0.0, 0.0)),
                                          des_pt(Eigen::Vector3d(0.0, 0.0, 0.0)), speed(0.0)
 {
 
 }
 
-bool LinearPointParticle::updateParticle(Eigen::VectorXd& _new_pt)
+bool LinearPointParticle::updateParticle(double _elap_time, Point& _new_pt)
 {
-    double elap_time = (ros::Time::now() - start_time).toSec();
-
     Eigen::Vector3d p_sd = des_pt.get() - start_pt.get();
 
     // We model the particle as a 3D point that moves toward the
     // target with a straight trajectory and constant speed.
-    _new_pt = start_pt.get() + p_sd / p_sd.norm() * speed.get() * elap_time;
+    _new_pt = start_pt.get() + p_sd / p_sd.norm() * speed.get() * _elap_time;
 
     Eigen::Vector3d p_cd = des_pt.get() - _new_pt;
 
@@ -173,9 +200,9 @@ bool LinearPointParticle::updateParticle(Eigen::VectorXd& _new_pt)
 
 void LinearPointParticle::setMarker()
 {
-    ParticleThread::setMarker();
+    ParticleThread<3>::setMarker();
 
-    rviz_pub.push_back(RVIZMarker(des_pt.get(), ColorRGBA(1.0, 1.0, 0.0), 0.02));
+    rviz_pub.setMarker(1, RVIZMarker(des_pt.get(), ColorRGBA(1.0, 1.0, 0.0), 0.02), true);
 }
 
 bool LinearPointParticle::setupParticle(const Eigen::Vector3d& _start_pt,
@@ -200,16 +227,16 @@ LinearPointParticle::~LinearPointParticle()
 /*                          CircularPointParticle                              */
 /*****************************************************************************/
 CircularPointParticle::CircularPointParticle(std::string _name, double _thread_rate, bool _rviz_visual) :
-                                         ParticleThread(_name, _thread_rate, _rviz_visual),
+                                         ParticleThread<3>(_name, _thread_rate, _rviz_visual),
                                          center(Eigen::Vector3d(0.0, 0.0, 0.0)),
                                          angles(Eigen::Vector2d(0.0, 0.0)), radius(0.0), speed(0.0)
 {
 
 }
 
-bool CircularPointParticle::updateParticle(Eigen::VectorXd& _new_pt)
+bool CircularPointParticle::updateParticle(double _elap_time, Point& _new_pt)
 {
-    double et = (ros::Time::now() - start_time).toSec(); // Elapsed time
+    double et = _elap_time;     // Elapsed time
 
     double p = angles.get()[0]; // Azimuth phi
     double t = angles.get()[1]; // Zenith theta
@@ -229,9 +256,9 @@ bool CircularPointParticle::updateParticle(Eigen::VectorXd& _new_pt)
 
 void CircularPointParticle::setMarker()
 {
-    ParticleThread::setMarker();
+    ParticleThread<3>::setMarker();
 
-    rviz_pub.push_back(RVIZMarker(center.get(), ColorRGBA(1.0, 1.0, 0.0), 0.02));
+    rviz_pub.setMarker(1, RVIZMarker(center.get(), ColorRGBA(1.0, 1.0, 0.0), 0.02), true);
 }
 
 bool CircularPointParticle::setupParticle(const Eigen::Vector3d& _center,
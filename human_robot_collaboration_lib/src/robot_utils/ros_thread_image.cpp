@@ -6,7 +6,7 @@
 
 ROSThreadImage::ROSThreadImage(std::string _name, std::string _encoding) :
                                nh(_name), name(_name), is_closing(false),
-                               spinner(4), img_trp(nh), img_empty(true),
+                               spinner(4), img_trp(nh), img_front(0), img_seq(0), img_empty(true),
                                encoding(_encoding), r(50) // 50Hz
 {
     img_sub = img_trp.subscribe("/"+getName()+"/image", // "/cameras/right_hand_camera/image",
@@ -21,6 +21,13 @@ bool ROSThreadImage::startThread()
     return img_thread.joinable();
 }
 
+void ROSThreadImage::stopThread()
+{
+    setIsClosing(true);
+
+    if (img_thread.joinable()) { img_thread.join(); }
+}
+
 void ROSThreadImage::setIsClosing(bool _arg)
 {
     std::lock_guard<std::mutex> lock(mtx_is_closing);
@@ -48,16 +55,32 @@ void ROSThreadImage::imageCb(const sensor_msgs::ImageConstPtr& _msg)
         return;
     }
 
+    // Image callbacks are serialized, so the back buffer is only written here,
+    // and the lock is needed only to swap it with the front buffer
+    int back = 1 - img_front;
+    img_buf[back] = cv_ptr;
+
     std::lock_guard<std::mutex> lock(mutex_img);
-    curr_img  = cv_ptr->image.clone();
-    img_size  =       curr_img.size();
-    img_empty =      curr_img.empty();
+    img_front = back;
+    ++img_seq;
+    img_size  =  cv_ptr->image.size();
+    img_empty = cv_ptr->image.empty();
 }
 
-ROSThreadImage::~ROSThreadImage()
+bool ROSThreadImage::getNewImage(unsigned long& _seq, cv_bridge::CvImageConstPtr& _img)
 {
-    setIsClosing(true);
+    std::lock_guard<std::mutex> lock(mutex_img);
 
-    if (img_thread.joinable()) { img_thread.join(); }
+    if (img_seq == _seq || img_empty)    { return false; }
+
+    _img = img_buf[img_front];
+    _seq =           img_seq;
+
+    return true;
+}
+
+ROSThreadImage::~ROSThreadImage()
+{
+    stopThread();
 }
 
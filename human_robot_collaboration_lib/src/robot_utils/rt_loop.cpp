@@ -0,0 +1,229 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#include "robot_utils/rt_loop.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <algorithm>
+
+#define NSEC_PER_SEC   1000000000L
+
+/**
+ * Converts a timespec into seconds
+ */
+static double toSec(const struct timespec& _t)
+{
+    return _t.tv_sec + _t.tv_nsec * 1e-9;
+}
+
+/**
+ * Adds a number of nanoseconds to a timespec
+ */
+static void addNsec(struct timespec& _t, long _nsec)
+{
+    _t.tv_nsec += _nsec;
+
+    while (_t.tv_nsec >= NSEC_PER_SEC)
+    {
+        _t.tv_nsec -= NSEC_PER_SEC;
+        ++_t.tv_sec;
+    }
+}
+
+/**
+ * Returns true if _a is before _b
+ */
+static bool isBefore(const struct timespec& _a, const struct timespec& _b)
+{
+    return _a.tv_sec < _b.tv_sec || (_a.tv_sec == _b.tv_sec && _a.tv_nsec < _b.tv_nsec);
+}
+
+/*****************************************************************************/
+/*                               RTLoopStats                                 */
+/*****************************************************************************/
+RTLoopStats::RTLoopStats(double _period) : period(_period), cycles(0), overruns(0),
+                                           jitter_last(0.0),     jitter_mean(0.0),     jitter_max(0.0),
+                                           ik_cycles(0),  ik_time_last(0.0),  ik_time_mean(0.0),  ik_time_max(0.0),
+                                           pub_cycles(0), pub_time_last(0.0), pub_time_mean(0.0), pub_time_max(0.0),
+                                           cycle_time_last(0.0), cycle_time_mean(0.0), cycle_time_max(0.0)
+{
+    hist.fill(0);
+}
+
+void RTLoopStats::toMsg(human_robot_collaboration_msgs::CtrlLoopStats& _msg) const
+{
+    _msg.period          =          period;
+    _msg.cycles          =          cycles;
+    _msg.overruns        =        overruns;
+
+    _msg.jitter_last     =     jitter_last;
+    _msg.jitter_mean     =     jitter_mean;
+    _msg.jitter_max      =      jitter_max;
+
+    _msg.ik_cycles       =       ik_cycles;
+    _msg.ik_time_last    =    ik_time_last;
+    _msg.ik_time_mean    =    ik_time_mean;
+    _msg.ik_time_max     =     ik_time_max;
+
+    _msg.pub_cycles      =      pub_cycles;
+    _msg.pub_time_last   =   pub_time_last;
+    _msg.pub_time_mean   =   pub_time_mean;
+    _msg.pub_time_max    =    pub_time_max;
+
+    _msg.cycle_time_last = cycle_time_last;
+    _msg.cycle_time_mean = cycle_time_mean;
+    _msg.cycle_time_max  =  cycle_time_max;
+
+    _msg.hist_bin_width  = RT_HIST_BIN_WIDTH;
+    _msg.hist.assign(hist.begin(), hist.end());
+}
+
+std::string RTLoopStats::printHistogram() const
+{
+    std::stringstream res;
+
+    res << "Cycles: " << cycles << " Overruns: " << overruns << "\n";
+
+    for (size_t i = 0; i < hist.size(); ++i)
+    {
+        if (hist[i] == 0) { continue; }
+
+        res << "[" << i * RT_HIST_BIN_WIDTH * 1e6 << ", ";
+
+        if (i + 1 < hist.size())    { res << (i + 1) * RT_HIST_BIN_WIDTH * 1e6 << ") us: "; }
+        else                        { res << "inf) us: "; }
+
+        res << hist[i] << "\n";
+    }
+
+    return res.str();
+}
+
+/*****************************************************************************/
+/*                                  RTLoop                                   */
+/*****************************************************************************/
+RTLoop::RTLoop(double _freq) : period(1.0 / _freq), ik_time(0.0), pub_time(0.0),
+                               has_ik(false), has_pub(false),
+                               stats(1.0 / _freq), shared_stats(stats)
+{
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    cycle_start = deadline;
+}
+
+bool RTLoop::setPriority(int _priority)
+{
+    struct sched_param param;
+    param.sched_priority = _priority;
+
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+bool RTLoop::setAffinity(int _cpu)
+{
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(_cpu, &cpu_set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) == 0;
+}
+
+double RTLoop::now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return toSec(t);
+}
+
+void RTLoop::start()
+{
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    cycle_start = deadline;
+
+    ik_time  =   0.0;
+    pub_time =   0.0;
+    has_ik   = false;
+    has_pub  = false;
+
+    stats = RTLoopStats(period);
+    shared_stats.set(stats);
+}
+
+void RTLoop::updateStat(double _val, unsigned long _n, double& _last, double& _mean, double& _max)
+{
+    _last  = _val;
+    _mean += (_val - _mean) / _n;
+    _max   = std::max(_max, _val);
+}
+
+bool RTLoop::sleep()
+{
+    struct timespec cycle_end;
+    clock_gettime(CLOCK_MONOTONIC, &cycle_end);
+
+    ++stats.cycles;
+    updateStat(toSec(cycle_end) - toSec(cycle_start), stats.cycles, stats.cycle_time_last,
+                                  stats.cycle_time_mean, stats.cycle_time_max);
+
+    // Idle cycles (e.g. when the arm is not moving) would bias the means towards zero
+    if (has_ik)
+    {
+        ++stats.ik_cycles;
+        updateStat(ik_time,  stats.ik_cycles,  stats.ik_time_last,  stats.ik_time_mean,  stats.ik_time_max);
+    }
+
+    if (has_pub)
+    {
+        ++stats.pub_cycles;
+        updateStat(pub_time, stats.pub_cycles, stats.pub_time_last, stats.pub_time_mean, stats.pub_time_max);
+    }
+
+    ik_time  =   0.0;
+    pub_time =   0.0;
+    has_ik   = false;
+    has_pub  = false;
+
+    // If the deadline of the next cycle has already passed, the cycle
+    // is an overrun and the missed deadlines are skipped altogether
+    bool res = true;
+    long period_nsec = long(period * NSEC_PER_SEC);
+
+    addNsec(deadline, period_nsec);
+
+    if (isBefore(deadline, cycle_end))
+    {
+        res = false;
+        ++stats.overruns;
+
+        while (isBefore(deadline, cycle_end))    { addNsec(deadline, period_nsec); }
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {};
+
+    clock_gettime(CLOCK_MONOTONIC, &cycle_start);
+
+    double jitter = std::max(0.0, toSec(cycle_start) - toSec(deadline));
+    updateStat(jitter, stats.cycles, stats.jitter_last, stats.jitter_mean, stats.jitter_max);
+
+    size_t bin = std::min(size_t(jitter / RT_HIST_BIN_WIDTH), stats.hist.size() - 1);
+    ++stats.hist[bin];
+
+    shared_stats.set(stats);
+
+    return res;
+}
@@ -67,7 +67,7 @@ void RVIZMarker::setPosition(double _x, double _y, double _z)
 /**************************************************************************/
 
 RVIZPublisher::RVIZPublisher(std::string _name, double _timer_period) :
-                             nh(_name), spinner(4), name(_name),
+                             nh(_name), spinner(4), name(_name), is_dirty(false),
                              timer_period(_timer_period), is_timer_created(false)
 {
     rviz_pub = nh.advertise<visualization_msgs::MarkerArray>("/visualization_marker_array",
@@ -79,22 +79,41 @@ RVIZPublisher::RVIZPublisher(std::string _name, double _timer_period) :
 
 void RVIZPublisher::publishMarkersCb(const ros::TimerEvent&)
 {
-    std::vector<RVIZMarker> _markers = getMarkers();
+    bool is_changed = false;
 
-    // ROS_INFO("[%s] Markers size: %lu", getName().c_str(), markers.size());
-    if (_markers.size() > 0)
     {
-        visualization_msgs::MarkerArray mrkrs;
+        std::lock_guard<std::mutex> lg(markers_mutex);
 
-        for (size_t i = 0; i < _markers.size(); ++i)
+        // The markers are copied only if they changed, and the copy
+        // reuses the memory of the previous one (points included)
+        if (is_dirty)
         {
-            visualization_msgs::Marker mrkr;
+            pub_markers = markers;
+            is_dirty    =   false;
+            is_changed  =    true;
+        }
+    }
+
+    // ROS_INFO("[%s] Markers size: %lu", getName().c_str(), pub_markers.size());
+    if (pub_markers.size() == 0)    { return; }
+
+    ros::Time now = ros::Time::now();
+
+    if (not is_changed && (now - last_pub).toSec() < RVIZ_KEEPALIVE)    { return; }
+
+    if (is_changed)
+    {
+        pub_msg.markers.resize(pub_markers.size());
+
+        for (size_t i = 0; i < pub_markers.size(); ++i)
+        {
+            visualization_msgs::Marker &mrkr = pub_msg.markers[i];
 
             mrkr.header.frame_id =      "base";
             mrkr.header.stamp    = ros::Time();
             mrkr.ns     =            getName();
             mrkr.id     =               int(i);
-            mrkr.type   =     _markers[i].type;
+            mrkr.type   =  pub_markers[i].type;
             mrkr.action = visualization_msgs::Marker::ADD;
 
             if (mrkr.type == visualization_msgs::Marker::LINE_STRIP  ||
@@ -103,49 +122,38 @@ void RVIZPublisher::publishMarkersCb(const ros::TimerEvent&)
                 mrkr.type == visualization_msgs::Marker::SPHERE_LIST ||
                 mrkr.type == visualization_msgs::Marker::POINTS        )
             {
-                for (size_t j = 0; j < _markers[i].points.size(); ++j)
-                {
-                    mrkr.points.push_back(_markers[i].points[j]);
-                }
+                mrkr.points.assign(pub_markers[i].points.begin(), pub_markers[i].points.end());
+                mrkr.pose = geometry_msgs::Pose();
             }
             else
             {
-                mrkr.pose.position.x    = _markers[i].pose.position.x;
-                mrkr.pose.position.y    = _markers[i].pose.position.y;
-                mrkr.pose.position.z    = _markers[i].pose.position.z;
-                mrkr.pose.orientation.x = _markers[i].pose.orientation.x;
-                mrkr.pose.orientation.y = _markers[i].pose.orientation.y;
-                mrkr.pose.orientation.z = _markers[i].pose.orientation.z;
-                mrkr.pose.orientation.w = _markers[i].pose.orientation.w;
+                mrkr.points.clear();
+                mrkr.pose = pub_markers[i].pose;
             }
 
             // Custom size of the object
             if (mrkr.type == visualization_msgs::Marker::ARROW)
             {
-                mrkr.scale.x = _markers[i].size;
-                mrkr.scale.y =             0.01;
-                mrkr.scale.z =             0.01;
+                mrkr.scale.x = pub_markers[i].size;
+                mrkr.scale.y =                0.01;
+                mrkr.scale.z =                0.01;
             }
             else
             {
-                mrkr.scale.x = _markers[i].size;
-                mrkr.scale.y = _markers[i].size;
-                mrkr.scale.z = _markers[i].size;
+                mrkr.scale.x = pub_markers[i].size;
+                mrkr.scale.y = pub_markers[i].size;
+                mrkr.scale.z = pub_markers[i].size;
             }
 
-            mrkr.color.a = _markers[i].col.col.a;
-            mrkr.color.r = _markers[i].col.col.r;
-            mrkr.color.g = _markers[i].col.col.g;
-            mrkr.color.b = _markers[i].col.col.b;
+            mrkr.color = pub_markers[i].col.col;
 
-            mrkr.lifetime = ros::Duration(_markers[i].lifetime);
-
-            mrkrs.markers.push_back(mrkr);
+            mrkr.lifetime = ros::Duration(pub_markers[i].lifetime);
         }
-
-        // ROS_INFO("[%s] Publishing", getName().c_str());
-        rviz_pub.publish(mrkrs);
     }
+
+    // ROS_INFO("[%s] Publishing", getName().c_str());
+    rviz_pub.publish(pub_msg);
+    last_pub = now;
 }
 
 bool RVIZPublisher::start()
@@ -169,6 +177,7 @@ bool RVIZPublisher::stop()
     timer.stop();
     std::lock_guard<std::mutex> lg(markers_mutex);
     markers.clear();
+    is_dirty = true;
 
     return true;
 }
@@ -182,7 +191,8 @@ std::vector<RVIZMarker> RVIZPublisher::getMarkers()
 void RVIZPublisher::push_back(RVIZMarker _mrkr)
 {
     std::lock_guard<std::mutex> lg(markers_mutex);
-    markers.push_back(_mrkr);
+    markers.push_back(std::move(_mrkr));
+    is_dirty = true;
 
     // ROS_INFO("[%s] Pushing back. Markers size: %lu",
     //              getName().c_str(), markers.size());
@@ -191,16 +201,24 @@ void RVIZPublisher::push_back(RVIZMarker _mrkr)
 void RVIZPublisher::setMarkers(std::vector<RVIZMarker> _mrkrs)
 {
     std::lock_guard<std::mutex> lg(markers_mutex);
-    markers.clear();
-    markers = _mrkrs;
+
+    // The old markers are swapped out, and freed by _mrkrs outside of the lock
+    markers.swap(_mrkrs);
+    is_dirty = true;
 }
 
-bool RVIZPublisher::setMarker(size_t _idx, RVIZMarker _mrkr)
+bool RVIZPublisher::setMarker(size_t _idx, RVIZMarker _mrkr, bool _resize)
 {
     std::lock_guard<std::mutex> lg(markers_mutex);
-    if (_idx >= markers.size()) { return false; };
+    if (_idx >= markers.size())
+    {
+        if (not _resize)    { return false; }
+
+        markers.resize(_idx + 1);
+    }
 
-    markers[_idx] = _mrkr;
+    markers[_idx] = std::move(_mrkr);
+    is_dirty = true;
 
     return true;
 }
@@ -209,6 +227,7 @@ bool RVIZPublisher::clearMarkers()
 {
     std::lock_guard<std::mutex> lg(markers_mutex);
     markers.clear();
+    is_dirty = true;
 
     return true;
 }
@@ -219,6 +238,7 @@ bool RVIZPublisher::removeMarker(size_t _idx)
     if (_idx >= markers.size()) { return false; };
 
     markers.erase(markers.begin() + int(_idx));
+    is_dirty = true;
 
     return true;
 }
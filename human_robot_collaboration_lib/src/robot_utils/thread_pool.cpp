@@ -0,0 +1,101 @@
+/**
+ * Copyright (C) 2017 Social Robotics Lab, Yale University
+ * Author: Alessandro Roncone
+ * email:  alessandro.roncone@yale.edu
+ * website: www.scazlab.yale.edu
+ * Permission is granted to copy, distribute, and/or modify this program
+ * under the terms of the GNU Lesser General Public License, version 2.1 or any
+ * later version published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details
+**/
+
+#include "robot_utils/thread_pool.h"
+
+ThreadPool::ThreadPool(size_t _num_workers) : job_ctx(nullptr), job_fn(nullptr), num_tasks(0),
+                                              next_task(0), num_busy(0), generation(0),
+                                              is_closing(false)
+{
+    for (size_t i = 0; i < _num_workers; ++i)
+    {
+        workers.push_back(std::thread(&ThreadPool::workerThread, this, i));
+    }
+}
+
+void ThreadPool::workerThread(size_t _worker)
+{
+    unsigned long last_generation = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            cv_start.wait(lck, [&]{ return is_closing || generation != last_generation; });
+
+            if (is_closing)    { return; }
+
+            last_generation = generation;
+        }
+
+        for (size_t t = next_task++; t < num_tasks; t = next_task++)
+        {
+            job_fn(job_ctx, t, _worker);
+        }
+
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+
+            if (--num_busy == 0)    { cv_done.notify_one(); }
+        }
+    }
+}
+
+bool ThreadPool::run(size_t _num_tasks, const void* _ctx, void (*_fn)(const void*, size_t, size_t))
+{
+    if (_num_tasks == 0)    { return true; }
+
+    // Without workers (or with a single task) there is no need to wake anybody up
+    if (workers.empty() || _num_tasks == 1)
+    {
+        for (size_t t = 0; t < _num_tasks; ++t)    { _fn(_ctx, t, 0); }
+
+        return true;
+    }
+
+    std::lock_guard<std::mutex> run_lck(run_mtx);
+
+    std::unique_lock<std::mutex> lck(mtx);
+
+    job_ctx   =              _ctx;
+    job_fn    =               _fn;
+    num_tasks =        _num_tasks;
+    next_task =                 0;
+    num_busy  =    workers.size();
+    ++generation;
+
+    cv_start.notify_all();
+    cv_done.wait(lck, [&]{ return num_busy == 0; });
+
+    job_ctx = nullptr;
+    job_fn  = nullptr;
+
+    return true;
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        is_closing = true;
+    }
+
+    cv_start.notify_all();
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        if (workers[i].joinable())    { workers[i].join(); }
+    }
+}
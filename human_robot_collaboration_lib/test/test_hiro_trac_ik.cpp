@@ -0,0 +1,289 @@
+#include <gtest/gtest.h>
+#include "robot_utils/hiro_trac_ik.h"
+
+using namespace std;
+
+#define EE_NAME    "stp_021808TP00080"
+#define POS_TOL    1e-4   // [m]
+
+/**
+ * Gets a joint configuration in the middle of the joint limits,
+ * with an offset of _d [rad] on every joint
+ */
+KDL::JntArray midConfiguration(hiroTracIK& _ik, double _d = 0.0)
+{
+    KDL::JntArray ll, ul;
+    _ik.getKDLLimits(ll, ul);
+
+    KDL::JntArray q(_ik.getNrOfJoints());
+    for (unsigned int j = 0; j < q.rows(); ++j)    { q(j) = (ll(j) + ul(j)) / 2.0 + _d; }
+
+    return q;
+}
+
+/**
+ * Checks that a joint configuration reaches a pose
+ */
+void expectReached(hiroTracIK& _ik, const KDL::JntArray& _q, const KDL::Frame& _pose)
+{
+    KDL::Frame pose;
+    ASSERT_TRUE(_ik.computeFwdKin(_q, pose));
+
+    EXPECT_LT((pose.p - _pose.p).Norm(), POS_TOL);
+    EXPECT_TRUE(KDL::Equal(pose.M, _pose.M, 1e-3));
+}
+
+TEST(hiroTracIKTest, testWarmStart)
+{
+    hiroTracIK ik("left", EE_NAME);
+
+    EXPECT_FALSE(ik.hasWarmStart());
+
+    KDL::JntArray q0 = midConfiguration(ik);
+    EXPECT_TRUE (ik.setSeed(q0.data));
+    EXPECT_TRUE (ik.hasWarmStart());
+    EXPECT_FALSE(ik.setSeed(Eigen::VectorXd::Zero(q0.rows() + 1)));
+
+    // A pose close to the seed is solved by the local solver, close to the seed
+    KDL::Frame pose;
+    ASSERT_TRUE(ik.computeFwdKin(midConfiguration(ik, 0.02), pose));
+
+    KDL::JntArray q(q0.rows());
+    EXPECT_TRUE(ik.solveIK(pose, q));
+    expectReached(ik, q, pose);
+    EXPECT_LT  ((q.data - q0.data).norm(), 0.2);
+
+    EXPECT_EQ  (1u, ik.getStats().local_sols);
+    EXPECT_EQ  (0u, ik.getStats().tracik_calls);
+
+    // The solution becomes the warm start of the next solve
+    EXPECT_TRUE(ik.hasWarmStart());
+
+    ASSERT_TRUE(ik.computeFwdKin(midConfiguration(ik, 0.04), pose));
+    KDL::JntArray q_next(q0.rows());
+    EXPECT_TRUE(ik.solveIK(pose, q_next));
+    expectReached(ik, q_next, pose);
+    EXPECT_LT  ((q_next.data - q.data).norm(), 0.2);
+
+    ik.resetWarmStart();
+    EXPECT_FALSE(ik.hasWarmStart());
+}
+
+TEST(hiroTracIKTest, testCache)
+{
+    hiroTracIK ik("left", EE_NAME);
+    ik.setSeed(midConfiguration(ik).data);
+
+    size_t n = ik.getCacheSize();
+    ASSERT_GT(n, 1u);
+
+    // n+1 distinct poses, one more than the cache can hold
+    vector<KDL::Frame> poses(n + 1);
+    for (size_t i = 0; i < poses.size(); ++i)
+    {
+        ASSERT_TRUE(ik.computeFwdKin(midConfiguration(ik, 0.01 * i), poses[i]));
+    }
+
+    KDL::JntArray q(ik.getNrOfJoints()), q_cached(ik.getNrOfJoints());
+
+    // The first solve of a pose misses the cache, the following ones hit it
+    EXPECT_TRUE(ik.solveIK(poses[0], q));
+    EXPECT_EQ  (0u, ik.getStats().cache_hits);
+    EXPECT_TRUE(ik.solveIK(poses[0], q_cached));
+    EXPECT_EQ  (1u, ik.getStats().cache_hits);
+    EXPECT_EQ  (q.data, q_cached.data);
+
+    // Fills the cache, then touches poses[0] so that poses[1] is the least recently used
+    for (size_t i = 1; i < n; ++i)    { EXPECT_TRUE(ik.solveIK(poses[i], q)); }
+    EXPECT_EQ  (1u, ik.getStats().cache_hits);
+
+    EXPECT_TRUE(ik.solveIK(poses[0], q));
+    EXPECT_EQ  (2u, ik.getStats().cache_hits);
+
+    // A new pose evicts poses[1], but not poses[0]
+    EXPECT_TRUE(ik.solveIK(poses[n], q));
+    EXPECT_EQ  (2u, ik.getStats().cache_hits);
+
+    EXPECT_TRUE(ik.solveIK(poses[0], q));
+    EXPECT_EQ  (3u, ik.getStats().cache_hits);
+    expectReached(ik, q, poses[0]);
+
+    EXPECT_TRUE(ik.solveIK(poses[1], q));
+    EXPECT_EQ  (3u, ik.getStats().cache_hits);
+
+    // Clearing the cache (or changing the joint limits) empties it
+    ik.clearCache();
+    EXPECT_TRUE(ik.solveIK(poses[0], q));
+    EXPECT_EQ  (3u, ik.getStats().cache_hits);
+
+    KDL::JntArray ll, ul;
+    ik.getKDLLimits(ll, ul);
+    ik.setKDLLimits(ll, ul);
+    EXPECT_TRUE(ik.solveIK(poses[0], q));
+    EXPECT_EQ  (3u, ik.getStats().cache_hits);
+}
+
+TEST(hiroTracIKTest, testTracIKFallback)
+{
+    hiroTracIK ik("left", EE_NAME);
+
+    KDL::JntArray ll, ul;
+    ik.getKDLLimits(ll, ul);
+
+    // An unreachable pose makes the local solver fail, and TRAC_IK is called (and fails)
+    KDL::JntArray q(ik.getNrOfJoints());
+    IKStats stats = ik.getStats();
+
+    EXPECT_FALSE(ik.solveIK(KDL::Frame(KDL::Vector(5.0, 5.0, 5.0)), q));
+    EXPECT_EQ   (stats.tracik_calls + 1, ik.getStats().tracik_calls);
+    EXPECT_EQ   (stats.tracik_sols,      ik.getStats().tracik_sols);
+    EXPECT_FALSE(ik.hasWarmStart());
+
+    // Poses far from the warm start are solved as well, some of them by TRAC_IK
+    int num_poses = 20, num_sols = 0;
+
+    srand(1);
+    for (int i = 0; i < num_poses; ++i)
+    {
+        KDL::JntArray q_seed(ik.getNrOfJoints()), q_goal(ik.getNrOfJoints());
+
+        for (unsigned int j = 0; j < q.rows(); ++j)
+        {
+            // The seed is close to one limit, the goal close to the other one
+            double r = 0.1 + 0.2 * double(rand()) / RAND_MAX;
+            q_seed(j) = ll(j) + r * (ul(j) - ll(j));
+            q_goal(j) = ul(j) - r * (ul(j) - ll(j));
+        }
+
+        KDL::Frame pose;
+        ASSERT_TRUE(ik.computeFwdKin(q_goal, pose));
+        ik.setSeed(q_seed.data);
+
+        if (ik.solveIK(pose, q))
+        {
+            expectReached(ik, q, pose);
+            ++num_sols;
+        }
+    }
+
+    // TRAC_IK runs with a timeout, hence a few poses may not be solved
+    EXPECT_GE(num_sols, num_poses * 9 / 10);
+    EXPECT_GT(ik.getStats().tracik_sols, stats.tracik_sols);
+}
+
+TEST(hiroTracIKTest, testSolveIKBatch)
+{
+    hiroTracIK ik("left", EE_NAME);
+
+    KDL::JntArray seed = midConfiguration(ik);
+
+    // Poses at different distances from the seed, with an unreachable one in the middle
+    vector<double> offsets = {0.3, 0.05, -1.0, 0.15};
+    vector<KDL::Frame> poses(offsets.size(), KDL::Frame(KDL::Vector(5.0, 5.0, 5.0)));
+
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+        if (offsets[i] >= 0.0)
+        {
+            ASSERT_TRUE(ik.computeFwdKin(midConfiguration(ik, offsets[i]), poses[i]));
+        }
+    }
+
+    vector<IKResult> res;
+    EXPECT_TRUE(ik.solveIKBatch(poses, seed, res));
+    ASSERT_EQ  (poses.size(), res.size());
+
+    // Successful solutions first, ranked by distance from the seed
+    for (size_t i = 0; i < res.size(); ++i)
+    {
+        EXPECT_EQ(i < 3, res[i].success);
+
+        if (res[i].success)
+        {
+            expectReached(ik, res[i].jnts, poses[res[i].idx]);
+            EXPECT_NEAR(res[i].dist, (res[i].jnts.data - seed.data).norm(), 1e-9);
+        }
+
+        if (i > 0 && res[i].success)    { EXPECT_LE(res[i-1].dist, res[i].dist); }
+    }
+
+    EXPECT_EQ(2u, res[3].idx);
+
+    // Every pose has its own result
+    vector<bool> seen(poses.size(), false);
+    for (size_t i = 0; i < res.size(); ++i)    { seen[res[i].idx] = true; }
+    EXPECT_EQ(vector<bool>(poses.size(), true), seen);
+
+    // The batch does not touch the warm start nor the cache of solveIK()
+    EXPECT_FALSE(ik.hasWarmStart());
+    KDL::JntArray q(ik.getNrOfJoints());
+    EXPECT_TRUE (ik.solveIK(poses[1], q));
+    EXPECT_EQ   (0u, ik.getStats().cache_hits);
+
+    // Nothing to solve, or a seed of the wrong size
+    EXPECT_FALSE(ik.solveIKBatch(vector<KDL::Frame>(), seed, res));
+    EXPECT_TRUE (res.empty());
+    EXPECT_FALSE(ik.solveIKBatch(poses, KDL::JntArray(seed.rows() + 1), res));
+}
+
+TEST(hiroTracIKTest, testPerformIK)
+{
+    hiroTracIK ik("left", EE_NAME);
+
+    // Three poses, the second of which is unreachable
+    vector<KDL::JntArray> goals = {midConfiguration(ik, 0.1), midConfiguration(ik),
+                                   midConfiguration(ik, -0.1)};
+
+    intera_core_msgs::SolvePositionIK ik_srv;
+
+    for (size_t i = 0; i < goals.size(); ++i)
+    {
+        KDL::Frame pose(KDL::Vector(5.0, 5.0, 5.0));
+        if (i != 1)    { ASSERT_TRUE(ik.computeFwdKin(goals[i], pose)); }
+
+        geometry_msgs::PoseStamped ps;
+        pose.M.GetQuaternion(ps.pose.orientation.x, ps.pose.orientation.y,
+                             ps.pose.orientation.z, ps.pose.orientation.w);
+        ps.pose.position.x = pose.p.x();
+        ps.pose.position.y = pose.p.y();
+        ps.pose.position.z = pose.p.z();
+
+        ik_srv.request.pose_stamp.push_back(ps);
+    }
+
+    // Only the first pose has its own seed (i.e. the goal itself)
+    sensor_msgs::JointState seed;
+    seed.name.resize(goals[0].rows());
+    for (unsigned int j = 0; j < goals[0].rows(); ++j)    { seed.position.push_back(goals[0](j)); }
+    ik_srv.request.seed_angles.push_back(seed);
+
+    EXPECT_TRUE(ik.perform_ik(ik_srv));
+
+    // One solution per pose, in the same order as the request
+    ASSERT_EQ(goals.size(), ik_srv.response.joints.size());
+    ASSERT_EQ(goals.size(), ik_srv.response.result_type.size());
+
+    EXPECT_TRUE (ik_srv.response.result_type[0]);
+    EXPECT_FALSE(ik_srv.response.result_type[1]);
+    EXPECT_TRUE (ik_srv.response.result_type[2]);
+
+    for (size_t i = 0; i < goals.size(); i += 2)
+    {
+        KDL::JntArray q = ik.JointState2JntArray(ik_srv.response.joints[i]);
+        EXPECT_EQ(ik.getNrOfJoints(), ik_srv.response.joints[i].name.size());
+
+        KDL::Frame pose;
+        ASSERT_TRUE(ik.computeFwdKin(goals[i], pose));
+        expectReached(ik, q, pose);
+    }
+
+    // Seeded with the goal, the first solution is the goal itself
+    EXPECT_LT((ik.JointState2JntArray(ik_srv.response.joints[0]).data - goals[0].data).norm(), 1e-3);
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "hiro_trac_ik_test");
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
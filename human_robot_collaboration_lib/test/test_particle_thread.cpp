@@ -1,9 +1,164 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+
 #include "robot_utils/particle_thread.h"
 
 using namespace std;
 
+/**
+ * Allocation counter. The C allocation functions are interposed, so that every
+ * allocation is counted whatever its entry point (operator new and new[] end up in
+ * malloc, Eigen uses malloc and realloc directly), but only in the thread that
+ * explicitly enabled the counting. This way, allocations performed by other
+ * threads (e.g. the ROS ones) do not interfere with the benchmark. The actual
+ * functions are looked up with dlsym(RTLD_NEXT), instead of relying on the
+ * internals of a specific C library.
+ */
+thread_local bool count_allocs = false;
+thread_local size_t  num_allocs =     0;
+
+namespace
+{
+typedef void* (*MallocFn)       (size_t);
+typedef void* (*CallocFn)       (size_t, size_t);
+typedef void* (*ReallocFn)      (void*, size_t);
+typedef void  (*FreeFn)         (void*);
+typedef int   (*PosixMemalignFn)(void**, size_t, size_t);
+typedef void* (*AlignedAllocFn) (size_t, size_t);
+
+MallocFn               real_malloc = nullptr;
+CallocFn               real_calloc = nullptr;
+ReallocFn             real_realloc = nullptr;
+FreeFn                   real_free = nullptr;
+PosixMemalignFn real_posix_memalign = nullptr;
+AlignedAllocFn   real_aligned_alloc = nullptr;
+
+// dlsym may allocate while the actual functions are being looked up: those
+// allocations are served by a small static buffer, and they are never released
+alignas(16) char boot_buf[4096];
+size_t           boot_used =     0;
+bool             resolving = false;
+
+void* bootAlloc(size_t _size)
+{
+    size_t size = (_size + 15) & ~size_t(15);
+
+    if (boot_used + size > sizeof(boot_buf))    { return nullptr; }
+
+    void *p = boot_buf + boot_used;
+    boot_used += size;
+
+    return p;
+}
+
+bool isBoot(void* _p)
+{
+    return static_cast<char*>(_p) >= boot_buf && static_cast<char*>(_p) < boot_buf + sizeof(boot_buf);
+}
+
+/**
+ * Looks up the actual allocation functions. It is called by the first
+ * allocation of the program, i.e. before any other thread is started.
+ */
+void resolve()
+{
+    resolving = true;
+
+    real_malloc         = reinterpret_cast<MallocFn>       (dlsym(RTLD_NEXT, "malloc"));
+    real_calloc         = reinterpret_cast<CallocFn>       (dlsym(RTLD_NEXT, "calloc"));
+    real_realloc        = reinterpret_cast<ReallocFn>      (dlsym(RTLD_NEXT, "realloc"));
+    real_free           = reinterpret_cast<FreeFn>         (dlsym(RTLD_NEXT, "free"));
+    real_posix_memalign = reinterpret_cast<PosixMemalignFn>(dlsym(RTLD_NEXT, "posix_memalign"));
+    real_aligned_alloc  = reinterpret_cast<AlignedAllocFn> (dlsym(RTLD_NEXT, "aligned_alloc"));
+
+    resolving = false;
+}
+
+bool isResolved()
+{
+    if (real_free)    { return true; }
+    if (resolving)    { return false; }
+
+    resolve();
+    return true;
+}
+}
+
+extern "C" void *malloc(size_t _size) noexcept
+{
+    if (not isResolved())    { return bootAlloc(_size); }
+    if (count_allocs)        { ++num_allocs; }
+
+    return real_malloc(_size);
+}
+
+extern "C" void *calloc(size_t _num, size_t _size) noexcept
+{
+    // The static buffer is zero-initialized, and never reused
+    if (not isResolved())    { return bootAlloc(_num * _size); }
+    if (count_allocs)        { ++num_allocs; }
+
+    return real_calloc(_num, _size);
+}
+
+extern "C" void *realloc(void* _p, size_t _size) noexcept
+{
+    if (not isResolved())    { return bootAlloc(_size); }
+    if (count_allocs)        { ++num_allocs; }
+
+    if (isBoot(_p))
+    {
+        void *p = real_malloc(_size);
+        if (p)    { memcpy(p, _p, std::min(_size, size_t(boot_buf + sizeof(boot_buf) - static_cast<char*>(_p)))); }
+        return p;
+    }
+
+    return real_realloc(_p, _size);
+}
+
+extern "C" void free(void* _p) noexcept
+{
+    if (_p == nullptr || isBoot(_p))    { return; }
+    if (isResolved())                   { real_free(_p); }
+}
+
+extern "C" int posix_memalign(void** _p, size_t _align, size_t _size) noexcept
+{
+    if (not isResolved())    { return ENOMEM; }
+    if (count_allocs)        { ++num_allocs; }
+
+    return real_posix_memalign(_p, _align, _size);
+}
+
+extern "C" void *aligned_alloc(size_t _align, size_t _size) noexcept
+{
+    if (not isResolved())    { return nullptr; }
+    if (count_allocs)        { ++num_allocs; }
+
+    return real_aligned_alloc(_align, _size);
+}
+
+/**
+ * Exposes the cycle of the particle thread, so that it can be benchmarked
+ * synchronously (without spinning the thread).
+ */
+class LinearPointParticleTester : public LinearPointParticle
+{
+public:
+    using LinearPointParticle::cycle;
+};
+
+class CircularPointParticleTester : public CircularPointParticle
+{
+public:
+    using CircularPointParticle::cycle;
+};
+
 TEST(ParticleThreadTest, testConstructor)
 {
     ros::Time::init();
@@ -81,6 +236,107 @@ TEST(ParticleThreadTest, testCircularPoint)
     EXPECT_TRUE (cpp.stop());
 }
 
+TEST(ParticleThreadTest, testInlineEvaluation)
+{
+    ros::Time::init();
+
+    LinearPointParticle lpp;
+    LinearPointParticle::Point pt;
+
+    EXPECT_FALSE(lpp.evaluate(0.0, pt));
+    EXPECT_TRUE (lpp.setupParticle(Eigen::Vector3d(0.0, 0.0, 0.0),
+                                   Eigen::Vector3d(0.0, 0.0, 0.1), 0.2));
+
+    // The particle is a function of time, and the thread is never started
+    EXPECT_TRUE (lpp.evaluate(0.25, pt));
+    EXPECT_TRUE (pt.isApprox(Eigen::Vector3d(0.0, 0.0, 0.05)));
+    EXPECT_TRUE (lpp.evaluate(1.0, pt));
+    EXPECT_EQ   (pt, Eigen::Vector3d(0.0, 0.0, 0.1));
+    EXPECT_FALSE(lpp.isRunning());
+
+    // The same particle can be reused for a new target
+    EXPECT_TRUE (lpp.setupParticle(Eigen::Vector3d(0.0, 0.0, 0.1),
+                                   Eigen::Vector3d(0.2, 0.0, 0.1), 0.2));
+    EXPECT_TRUE (lpp.evaluate(0.5, pt));
+    EXPECT_TRUE (pt.isApprox(Eigen::Vector3d(0.1, 0.0, 0.1)));
+    EXPECT_TRUE (lpp.evaluate(2.0, pt));
+    EXPECT_EQ   (pt, Eigen::Vector3d(0.2, 0.0, 0.1));
+}
+
+TEST(ParticleThreadTest, benchmarkAllocations)
+{
+    ros::Time::init();
+
+    const int num_cycles = 100000;
+
+    LinearPointParticleTester lpp;
+    EXPECT_TRUE (lpp.setupParticle(Eigen::Vector3d(0.0, 0.0, 0.0),
+                                   Eigen::Vector3d(0.0, 0.0, 0.1), 0.2));
+
+    CircularPointParticleTester cpp;
+    EXPECT_TRUE (cpp.setupParticle(Eigen::Vector3d(0.0, 0.0, 0.0),
+                                   Eigen::Vector2d(0.0, 0.0), 0.2, 1.0*M_PI));
+
+    Eigen::Vector3d pt(0.0, 0.0, 0.0);
+
+    // The counter sees every entry point (the pointers are volatile,
+    // so that the compiler cannot elide the allocations)
+    num_allocs   =    0;
+    count_allocs = true;
+
+    void *volatile p = malloc(16);
+    p = realloc(p, 32);
+    free(p);
+    p = calloc(4, 8);
+    free(p);
+    int  *volatile q = new int(0);
+    delete q;
+    q = new int[4];
+    delete[] q;
+    Eigen::VectorXd *volatile v = new Eigen::VectorXd(16);
+    delete v;
+
+    count_allocs = false;
+    EXPECT_EQ(num_allocs, 7u);
+
+    num_allocs   =    0;
+    count_allocs = true;
+
+    ros::WallTime start = ros::WallTime::now();
+
+    // A cycle of the particle thread, plus a read from the control thread
+    for (int i = 0; i < num_cycles; ++i)
+    {
+        lpp.cycle();
+        pt += lpp.getCurrPoint();
+    }
+
+    double lpp_time = (ros::WallTime::now() - start).toSec();
+    size_t lpp_allocs = num_allocs;
+
+    start = ros::WallTime::now();
+
+    for (int i = 0; i < num_cycles; ++i)
+    {
+        cpp.cycle();
+        pt += cpp.getCurrPoint();
+    }
+
+    double cpp_time = (ros::WallTime::now() - start).toSec();
+
+    count_allocs = false;
+    size_t cpp_allocs = num_allocs - lpp_allocs;
+
+    EXPECT_EQ(lpp_allocs, 0u);
+    EXPECT_EQ(cpp_allocs, 0u);
+    EXPECT_TRUE(pt.allFinite());
+
+    printf("[ ParticleThreadTest ] LinearPointParticle:   %g [us/cycle], %zu allocations\n",
+                                               lpp_time * 1e6 / num_cycles, lpp_allocs);
+    printf("[ ParticleThreadTest ] CircularPointParticle: %g [us/cycle], %zu allocations\n",
+                                               cpp_time * 1e6 / num_cycles, cpp_allocs);
+}
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv)
 {
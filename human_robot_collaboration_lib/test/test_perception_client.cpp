@@ -0,0 +1,191 @@
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+#include "robot_perception/perception_client_impl.h"
+
+using namespace std;
+
+/**
+ * Exposes the protected interface of the perception client, and
+ * feeds it with messages without the need of a perception node
+ */
+class PerceptionClientTester : public PerceptionClientImpl
+{
+public:
+    explicit PerceptionClientTester(string _limb = "left") :
+                                    PerceptionClientImpl("test", _limb) { };
+
+    using PerceptionClientImpl::getObjectPos;
+    using PerceptionClientImpl::setObjectID;
+    using PerceptionClientImpl::getAvailableObjects;
+    using PerceptionClientImpl::getVisibleObjects;
+    using PerceptionClientImpl::getObservation;
+    using PerceptionClientImpl::isObjectSeen;
+    using PerceptionClientImpl::setPerceptionTimeout;
+    using PerceptionClientImpl::waitForOK;
+    using PerceptionClientImpl::waitForObjFound;
+    using PerceptionClientImpl::waitForData;
+
+    /**
+     * Sends a message with a set of markers, all of them at the same position
+     *
+     * @param _ids   the ids of the markers
+     * @param _x     the x coordinate of their position
+     * @param _stamp the time of the message
+     */
+    void sendMarkers(const vector<int>& _ids, double _x, const ros::Time& _stamp)
+    {
+        aruco_msgs::MarkerArray msg;
+        msg.header.stamp = _stamp;
+
+        for (size_t i = 0; i < _ids.size(); ++i)
+        {
+            aruco_msgs::Marker marker;
+            marker.id                      = _ids[i];
+            marker.confidence              =     1.0;
+            marker.pose.pose.position.x    =      _x;
+            marker.pose.pose.orientation.w =     1.0;
+
+            msg.markers.push_back(marker);
+        }
+
+        ObjectCb(msg);
+    }
+};
+
+TEST(PerceptionClientTest, testObservations)
+{
+    PerceptionClientTester pc;
+    pc.setObjectID(1);
+
+    ros::Time t1 = ros::Time::now();
+    ros::Time t0 = t1 - ros::Duration(0.5);
+    ros::Time t2 = t1 + ros::Duration(0.5);
+
+    ObjectObservation obs;
+    vector<int> objs;
+
+    // Nothing has been seen yet
+    EXPECT_FALSE(pc.getObservation(1, obs));
+    EXPECT_FALSE(pc.isObjectSeen(1, 10.0));
+    pc.getVisibleObjects(objs);
+    EXPECT_TRUE (objs.empty());
+
+    pc.sendMarkers({1, 2}, 0.1, t1);
+
+    EXPECT_TRUE (pc.getObservation(1, obs));
+    EXPECT_EQ   (t1,  obs.stamp);
+    EXPECT_EQ   (0.1, obs.pose.position.x);
+    EXPECT_EQ   (1.0, obs.confidence);
+    EXPECT_FALSE(pc.getObservation(3, obs));
+
+    pc.getVisibleObjects(objs);
+    EXPECT_EQ   (vector<int>({1, 2}), objs);
+    EXPECT_EQ   (vector<int>({2}),    pc.getAvailableObjects(vector<int>({2, 3})));
+    EXPECT_EQ   (0.1, pc.getObjectPos().x);
+
+    // A late message does not regress the latest observations, nor the visible objects
+    pc.sendMarkers({1, 3}, 0.2, t0);
+
+    EXPECT_TRUE (pc.getObservation(1, obs));
+    EXPECT_EQ   (t1,  obs.stamp);
+    EXPECT_EQ   (0.1, obs.pose.position.x);
+    EXPECT_EQ   (0.1, pc.getObjectPos().x);
+
+    // Objects that were never seen before are recorded, but they are not visible
+    EXPECT_TRUE (pc.getObservation(3, obs));
+    EXPECT_EQ   (t0,  obs.stamp);
+
+    pc.getVisibleObjects(objs);
+    EXPECT_EQ   (vector<int>({1, 2}), objs);
+
+    // A newer message replaces the visible objects, but not the observations of the others
+    pc.sendMarkers({2}, 0.3, t2);
+
+    pc.getVisibleObjects(objs);
+    EXPECT_EQ   (vector<int>({2}), objs);
+    EXPECT_TRUE (pc.getAvailableObjects(vector<int>({1})).empty());
+
+    EXPECT_TRUE (pc.getObservation(1, obs));
+    EXPECT_EQ   (t1,  obs.stamp);
+    EXPECT_TRUE (pc.getObservation(2, obs));
+    EXPECT_EQ   (t2,  obs.stamp);
+    EXPECT_EQ   (0.3, obs.pose.position.x);
+
+    // Objects are seen if their latest observation is within the time window
+    pc.sendMarkers({4}, 0.4, ros::Time::now() - ros::Duration(5.0));
+
+    EXPECT_TRUE (pc.isObjectSeen(1, 2.0));
+    EXPECT_FALSE(pc.isObjectSeen(4, 2.0));
+    EXPECT_TRUE (pc.isObjectSeen(4, 10.0));
+    EXPECT_FALSE(pc.isObjectSeen(5, 10.0));
+}
+
+TEST(PerceptionClientTest, testWaitForData)
+{
+    PerceptionClientTester pc;
+    pc.setObjectID(1);
+    pc.setPerceptionTimeout(2.0);
+
+    // Messages are sent periodically by another thread, so that
+    // the flags are set in the middle of the waits
+    std::atomic<bool> sending(true);
+    std::thread sender([&]()
+    {
+        while (sending)
+        {
+            pc.sendMarkers({1, 2}, 0.1, ros::Time::now());
+            ros::WallDuration(0.02).sleep();
+        }
+    });
+
+    // The waits return as soon as the data arrives, well before the timeout
+    ros::WallTime start = ros::WallTime::now();
+    EXPECT_TRUE(pc.waitForData());
+    EXPECT_TRUE(pc.waitForOK());
+    EXPECT_TRUE(pc.waitForObjFound());
+    EXPECT_LT  ((ros::WallTime::now() - start).toSec(), 0.5);
+
+    sending = false;
+    sender.join();
+}
+
+TEST(PerceptionClientTest, testWaitTimeout)
+{
+    PerceptionClientTester pc;
+    pc.setObjectID(1);
+    pc.setPerceptionTimeout(0.3);
+
+    // Without messages, the waits time out
+    ros::WallTime start = ros::WallTime::now();
+    EXPECT_FALSE(pc.waitForOK());
+    EXPECT_GE   ((ros::WallTime::now() - start).toSec(), 0.3);
+    EXPECT_LT   ((ros::WallTime::now() - start).toSec(), 1.0);
+
+    // The same happens if the messages do not carry the selected object
+    std::atomic<bool> sending(true);
+    std::thread sender([&]()
+    {
+        while (sending)
+        {
+            pc.sendMarkers({2}, 0.1, ros::Time::now());
+            ros::WallDuration(0.02).sleep();
+        }
+    });
+
+    start = ros::WallTime::now();
+    EXPECT_FALSE(pc.waitForData());
+    EXPECT_GE   ((ros::WallTime::now() - start).toSec(), 0.3);
+    EXPECT_LT   ((ros::WallTime::now() - start).toSec(), 1.0);
+
+    sending = false;
+    sender.join();
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "perception_client_test");
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
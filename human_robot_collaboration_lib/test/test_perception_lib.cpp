@@ -0,0 +1,1120 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <ros/ros.h>
+
+#include "robot_perception/cartesian_estimator_hsv.h"
+#include "robot_perception/object_tracker.h"
+
+using namespace std;
+
+#define IMG_W       640
+#define IMG_H       400
+#define OBJ_W        60
+#define OBJ_H        40
+
+#define SMALL_MAT_SIZE  1024    // [bytes] Bigger cv::Mat buffers are images (see testNoAllocations)
+
+// Heap allocations done through operator new while they are being counted (see testNoAllocations)
+static std::atomic<bool>   count_allocs(false);
+static std::atomic<size_t>   num_allocs(0);
+
+// Buffers of cv::Mat allocated while they are being counted (see testNoAllocations).
+// They do not go through operator new, but through the allocator of OpenCV.
+static std::atomic<size_t>   num_mat_allocs(0);
+static std::atomic<size_t>   num_img_allocs(0);   // The ones bigger than SMALL_MAT_SIZE
+
+void* operator new(size_t _size)
+{
+    if (count_allocs)    { ++num_allocs; }
+
+    void *p = malloc(_size == 0? 1 : _size);
+
+    if (not p)    { throw std::bad_alloc(); }
+
+    return p;
+}
+
+void operator delete(void* _p) noexcept
+{
+    free(_p);
+}
+
+/**
+ * Allocator of cv::Mat that counts the buffers it allocates, and leaves the
+ * rest to the standard allocator of OpenCV (which also releases the buffers)
+ */
+class CountingMatAllocator : public cv::MatAllocator
+{
+public:
+    cv::UMatData* allocate(int _dims, const int* _sizes, int _type, void* _data,
+                           size_t* _step, int _flags, cv::UMatUsageFlags _usage) const
+    {
+        if (count_allocs && not _data)
+        {
+            size_t total = CV_ELEM_SIZE(_type);
+            for (int i = 0; i < _dims; ++i)    { total *= _sizes[i]; }
+
+            ++num_mat_allocs;
+            if (total > SMALL_MAT_SIZE)    { ++num_img_allocs; }
+        }
+
+        return cv::Mat::getStdAllocator()->allocate(_dims, _sizes, _type, _data,
+                                                    _step, _flags, _usage);
+    }
+
+    bool allocate(cv::UMatData* _u, int _access, cv::UMatUsageFlags _usage) const
+    {
+        return cv::Mat::getStdAllocator()->allocate(_u, _access, _usage);
+    }
+
+    void deallocate(cv::UMatData* _u) const
+    {
+        cv::Mat::getStdAllocator()->deallocate(_u);
+    }
+};
+
+/**
+ * Creates a synthetic image with _num_objs rectangles of different hues,
+ * and the corresponding HSV objects to detect them.
+ */
+void createScene(size_t _num_objs, cv::Mat& _img, vector<SegmentedObj*>& _objs)
+{
+    _img.create(IMG_H, IMG_W, CV_8UC3);
+    _img.setTo(cv::Scalar::all(0));
+
+    for (size_t i = 0; i < _num_objs; ++i)
+    {
+        int hue = 5 + int(i) * 170 / int(_num_objs);
+
+        cv::Mat hsv(1, 1, CV_8UC3, cv::Scalar(hue, 255, 255)), bgr;
+        cv::cvtColor(hsv, bgr, CV_HSV2BGR);
+        cv::Vec3b col = bgr.at<cv::Vec3b>(0, 0);
+
+        int x = 20 + int(i % 6) * 100;
+        int y = 20 + int(i / 6) * 100;
+
+        cv::rectangle(_img, cv::Rect(x, y, OBJ_W, OBJ_H),
+                      cv::Scalar(col[0], col[1], col[2]), CV_FILLED);
+
+        vector<double> size = {0.06, 0.04};
+        _objs.push_back(new SegmentedObjHSV("obj_" + toString(int(i)), int(i), size, AREA_THRES,
+                        hsvColorRange(colorRange(max(hue - 3, 0), min(hue + 3, 180)),
+                                      colorRange(200, 256), colorRange(200, 256))));
+    }
+}
+
+void clearScene(vector<SegmentedObj*>& _objs)
+{
+    for (size_t i = 0; i < _objs.size(); ++i)    { delete _objs[i]; }
+    _objs.clear();
+}
+
+TEST(PerceptionLibTest, testBlobExtractor)
+{
+    cv::Mat mask(IMG_H, IMG_W, CV_8UC1, cv::Scalar::all(0));
+
+    // Two objects, one of them with a hole, an isolated pixel, and two diagonal pixels
+    cv::rectangle(mask, cv::Rect( 20,  20, OBJ_W, OBJ_H), cv::Scalar::all(255), CV_FILLED);
+    cv::rectangle(mask, cv::Rect(200, 100, OBJ_W, OBJ_H), cv::Scalar::all(255), CV_FILLED);
+    cv::rectangle(mask, cv::Rect(210, 110,    10,    10), cv::Scalar::all(0),   CV_FILLED);
+    mask.at<uchar>(300, 300) = 255;
+    mask.at<uchar>(350, 350) = 255;
+    mask.at<uchar>(351, 351) = 255;
+
+    BlobExtractor blobs;
+    blobs.extract(mask);
+
+    const vector<Blob>& bl = blobs.getBlobs();
+
+    ASSERT_EQ(bl.size(), size_t(4));
+    EXPECT_EQ(bl[0].area, OBJ_W * OBJ_H);
+    EXPECT_EQ(bl[0].bbox, cv::Rect(20, 20, OBJ_W, OBJ_H));
+    EXPECT_EQ(bl[1].area, OBJ_W * OBJ_H - 100);
+    EXPECT_EQ(bl[1].bbox, cv::Rect(200, 100, OBJ_W, OBJ_H));
+    EXPECT_EQ(bl[2].area, 1);
+    EXPECT_EQ(bl[3].area, 2);   // 8-connectivity
+
+    EXPECT_EQ(blobs.countBlobs(AREA_THRES), size_t(2));
+
+    // Only the big blobs are drawn
+    cv::Mat out(IMG_H, IMG_W, CV_8UC1, cv::Scalar::all(0));
+    blobs.draw(AREA_THRES, out);
+    EXPECT_EQ(cv::countNonZero(out), 2 * OBJ_W * OBJ_H - 100);
+    EXPECT_EQ(out.at<uchar>(300, 300), 0);
+
+    // The rectangle around the hull points is the same as around the whole blob
+    cv::Mat single(IMG_H, IMG_W, CV_8UC1, cv::Scalar::all(0));
+    cv::rectangle(single, cv::Rect(200, 100, OBJ_W, OBJ_H), cv::Scalar::all(255), CV_FILLED);
+    blobs.extract(single);
+
+    vector<cv::Point> pts;
+    cv::findNonZero(single, pts);
+
+    cv::RotatedRect rect_hull = cv::minAreaRect(blobs.getHullPoints(AREA_THRES, cv::Point(5, 5)));
+    cv::RotatedRect rect_all  = cv::minAreaRect(pts);
+
+    EXPECT_NEAR(rect_hull.center.x,   rect_all.center.x + 5, 1e-3);
+    EXPECT_NEAR(rect_hull.center.y,   rect_all.center.y + 5, 1e-3);
+    EXPECT_NEAR(rect_hull.size.area(), rect_all.size.area(), 1e-3);
+
+    // Labeled images give the same blobs as masks, without extracting the mask first
+    cv::Mat labels(IMG_H, IMG_W, CV_32SC1, cv::Scalar::all(1));
+    labels.setTo(cv::Scalar::all(1 | (1 << 3)), mask);
+
+    blobs.extract(labels, 3);
+    EXPECT_EQ(blobs.getBlobs().size(), size_t(4));
+    EXPECT_EQ(blobs.countBlobs(AREA_THRES), size_t(2));
+
+    blobs.extract(labels, 0);
+    EXPECT_EQ(blobs.getBlobs().size(), size_t(1));
+}
+
+TEST(PerceptionLibTest, testDetectObjectsParallel)
+{
+    cv::Mat img, out_s, out_p;
+    vector<SegmentedObj*> objs_s, objs_p;
+
+    createScene(8, img, objs_s);
+    createScene(8, img, objs_p);
+
+    ThreadPool serial(0), parallel(4);
+    vector<cv::Mat> thres_s, thres_p;
+    vector<ScratchArena> arenas_s, arenas_p;
+
+    cv::Mat out_thres_s(img.rows, img.cols, CV_8UC1, cv::Scalar::all(0));
+    cv::Mat out_thres_p(img.rows, img.cols, CV_8UC1, cv::Scalar::all(0));
+
+    EXPECT_TRUE(detectObjectsParallel(objs_s, serial,   img, out_s, out_thres_s, thres_s, arenas_s));
+    EXPECT_TRUE(detectObjectsParallel(objs_p, parallel, img, out_p, out_thres_p, thres_p, arenas_p));
+
+    EXPECT_EQ(thres_s.size(), 1u);
+    EXPECT_EQ(thres_p.size(), 4u);
+
+    for (size_t i = 0; i < objs_s.size(); ++i)
+    {
+        EXPECT_TRUE(objs_s[i]->isThere());
+        EXPECT_TRUE(objs_p[i]->isThere());
+        EXPECT_EQ  (objs_s[i]->rect.center, objs_p[i]->rect.center);
+        EXPECT_EQ  (objs_s[i]->rect.size,   objs_p[i]->rect.size);
+    }
+
+    // The merged thresholded images should not depend on the number of workers
+    EXPECT_EQ(cv::countNonZero(out_thres_s != out_thres_p), 0);
+    EXPECT_EQ(cv::countNonZero(out_thres_s), 8 * OBJ_W * OBJ_H);
+
+    clearScene(objs_s);
+    clearScene(objs_p);
+}
+
+/**
+ * Creates a random color range, with H.min > H.max (i.e. the red) about half of the times
+ */
+hsvColorRange randomColorRange(cv::RNG& _rng)
+{
+    int s_min = _rng.uniform(0, 256), v_min = _rng.uniform(0, 256);
+
+    return hsvColorRange(colorRange(_rng.uniform(0, 181),   _rng.uniform(0, 181)),
+                         colorRange(s_min, _rng.uniform(s_min, 257)),
+                         colorRange(v_min, _rng.uniform(v_min, 257)));
+}
+
+TEST(PerceptionLibTest, testHSVLabeler)
+{
+    cv::RNG rng(2);
+
+    cv::Mat hsv(IMG_H, IMG_W, CV_8UC3);
+    rng.fill(hsv, cv::RNG::UNIFORM, 0, 256);
+
+    // The red, the whole color space, a single color, and then random ranges
+    vector<hsvColorRange> ranges = {
+        hsvColorRange(colorRange(160,  10), colorRange( 40, 196), colorRange(50, 196)),
+        hsvColorRange(colorRange(  0, 180), colorRange(  0, 256), colorRange( 0, 256)),
+        hsvColorRange(colorRange( 20,  20), colorRange(100, 100), colorRange(90,  90))};
+
+    while (ranges.size() < size_t(HSV_MAX_LABELS))    { ranges.push_back(randomColorRange(rng)); }
+
+    hsvLabeler labeler;
+    EXPECT_TRUE(labeler.setColorRanges(ranges));
+    EXPECT_EQ  (labeler.getNumRanges(), ranges.size());
+
+    cv::Mat labels, mask;
+    labeler.label(hsv, labels);
+
+    EXPECT_EQ(labels.size(), hsv.size());
+    EXPECT_EQ(labels.type(),   CV_32SC1);
+
+    // Every bit of the labels is the same as thresholding the image on its own
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        hsvLabeler::extract(labels, int(i), mask);
+
+        EXPECT_EQ(cv::countNonZero(mask != hsvThreshold(hsv, ranges[i])), 0) << "Range " << i;
+    }
+
+    EXPECT_GT(cv::countNonZero(hsvThreshold(hsv, ranges[0])), 0);
+
+    // Views of a bigger image (i.e. ROIs) are labeled in the same way
+    cv::Rect roi(13, 7, 101, 57);
+    cv::Mat labels_roi;
+    labeler.label(hsv(roi), labels_roi);
+    EXPECT_EQ(cv::countNonZero(labels_roi != labels(roi)), 0);
+
+    // Too many color ranges are rejected, and the previous ones are kept
+    ranges.push_back(hsvColorRange());
+    EXPECT_FALSE(labeler.setColorRanges(ranges));
+    EXPECT_EQ   (labeler.getNumRanges(), size_t(HSV_MAX_LABELS));
+}
+
+TEST(PerceptionLibTest, testHSVLabelerBGR)
+{
+    cv::RNG rng(4);
+
+    // Every color of the BGR cube once, followed by random colors
+    cv::Mat bgr(4096 + 256, 4096, CV_8UC3);
+
+    for (int i = 0; i < 4096 * 4096; ++i)
+    {
+        bgr.at<cv::Vec3b>(i / 4096, i % 4096) = cv::Vec3b(i >> 16, (i >> 8) & 255, i & 255);
+    }
+
+    cv::Mat bgr_rand = bgr(cv::Rect(0, 4096, 4096, 256));
+    rng.fill(bgr_rand, cv::RNG::UNIFORM, 0, 256);
+
+    // Enough color ranges for all the BGR lookup tables
+    vector<hsvColorRange> ranges = {
+        hsvColorRange(colorRange(160,  10), colorRange( 40, 196), colorRange(50, 196)),
+        hsvColorRange(colorRange(  0, 180), colorRange(  0, 256), colorRange( 0, 256))};
+
+    while (ranges.size() < size_t(HSV_MAX_LABELS))    { ranges.push_back(randomColorRange(rng)); }
+
+    // The BGR lookup table is built only on request
+    hsvLabeler labeler;
+    EXPECT_TRUE (labeler.setColorRanges(ranges));
+    EXPECT_FALSE(labeler.isBGRLUTOk());
+    EXPECT_TRUE (labeler.setColorRanges(ranges, true));
+    EXPECT_TRUE (labeler.isBGRLUTOk());
+
+    cv::Mat hsv, labels, labels_bgr;
+    cv::cvtColor(bgr, hsv, CV_BGR2HSV);
+
+    labeler.label   (hsv, labels);
+    labeler.labelBGR(bgr, labels_bgr);
+
+    // Bit for bit the same as converting the image to HSV first
+    EXPECT_EQ(cv::countNonZero(labels != labels_bgr), 0);
+
+    // Changing the color ranges invalidates the table, unless it is rebuilt
+    ranges[0].H.max = 20;
+    EXPECT_TRUE (labeler.setColorRanges(ranges));
+    EXPECT_FALSE(labeler.isBGRLUTOk());
+
+    labeler.label   (hsv, labels);
+    labeler.labelBGR(bgr, labels_bgr);
+    EXPECT_TRUE(labeler.isBGRLUTOk());
+    EXPECT_EQ(cv::countNonZero(labels != labels_bgr), 0);
+
+    // The joint detection builds the tables when the colors are set, rather than at the first frame
+    cv::Mat img;
+    vector<SegmentedObj*> objs;
+    createScene(9, img, objs);
+
+    hsvLabeling labeling;
+    labeling.use_bgr_lut = true;
+
+    EXPECT_TRUE(setLabelingColors(objs, labeling));
+    EXPECT_EQ  (labeling.labelers.size(), size_t(1));
+    EXPECT_TRUE(labeling.labelers[0].isBGRLUTOk());
+
+    clearScene(objs);
+}
+
+TEST(PerceptionLibTest, testMorphLabels)
+{
+    cv::RNG rng(3);
+
+    // Odd sizes as well, since the borders are handled separately
+    const vector<cv::Size> sizes = {cv::Size(IMG_W, IMG_H), cv::Size(7, 1), cv::Size(1, 7),
+                                    cv::Size(2, 2), cv::Size(1, 1)};
+
+    for (size_t n = 0; n < sizes.size(); ++n)
+    {
+        // Every bit is set with a different density, from isolated pixels to large blobs
+        cv::Mat labels(sizes[n], CV_32SC1);
+
+        for (int r = 0; r < labels.rows; ++r)
+        {
+            for (int c = 0; c < labels.cols; ++c)
+            {
+                uint32_t val = 0;
+
+                for (int b = 0; b < 8; ++b)
+                {
+                    if (rng.uniform(0, 100) < 10 + 10 * b)    { val |= uint32_t(1) << b; }
+                }
+
+                labels.at<uint32_t>(r, c) = val;
+            }
+        }
+
+        for (int it = 1; it <= 3; ++it)
+        {
+            cv::Mat eroded = labels.clone(), dilated = labels.clone(), tmp;
+
+            erodeLabels (eroded,  tmp, it);
+            dilateLabels(dilated, tmp, it);
+
+            for (int b = 0; b < 8; ++b)
+            {
+                cv::Mat mask, ref_e, ref_d, res_e, res_d;
+                hsvLabeler::extract(labels, b, mask);
+
+                ref_e = mask.clone();
+                ref_d = mask.clone();
+
+                for (int i = 0; i < it; ++i)
+                {
+                    cv::erode (ref_e, ref_e, cv::Mat());
+                    cv::dilate(ref_d, ref_d, cv::Mat());
+                }
+
+                hsvLabeler::extract(eroded,  b, res_e);
+                hsvLabeler::extract(dilated, b, res_d);
+
+                EXPECT_EQ(cv::countNonZero(res_e != ref_e), 0) << "Size " << sizes[n] << " bit " << b;
+                EXPECT_EQ(cv::countNonZero(res_d != ref_d), 0) << "Size " << sizes[n] << " bit " << b;
+            }
+        }
+    }
+}
+
+TEST(PerceptionLibTest, testDetectObjectsHSVvsParallel)
+{
+    cv::Mat img, out;
+    vector<SegmentedObj*> objs_s, objs_j;
+
+    createScene(12, img, objs_s);
+    createScene(12, img, objs_j);
+
+    // Some salt and pepper noise within the objects, to make the morphology meaningful
+    cv::Mat noise(img.size(), CV_8UC1);
+    cv::randu(noise, 0, 100);
+    img.setTo(cv::Scalar::all(255), noise == 0);
+    img.setTo(cv::Scalar::all(  0), noise == 1);
+
+    ThreadPool pool(4);
+    vector<cv::Mat>   thres_s, thres_j;
+    vector<ScratchArena> arenas_s, arenas_j;
+    hsvLabeling labeling;
+
+    cv::Mat out_thres_s(img.rows, img.cols, CV_8UC1);
+    cv::Mat out_thres_j(img.rows, img.cols, CV_8UC1);
+
+    // The objects detected one by one and all at once should be the same,
+    // with and without the morphological operations
+    for (int m = 0; m < 2; ++m)
+    {
+        labeling.use_morphology = m == 1;
+        labeling.use_bgr_lut    = false;
+
+        for (size_t i = 0; i < objs_s.size(); ++i)
+        {
+            static_cast<SegmentedObjHSV*>(objs_s[i])->setMorphology(m == 1);
+        }
+
+        out_thres_s.setTo(cv::Scalar::all(0));
+        out_thres_j.setTo(cv::Scalar::all(0));
+
+        EXPECT_TRUE(detectObjectsParallel(objs_s, pool, img, out, out_thres_s, thres_s, arenas_s));
+        EXPECT_TRUE(detectObjectsHSV(objs_j, pool, img, out_thres_j, thres_j, arenas_j, labeling));
+
+        for (size_t i = 0; i < objs_s.size(); ++i)
+        {
+            EXPECT_TRUE(objs_j[i]->isThere());
+            EXPECT_EQ  (objs_s[i]->rect.center, objs_j[i]->rect.center) << "Morphology " << m;
+            EXPECT_EQ  (objs_s[i]->rect.size,   objs_j[i]->rect.size)   << "Morphology " << m;
+        }
+
+        EXPECT_EQ(cv::countNonZero(out_thres_s != out_thres_j), 0);
+    }
+
+    clearScene(objs_s);
+    clearScene(objs_j);
+}
+
+TEST(PerceptionLibTest, testROITracking)
+{
+    cv::Mat img, out;
+    vector<SegmentedObj*> objs;
+
+    createScene(1, img, objs);
+    objs[0]->setROITracking(true, 20, 3);
+
+    cv::Mat out_thres(img.rows, img.cols, CV_8UC1, cv::Scalar::all(0));
+    cv::Rect roi;
+
+    // Before the object is found, the whole image is searched
+    EXPECT_FALSE(objs[0]->getSearchROI(img.size(), roi));
+    EXPECT_EQ   (roi, cv::Rect(0, 0, IMG_W, IMG_H));
+    EXPECT_TRUE (objs[0]->detectObject(img, out, out_thres));
+
+    cv::Point2f center = objs[0]->rect.center;
+
+    // A small motion is tracked within the ROI
+    cv::Mat img_moved(img.size(), img.type(), cv::Scalar::all(0));
+    img(cv::Rect(0, 0, IMG_W - 10, IMG_H - 5)).copyTo(img_moved(cv::Rect(10, 5, IMG_W - 10, IMG_H - 5)));
+
+    EXPECT_TRUE (objs[0]->getSearchROI(img.size(), roi));
+    EXPECT_TRUE (roi.contains(cv::Point(center)));
+    EXPECT_LT   (roi.area(), IMG_W * IMG_H);
+
+    EXPECT_TRUE (objs[0]->detectObject(img_moved, out, out_thres));
+    EXPECT_EQ   (objs[0]->rect.center, center + cv::Point2f(10, 5));
+
+    // A motion bigger than the margin loses the object in the ROI,
+    // and it is re-acquired in the whole image within the same frame
+    img_moved.setTo(cv::Scalar::all(0));
+    img(cv::Rect(0, 0, IMG_W - 300, IMG_H - 200)).copyTo(img_moved(cv::Rect(300, 200, IMG_W - 300, IMG_H - 200)));
+
+    EXPECT_TRUE (objs[0]->detectObject(img_moved, out, out_thres));
+    EXPECT_EQ   (objs[0]->rect.center, center + cv::Point2f(300, 200));
+
+    // A full-frame search is forced every roi_refresh frames
+    int num_roi = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        if (objs[0]->getSearchROI(img.size(), roi))    { ++num_roi; }
+    }
+    EXPECT_LT(num_roi, 8);
+
+    // With the tracking mode disabled, the whole image is always searched
+    objs[0]->setROITracking(false);
+    EXPECT_FALSE(objs[0]->getSearchROI(img.size(), roi));
+
+    clearScene(objs);
+}
+
+TEST(PerceptionLibTest, testPyramid)
+{
+    cv::Mat img, out;
+    vector<SegmentedObj*> objs;
+
+    createScene(8, img, objs);
+
+    cv::Mat out_thres(img.rows, img.cols, CV_8UC1, cv::Scalar::all(0));
+
+    // Detection at full resolution, as a reference
+    vector<cv::RotatedRect> rects;
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        EXPECT_TRUE(objs[i]->detectObject(img, out, out_thres));
+        rects.push_back(objs[i]->rect);
+    }
+
+    // The coarse search only finds the candidate blobs, so the result should be the same
+    for (int l = 1; l <= PYR_MAX_LEVELS; ++l)
+    {
+        for (size_t i = 0; i < objs.size(); ++i)
+        {
+            objs[i]->setPyrLevels(l);
+            EXPECT_EQ  (objs[i]->getPyrLevels(), l);
+            EXPECT_TRUE(objs[i]->detectObject(img, out, out_thres));
+            EXPECT_EQ  (objs[i]->rect.center, rects[i].center);
+            EXPECT_EQ  (objs[i]->rect.size,   rects[i].size);
+        }
+    }
+
+    objs[0]->setPyrLevels(PYR_MAX_LEVELS + 1);
+    EXPECT_EQ(objs[0]->getPyrLevels(), PYR_MAX_LEVELS);
+
+    // Nothing to be found in an empty image
+    cv::Mat img_empty(img.size(), img.type(), cv::Scalar::all(0));
+    EXPECT_FALSE(objs[0]->detectObject(img_empty, out, out_thres));
+    EXPECT_FALSE(objs[0]->isThere());
+
+    clearScene(objs);
+}
+
+TEST(PerceptionLibTest, testDetectObjectsHSV)
+{
+    cv::Mat img, out;
+    vector<SegmentedObj*> objs_ref, objs;
+
+    createScene(8, img, objs_ref);
+    createScene(8, img, objs);
+
+    // Detection of every object on its own at full resolution, as a reference
+    cv::Mat out_thres_ref(img.rows, img.cols, CV_8UC1, cv::Scalar::all(0));
+
+    for (size_t i = 0; i < objs_ref.size(); ++i)
+    {
+        EXPECT_TRUE(objs_ref[i]->detectObject(img, out, out_thres_ref));
+    }
+
+    ThreadPool pool(4);
+    vector<cv::Mat>   worker_thres;
+    vector<ScratchArena>    arenas;
+    hsvLabeling           labeling;
+
+    cv::Mat out_thres(img.rows, img.cols, CV_8UC1);
+
+    // The objects keep their own level of the pyramid (i.e. 0), and only the labeling
+    // knows the level the labels are at: the result should be the same at every level
+    for (int lut = 0; lut < 2; ++lut)
+    {
+        for (int l = 0; l <= PYR_MAX_LEVELS; ++l)
+        {
+            labeling.use_bgr_lut = lut == 1;
+            labeling.pyr_levels  = l;
+
+            out_thres.setTo(cv::Scalar::all(0));
+            EXPECT_TRUE(detectObjectsHSV(objs, pool, img, out_thres, worker_thres, arenas, labeling));
+
+            for (size_t i = 0; i < objs.size(); ++i)
+            {
+                EXPECT_EQ  (objs[i]->getPyrLevels(), 0);
+                EXPECT_TRUE(objs[i]->isThere());
+                EXPECT_EQ  (objs[i]->rect.center, objs_ref[i]->rect.center);
+                EXPECT_EQ  (objs[i]->rect.size,   objs_ref[i]->rect.size);
+            }
+
+            EXPECT_EQ(cv::countNonZero(out_thres != out_thres_ref), 0);
+        }
+    }
+
+    clearScene(objs);
+    clearScene(objs_ref);
+
+    // Tracking mode on top of the pyramid mode
+    createScene(1, img, objs);
+    objs[0]->setROITracking(true, 20, 3);
+    labeling.pyr_levels = PYR_MAX_LEVELS;
+
+    EXPECT_TRUE(detectObjectsHSV(objs, pool, img, out_thres, worker_thres, arenas, labeling));
+
+    cv::Point2f center = objs[0]->rect.center;
+
+    // A small motion is tracked within the ROI...
+    cv::Mat img_moved(img.size(), img.type(), cv::Scalar::all(0));
+    img(cv::Rect(0, 0, IMG_W - 10, IMG_H - 5)).copyTo(img_moved(cv::Rect(10, 5, IMG_W - 10, IMG_H - 5)));
+
+    EXPECT_TRUE(detectObjectsHSV(objs, pool, img_moved, out_thres, worker_thres, arenas, labeling));
+    EXPECT_EQ  (objs[0]->rect.center, center + cv::Point2f(10, 5));
+
+    // ... while a bigger one is re-acquired through the coarse labels in the same frame
+    img_moved.setTo(cv::Scalar::all(0));
+    img(cv::Rect(0, 0, IMG_W - 300, IMG_H - 200)).copyTo(img_moved(cv::Rect(300, 200, IMG_W - 300, IMG_H - 200)));
+
+    EXPECT_TRUE(detectObjectsHSV(objs, pool, img_moved, out_thres, worker_thres, arenas, labeling));
+    EXPECT_EQ  (objs[0]->rect.center, center + cv::Point2f(300, 200));
+
+    // Nothing to be found in an empty image
+    img_moved.setTo(cv::Scalar::all(0));
+    EXPECT_FALSE(detectObjectsHSV(objs, pool, img_moved, out_thres, worker_thres, arenas, labeling));
+    EXPECT_FALSE(objs[0]->isThere());
+
+    clearScene(objs);
+}
+
+TEST(PerceptionLibTest, benchmarkPyramid)
+{
+    ros::Time::init();
+
+    const int num_frames = 50;
+
+    cv::Mat img, out;
+    vector<SegmentedObj*> objs;
+
+    createScene(8, img, objs);
+
+    // Some salt and pepper noise, to make the cleanup of the images meaningful
+    cv::Mat noise(img.size(), CV_8UC1);
+    cv::randu(noise, 0, 100);
+    img.setTo(cv::Scalar::all(255), noise == 0);
+    img.setTo(cv::Scalar::all(  0), noise == 1);
+
+    cv::Mat out_thres(img.rows, img.cols, CV_8UC1);
+
+    vector<cv::RotatedRect> rects(objs.size());
+
+    for (int l = 0; l <= PYR_MAX_LEVELS; ++l)
+    {
+        double err = 0.0;
+
+        ros::WallTime start = ros::WallTime::now();
+
+        for (int f = 0; f < num_frames; ++f)
+        {
+            out_thres.setTo(cv::Scalar::all(0));
+
+            for (size_t i = 0; i < objs.size(); ++i)
+            {
+                objs[i]->setPyrLevels(l);
+                EXPECT_TRUE(objs[i]->detectObject(img, out, out_thres));
+            }
+        }
+
+        double time = (ros::WallTime::now() - start).toSec();
+
+        // Accuracy is measured against the full-resolution detection
+        for (size_t i = 0; i < objs.size(); ++i)
+        {
+            if (l == 0)    { rects[i] = objs[i]->rect; }
+
+            err = max(err, double(cv::norm(objs[i]->rect.center - rects[i].center)));
+        }
+
+        printf("[ PerceptionLibTest ] Pyramid levels %i: %g [ms/frame], max center error %g [px]\n",
+                                                 l, time * 1e3 / num_frames, err);
+    }
+
+    clearScene(objs);
+}
+
+TEST(PerceptionLibTest, testObjectKF)
+{
+    // An object moving at constant velocity, seen at 30 Hz with 5 mm of noise
+    cv::RNG rng(1);
+    vector<geometry_msgs::Pose> poses;
+    vector<ros::Time>          stamps;
+
+    for (int i = 0; i < 60; ++i)
+    {
+        double t = 100.0 + i / 30.0;
+
+        geometry_msgs::Pose p;
+        p.position.x    =  0.10 * (t - 100.0) + rng.gaussian(0.005);
+        p.position.y    = -0.05 * (t - 100.0) + rng.gaussian(0.005);
+        p.position.z    =  0.50               + rng.gaussian(0.005);
+        p.orientation.w =  1.0;
+
+        poses.push_back(p);
+        stamps.push_back(ros::Time(t));
+    }
+
+    // The same measurements, received in order and pairwise swapped (after the first one)
+    ObjectKF kf_ord, kf_swp;
+    geometry_msgs::Pose pose_ord, pose_swp;
+
+    EXPECT_FALSE(kf_ord.predict(stamps[0], pose_ord));
+    EXPECT_TRUE (kf_ord.update(poses[0], stamps[0]));
+    EXPECT_TRUE (kf_swp.update(poses[0], stamps[0]));
+
+    for (size_t i = 1; i + 1 < poses.size(); i += 2)
+    {
+        EXPECT_TRUE(kf_ord.update(poses[i    ], stamps[i    ]));
+        EXPECT_TRUE(kf_ord.update(poses[i + 1], stamps[i + 1]));
+
+        EXPECT_TRUE(kf_swp.update(poses[i + 1], stamps[i + 1]));
+        EXPECT_TRUE(kf_swp.update(poses[i    ], stamps[i    ]));
+    }
+
+    // Late messages are re-filtered in order, so the estimates are the same
+    ros::Time t_query = stamps.back() + ros::Duration(0.05);
+
+    EXPECT_TRUE (kf_ord.predict(t_query, pose_ord));
+    EXPECT_TRUE (kf_swp.predict(t_query, pose_swp));
+    EXPECT_NEAR (pose_ord.position.x, pose_swp.position.x, 1e-9);
+    EXPECT_NEAR (pose_ord.position.y, pose_swp.position.y, 1e-9);
+
+    // The prediction compensates for the time elapsed since the last image
+    double t_elap = (t_query - stamps[0]).toSec();
+    EXPECT_NEAR (pose_ord.position.x,  0.10 * t_elap, 0.01);
+    EXPECT_NEAR (pose_ord.position.y, -0.05 * t_elap, 0.01);
+    EXPECT_NEAR (pose_ord.position.z,  0.50,          0.01);
+    EXPECT_NEAR (kf_ord.getVelocity()[0], 0.10, 0.05);
+
+    // Duplicates and messages older than the history are discarded
+    EXPECT_FALSE(kf_ord.update(poses.back(), stamps.back()));
+    EXPECT_FALSE(kf_ord.update(poses[0],     stamps[0]));
+    EXPECT_EQ   (kf_ord.getLastStamp(),      stamps.back());
+
+    // Stale filters do not predict anything
+    EXPECT_FALSE(kf_ord.predict(stamps.back() + ros::Duration(1.0), pose_ord));
+
+    ObjectTracker tracker;
+    EXPECT_TRUE (tracker.update(24, poses[0], stamps[0]));
+    EXPECT_TRUE (tracker.predict(24, stamps[0], pose_ord));
+    EXPECT_FALSE(tracker.predict(25, stamps[0], pose_ord));
+
+    tracker.clear();
+    EXPECT_FALSE(tracker.predict(24, stamps[0], pose_ord));
+}
+
+/**
+ * Projects the corners of a rectangle (ordered as in planarRectPose) into the image
+ */
+void projectRect(double _w, double _h, const cv::Matx33d& _rot, const cv::Vec3d& _tran,
+                 const cv::Matx33d& _cam_mat, cv::Point2f _img_pts[4])
+{
+    const double obj_pts[4][2] = {{-_w/2, -_h/2}, {-_w/2, +_h/2},
+                                  {+_w/2, +_h/2}, {+_w/2, -_h/2}};
+
+    for (int i = 0; i < 4; ++i)
+    {
+        cv::Vec3d p = _cam_mat * (_rot * cv::Vec3d(obj_pts[i][0], obj_pts[i][1], 0.0) + _tran);
+        _img_pts[i] = cv::Point2f(float(p[0] / p[2]), float(p[1] / p[2]));
+    }
+}
+
+TEST(PerceptionLibTest, testPlanarRectPose)
+{
+    cv::Matx33d cam_mat(500.0,   0.0, IMG_W/2,
+                          0.0, 500.0, IMG_H/2,
+                          0.0,   0.0,     1.0);
+
+    cv::Matx33d rot_true;
+    cv::Rodrigues(cv::Vec3d(0.2, -0.3, 0.5), rot_true);
+    cv::Vec3d tran_true(0.05, -0.02, 0.6);
+
+    cv::Point2f img_pts[4];
+    projectRect(0.06, 0.04, rot_true, tran_true, cam_mat, img_pts);
+
+    cv::Matx33d rot;
+    cv::Vec3d  tran;
+    EXPECT_TRUE(planarRectPose(img_pts, 0.06, 0.04, cam_mat, rot, tran));
+    EXPECT_LT(cv::norm(rot - rot_true,  cv::NORM_INF), 1e-3);
+    EXPECT_LT(cv::norm(tran - tran_true, cv::NORM_INF), 1e-4);
+
+    // With the corners shifted by two, the pose is rotated by 180 deg around the normal...
+    cv::Point2f img_pts_flip[4] = {img_pts[2], img_pts[3], img_pts[0], img_pts[1]};
+    cv::Matx33d flip(-1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, 1.0);
+
+    EXPECT_TRUE(planarRectPose(img_pts_flip, 0.06, 0.04, cam_mat, rot, tran));
+    EXPECT_LT(cv::norm(rot - rot_true * flip, cv::NORM_INF), 1e-3);
+    EXPECT_LT(cv::norm(tran - tran_true,     cv::NORM_INF), 1e-4);
+
+    // ... unless the previous pose is given as a guess
+    rot = rot_true;
+    EXPECT_TRUE(planarRectPose(img_pts_flip, 0.06, 0.04, cam_mat, rot, tran, true));
+    EXPECT_LT(cv::norm(rot - rot_true,  cv::NORM_INF), 1e-3);
+
+    // Degenerate corners are rejected
+    cv::Point2f img_pts_deg[4] = {img_pts[0], img_pts[0], img_pts[0], img_pts[0]};
+    EXPECT_FALSE(planarRectPose(img_pts_deg, 0.06, 0.04, cam_mat, rot, tran));
+
+    // And so is the zero-height rectangle of a blob that is one pixel tall
+    cv::Mat mask(IMG_H, IMG_W, CV_8UC1, cv::Scalar::all(0));
+    cv::line(mask, cv::Point(100, 200), cv::Point(100 + 2 * AREA_THRES, 200), cv::Scalar::all(255));
+
+    BlobExtractor blobs;
+    blobs.extract(mask);
+    ASSERT_EQ(blobs.countBlobs(AREA_THRES), size_t(1));
+
+    cv::RotatedRect rect = cv::minAreaRect(blobs.getHullPoints(AREA_THRES));
+    EXPECT_EQ(min(rect.size.width, rect.size.height), 0.0f);
+
+    rect.points(img_pts_deg);
+    EXPECT_FALSE(planarRectPose(img_pts_deg, 0.06, 0.04, cam_mat, rot, tran));
+    EXPECT_FALSE(planarRectPose(img_pts_deg, 0.06, 0.04, cam_mat, rot, tran, true));
+}
+
+TEST(PerceptionLibTest, testSegmentedObjSnapshot)
+{
+    cv::Mat img, out;
+    vector<SegmentedObj*> objs;
+
+    createScene(2, img, objs);
+
+    cv::Mat out_thres(img.rows, img.cols, CV_8UC1, cv::Scalar::all(0));
+    EXPECT_TRUE(objs[0]->detectObject(img, out, out_thres));
+    objs[0]->setName("an_object_whose_name_does_not_fit_in_a_small_string");
+    objs[0]->rot  = cv::Matx33d(0, -1, 0, 1, 0, 0, 0, 0, 1);
+    objs[0]->tran = cv::Vec3d(0.1, -0.2, 0.7);
+
+    // The snapshot carries only what is needed to draw the object
+    SegmentedObjSnapshot snap;
+    objs[0]->snapshot(snap);
+
+    EXPECT_EQ(snap.name,        objs[0]->getName());
+    EXPECT_EQ(snap.rect.center, objs[0]->rect.center);
+    EXPECT_EQ(snap.rect.size,   objs[0]->rect.size);
+    EXPECT_EQ(snap.rect.angle,  objs[0]->rect.angle);
+    EXPECT_EQ(snap.rot,         objs[0]->rot);
+    EXPECT_EQ(snap.tran,        objs[0]->tran);
+
+    // Refilling a snapshot with a shorter name reuses its storage
+    const char* name_data = snap.name.data();
+    objs[1]->snapshot(snap);
+
+    EXPECT_EQ(snap.name,        objs[1]->getName());
+    EXPECT_EQ(snap.name.data(), name_data);
+
+    cv::Mat cam_mat = (cv::Mat_<float>(3, 3) << 600, 0, IMG_W / 2, 0, 600, IMG_H / 2, 0, 0, 1);
+    cv::Mat img_out(img.size(), CV_8UC3, cv::Scalar::all(0));
+    snap.draw(img_out, cam_mat, cv::Mat());
+    EXPECT_GT(cv::countNonZero(img_out.reshape(1)), 0);
+
+    clearScene(objs);
+}
+
+TEST(PerceptionLibTest, benchmarkPlanarRectPose)
+{
+    ros::Time::init();
+
+    const int num_poses = 2000;
+
+    cv::Matx33d cam_mat(500.0,   0.0, IMG_W/2,
+                          0.0, 500.0, IMG_H/2,
+                          0.0,   0.0,     1.0);
+
+    cv::Mat cam_mat_32f;
+    cv::Mat(cam_mat).convertTo(cam_mat_32f, CV_32F);
+
+    vector<cv::Point2f> img_pts(4 * num_poses);
+
+    for (int n = 0; n < num_poses; ++n)
+    {
+        cv::Matx33d rot;
+        cv::Rodrigues(cv::Vec3d(0.3 * sin(0.01 * n), 0.2 * cos(0.02 * n), 0.001 * n), rot);
+        projectRect(0.06, 0.04, rot, cv::Vec3d(0.0001 * n - 0.1, 0.05, 0.6), cam_mat, &img_pts[4 * n]);
+    }
+
+    // Previous path: generic solvePnP on freshly allocated matrices, and conversions to float
+    cv::Mat Rvec, Tvec, rot_pnp(3, 3, CV_32FC1);
+
+    ros::WallTime start = ros::WallTime::now();
+
+    for (int n = 0; n < num_poses; ++n)
+    {
+        cv::Mat ImgPoints(4, 2, CV_32FC1), ObjPoints(4, 3, CV_32FC1);
+
+        for (int j = 0; j < 4; ++j)
+        {
+            ImgPoints.at<float>(j,0) = img_pts[4 * n + j].x;
+            ImgPoints.at<float>(j,1) = img_pts[4 * n + j].y;
+        }
+
+        ObjPoints.at<float>(0,0)=-0.03; ObjPoints.at<float>(0,1)=-0.02; ObjPoints.at<float>(0,2)=0;
+        ObjPoints.at<float>(1,0)=-0.03; ObjPoints.at<float>(1,1)=+0.02; ObjPoints.at<float>(1,2)=0;
+        ObjPoints.at<float>(2,0)=+0.03; ObjPoints.at<float>(2,1)=+0.02; ObjPoints.at<float>(2,2)=0;
+        ObjPoints.at<float>(3,0)=+0.03; ObjPoints.at<float>(3,1)=-0.02; ObjPoints.at<float>(3,2)=0;
+
+        cv::Mat raux, taux;
+        cv::solvePnP(ObjPoints, ImgPoints, cam_mat_32f, cv::Mat(), raux, taux);
+        raux.convertTo(Rvec, CV_32F);
+        taux.convertTo(Tvec, CV_32F);
+        cv::Rodrigues(Rvec, rot_pnp);
+    }
+
+    double time_pnp = (ros::WallTime::now() - start).toSec();
+
+    // Closed-form planar path, warm-started from the previous pose
+    cv::Matx33d rot = cv::Matx33d::eye();
+    cv::Vec3d  tran;
+    bool has_pose = false;
+
+    start = ros::WallTime::now();
+
+    for (int n = 0; n < num_poses; ++n)
+    {
+        has_pose = planarRectPose(&img_pts[4 * n], 0.06, 0.04, cam_mat, rot, tran, has_pose);
+    }
+
+    double time_planar = (ros::WallTime::now() - start).toSec();
+
+    // The two paths agree on the last pose
+    rot_pnp.convertTo(rot_pnp, CV_64F);
+    double max_diff = cv::norm(cv::Mat(rot) - rot_pnp, cv::NORM_INF);
+
+    EXPECT_TRUE(has_pose);
+    EXPECT_LT(max_diff, 1e-2);
+
+    printf("[ PerceptionLibTest ] solvePnP %g [us/pose], planar %g [us/pose]\n",
+           time_pnp * 1e6 / num_poses, time_planar * 1e6 / num_poses);
+}
+
+/**
+ * Gets the data pointers of all the buffers of a set of scratch arenas
+ */
+vector<const uchar*> arenaData(const vector<ScratchArena>& _arenas, const cv::Size& _size)
+{
+    vector<const uchar*> res;
+
+    for (size_t w = 0; w < _arenas.size(); ++w)
+    {
+        res.push_back(_arenas[w].bgr   (_size).data);
+        res.push_back(_arenas[w].hsv   (_size).data);
+        res.push_back(_arenas[w].thres (_size).data);
+        res.push_back(_arenas[w].tmp   (_size).data);
+        res.push_back(_arenas[w].labels(_size).data);
+        res.push_back(_arenas[w].ltmp  (_size).data);
+    }
+
+    return res;
+}
+
+/**
+ * Gets the data pointers of the per-worker thresholded images and of the shared
+ * buffers of the joint detection (see detectObjectsHSV)
+ */
+vector<const uchar*> frameData(const vector<cv::Mat>& _worker_thres, const hsvLabeling& _labeling)
+{
+    vector<const uchar*> res;
+
+    for (size_t w = 0; w < _worker_thres.size(); ++w)    { res.push_back(_worker_thres[w].data); }
+
+    res.push_back(_labeling.img_hsv.data);
+    res.push_back(_labeling.img_labels.data);
+    res.push_back(_labeling.img_tmp.data);
+    res.push_back(_labeling.img_coarse.data);
+
+    return res;
+}
+
+TEST(PerceptionLibTest, testNoAllocations)
+{
+    cv::Mat img, out;
+    vector<SegmentedObj*> objs;
+
+    createScene(8, img, objs);
+
+    ThreadPool pool(4);
+    vector<cv::Mat>   worker_thres;
+    vector<ScratchArena>    arenas;
+    hsvLabeling           labeling;
+
+    cv::Mat out_thres(img.rows, img.cols, CV_8UC1);
+
+    // OpenCV runs its own functions serially, so that only the perception loop is measured
+    int num_cv_threads = cv::getNumThreads();
+    cv::setNumThreads(0);
+
+    CountingMatAllocator mat_allocator;
+    cv::MatAllocator *prev_allocator = cv::Mat::getDefaultAllocator();
+    cv::Mat::setDefaultAllocator(&mat_allocator);
+
+    // Modes 0-1: every object on its own, with the full-frame search first, and then
+    // with ROI tracking on top of the pyramid mode (which uses views of the scratch buffers
+    // of different sizes). Modes 2-3: all the objects at once, from the BGR lookup table
+    // at full resolution, and then from HSV at the coarse scale, with the morphology
+    for (int mode = 0; mode < 4; ++mode)
+    {
+        bool tracking = mode == 1 || mode == 3;
+
+        for (size_t i = 0; i < objs.size(); ++i)
+        {
+            objs[i]->setROITracking(tracking);
+            objs[i]->setPyrLevels  (tracking? 1 : 0);
+        }
+
+        labeling.pyr_levels     = mode == 3? 1 : 0;
+        labeling.use_bgr_lut    = mode == 2;
+        labeling.use_morphology = mode == 3;
+
+        auto detect = [&]()
+        {
+            out_thres.setTo(cv::Scalar::all(0));
+
+            if (mode < 2)
+            {
+                return detectObjectsParallel(objs, pool, img, out, out_thres, worker_thres, arenas);
+            }
+
+            return detectObjectsHSV(objs, pool, img, out_thres, worker_thres, arenas, labeling);
+        };
+
+        // The first frames allocate the buffers, and grow the vectors to their steady size
+        for (int i = 0; i < 3; ++i)    { EXPECT_TRUE(detect()); }
+
+        vector<const uchar*> arena_data = arenaData(arenas, img.size());
+        vector<const uchar*> frame_data = frameData(worker_thres, labeling);
+
+        bool res = true;
+        const int num_frames = 10;
+
+        num_allocs     =    0;
+        num_mat_allocs =    0;
+        num_img_allocs =    0;
+        count_allocs   = true;
+
+        for (int i = 0; i < num_frames; ++i)    { res = detect() && res; }
+
+        count_allocs = false;
+
+        EXPECT_TRUE(res) << "Mode " << mode;
+
+        // No image is allocated, not even a view of the scratch buffers that is reallocated
+        // by a function because of a mismatch in its size or type
+        EXPECT_EQ(num_img_allocs.load(), size_t(0)) << "Mode " << mode;
+
+        // cv::minAreaRect still allocates the convex hull of the points it is given (and its
+        // conversion to float), which is a few points per object. Everything else that goes
+        // through operator new is the header of one of those
+        EXPECT_LE(num_mat_allocs.load(), size_t(2 * objs.size() * num_frames)) << "Mode " << mode;
+        EXPECT_LE(num_allocs.load(),     num_mat_allocs.load())                << "Mode " << mode;
+
+        // All the buffers are still the same ones
+        EXPECT_TRUE(arenaData(arenas, img.size())   == arena_data) << "Mode " << mode;
+        EXPECT_TRUE(frameData(worker_thres, labeling) == frame_data) << "Mode " << mode;
+
+        for (size_t w = 0; w < arenas.size(); ++w)
+        {
+            EXPECT_FALSE(arenas[w].reserve(img.size()));
+        }
+    }
+
+    cv::Mat::setDefaultAllocator(prev_allocator);
+    cv::setNumThreads(num_cv_threads);
+
+    // The buffers are reallocated only if the resolution changes
+    EXPECT_TRUE (arenas[0].reserve(cv::Size(IMG_W / 2, IMG_H / 2)));
+    EXPECT_FALSE(arenas[0].reserve(cv::Size(IMG_W / 2, IMG_H / 2)));
+
+    clearScene(objs);
+}
+
+TEST(PerceptionLibTest, benchmarkDetectObjectsParallel)
+{
+    ros::Time::init();
+
+    const int num_frames = 50;
+    const vector<size_t> num_objs = {1, 2, 4, 8, 12};
+
+    ThreadPool serial(0), parallel(4);
+
+    for (size_t n = 0; n < num_objs.size(); ++n)
+    {
+        cv::Mat img, out;
+        vector<SegmentedObj*> objs;
+        vector<cv::Mat> worker_thres;
+        vector<ScratchArena> arenas;
+
+        createScene(num_objs[n], img, objs);
+
+        cv::Mat out_thres(img.rows, img.cols, CV_8UC1);
+
+        double time[2] = {0.0, 0.0};
+        ThreadPool *pools[2] = {&serial, &parallel};
+
+        for (int p = 0; p < 2; ++p)
+        {
+            ros::WallTime start = ros::WallTime::now();
+
+            for (int i = 0; i < num_frames; ++i)
+            {
+                out_thres.setTo(cv::Scalar::all(0));
+                EXPECT_TRUE(detectObjectsParallel(objs, *pools[p], img, out, out_thres,
+                                                  worker_thres, arenas));
+            }
+
+            time[p] = (ros::WallTime::now() - start).toSec();
+        }
+
+        printf("[ PerceptionLibTest ] %2zu objects: serial %g [ms/frame], %zu workers %g [ms/frame]\n",
+                         num_objs[n], time[0] * 1e3 / num_frames,
+                     parallel.size(), time[1] * 1e3 / num_frames);
+
+        clearScene(objs);
+    }
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
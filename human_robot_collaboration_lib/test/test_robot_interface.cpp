@@ -143,6 +143,156 @@ TEST(RobotInterfaceTest, testJointStatesCb)
     EXPECT_EQ(ri.getJointStates().velocity, msg.velocity);
 }
 
+// Unit test for the (preallocated) joint commands
+TEST(RobotInterfaceTest, testJointCommands)
+{
+    RobotInterface ri("robot", "left");
+
+    // Names and commands are overwritten, so the same JointCommand can be reused
+    intera_core_msgs::JointCommand cmd;
+    ri.setJointNames(cmd);
+    ri.setJointNames(cmd);
+    ri.setJointCommands(0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, cmd);
+    ri.setJointCommands(1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7, cmd);
+
+    ASSERT_EQ(cmd.names.size(),    size_t(NUM_JOINTS));
+    ASSERT_EQ(cmd.position.size(), size_t(NUM_JOINTS));
+
+    for (int i = 0; i < NUM_JOINTS; ++i)
+    {
+        EXPECT_EQ(cmd.names[i], ri.getLimb() + "_j" + toString(i));
+        EXPECT_DOUBLE_EQ(cmd.position[i], 1.1 + 0.1 * i);
+    }
+
+    // Without joint states, no configuration can be reached
+    Eigen::VectorXd conf = Eigen::VectorXd::Constant(NUM_JOINTS, 0.0);
+    EXPECT_FALSE(ri.isConfigurationReached(conf));
+    EXPECT_FALSE(ri.isConfigurationReached(cmd));
+
+    ros::NodeHandle nh("robot_interface_tester");
+    ros::Publisher pub = nh.advertise<sensor_msgs::JointState>("/robot/joint_states",
+                                                                  SUBSCRIBER_BUFFER);
+
+    sensor_msgs::JointState msg;
+    msg.name     = cmd.names;
+    msg.position = cmd.position;
+    msg.velocity = std::vector<double>(NUM_JOINTS, 0.0);
+
+    ros::Rate loop_rate(10);
+    while(ros::ok() && (ri.getJointStates().name.size() == 0))
+    {
+        pub.publish(msg);
+
+        ros::spinOnce();
+        loop_rate.sleep();
+    }
+
+    EXPECT_TRUE(ri.isConfigurationReached(cmd, "strict"));
+
+    for (int i = 0; i < NUM_JOINTS; ++i)    { conf[i] = cmd.position[i]; }
+    EXPECT_TRUE (ri.isConfigurationReached(conf, "strict"));
+
+    // A difference of ~1.1 degrees is loose, but not strict
+    conf[3] += 0.015;
+    EXPECT_TRUE (ri.isConfigurationReached(conf,  "loose"));
+    EXPECT_FALSE(ri.isConfigurationReached(conf, "strict"));
+
+    cmd.position[3] += 0.05;
+    EXPECT_FALSE(ri.isConfigurationReached(cmd,   "loose"));
+
+    // Unknown joint names are never reached
+    cmd.names[0] = "foo";
+    EXPECT_FALSE(ri.isConfigurationReached(cmd,   "loose"));
+}
+
+// Unit test for JointStateDecoder
+TEST(RobotInterfaceTest, testJointStateDecoder)
+{
+    JointStateDecoder dec;
+
+    EXPECT_TRUE (dec.addLimb("left"));
+    EXPECT_TRUE (dec.addLimb("right"));
+    EXPECT_FALSE(dec.addLimb("left"));
+
+    // Both limbs in the same message, interleaved with other joints
+    sensor_msgs::JointState msg;
+    msg.name = {"head_pan", "right_j0", "left_j0", "right_j1", "left_j1", "right_j2",
+                "left_j2",  "right_j3", "left_j3", "right_j4", "left_j4", "right_j5",
+                "left_j5",  "right_j6", "left_j6"};
+
+    for (size_t i = 0; i < msg.name.size(); ++i)
+    {
+        msg.position.push_back(     double(i));
+        msg.velocity.push_back(10.0*double(i));
+    }
+
+    std::array<double, NUM_JOINTS> pos, vel;
+
+    EXPECT_TRUE(dec.decode(msg, "left", pos, vel));
+    for (size_t i = 0; i < NUM_JOINTS; ++i)
+    {
+        EXPECT_EQ(pos[i],      double(2*i+2));
+        EXPECT_EQ(vel[i], 10.0*double(2*i+2));
+    }
+
+    EXPECT_TRUE(dec.decode(msg, "right", pos, vel));
+    for (size_t i = 0; i < NUM_JOINTS; ++i)
+    {
+        EXPECT_EQ(pos[i],      double(2*i+1));
+        EXPECT_EQ(vel[i], 10.0*double(2*i+1));
+    }
+
+    // Same size, different layout: the decoder should notice it
+    std::swap(msg.name[1], msg.name[2]);
+    EXPECT_TRUE(dec.decode(msg, "left", pos, vel));
+    EXPECT_EQ(pos[0], 1.0);
+    EXPECT_TRUE(dec.decode(msg, "right", pos, vel));
+    EXPECT_EQ(pos[0], 2.0);
+
+    // Messages without velocities are still decoded
+    msg.velocity.clear();
+    EXPECT_TRUE(dec.decode(msg, "left", pos, vel));
+    EXPECT_EQ(vel[0], 0.0);
+
+    // Messages that do not carry the whole limb are discarded
+    sensor_msgs::JointState gripper;
+    gripper.name     = {"right_gripper_l_finger_joint", "right_j0"};
+    gripper.position = {0.01, 0.5};
+    EXPECT_FALSE(dec.decode(gripper, "right", pos, vel));
+    EXPECT_EQ(pos[0], 1.0);
+
+    // ... and they do not replace the layout, so the full messages that
+    // are interleaved with them are decoded without resolving it again
+    sensor_msgs::JointState other;
+    other.name     = {"left_gripper_l_finger_joint"};
+    other.position = {0.02};
+
+    unsigned long num_resolves = dec.getNumResolves();
+
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_FALSE(dec.decode(gripper, "right", pos, vel));
+        EXPECT_FALSE(dec.decode(other,    "left", pos, vel));
+        EXPECT_TRUE (dec.decode(msg,     "right", pos, vel));
+        EXPECT_EQ   (pos[0], 2.0);
+        EXPECT_TRUE (dec.decode(msg,      "left", pos, vel));
+        EXPECT_EQ   (pos[0], 1.0);
+    }
+
+    EXPECT_EQ(num_resolves, dec.getNumResolves());
+
+    // A message with more names, but the same positions for the joints, is decoded as is
+    sensor_msgs::JointState longer = msg;
+    longer.name.push_back("torso_t0");
+    longer.position.push_back(100.0);
+    EXPECT_TRUE(dec.decode(longer, "left", pos, vel));
+    EXPECT_EQ  (num_resolves, dec.getNumResolves());
+
+    // An unregistered limb is registered on the fly
+    msg.name[0] = "head_j0";
+    EXPECT_FALSE(dec.decode(msg, "head", pos, vel));
+}
+
 // Unit test for cuffLowerCb
 TEST(RobotInterfaceTest, testCuffLowerCb)
 {
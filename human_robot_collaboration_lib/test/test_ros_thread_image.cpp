@@ -63,17 +63,15 @@ public:
 
     void internalThread()
     {
+        unsigned long img_seq = 0;
+        cv_bridge::CvImageConstPtr img_ptr;
+
         while(ros::ok() && not isClosing())
         {
-            cv::Mat img_in;
-
-            if (not img_empty)
+            if (getNewImage(img_seq, img_ptr))
             {
                 // ROS_INFO("Processing image");
-                {
-                    std::lock_guard<std::mutex> lock(mutex_img);
-                    img_in=curr_img;
-                }
+                const cv::Mat& img_in = img_ptr->image;
 
                 // Convert image to black and white
                 cv::Mat gray;
@@ -87,7 +85,8 @@ public:
                 }
                 else
                 {
-                    gray = img_in;
+                    // findContours modifies its input, and the image is shared
+                    gray = img_in.clone();
                 }
 
                 // Find contours
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 
 #include "robot_utils/utils.h"
+#include "robot_utils/rt_loop.h"
+#include "robot_utils/thread_pool.h"
 
 using namespace std;
 
@@ -172,6 +174,98 @@ TEST(UtilsLib, misc)
     EXPECT_EQ(quat.w,    01.001);
 }
 
+TEST(UtilsLib, RTLoop)
+{
+    RTLoop loop(1000.0);
+
+    EXPECT_EQ(loop.getPeriod(), 0.001);
+    EXPECT_EQ(loop.getStats().cycles, 0u);
+
+    loop.start();
+
+    for (int i = 0; i < 50; ++i)
+    {
+        // Only one cycle out of two runs the IK, and only one out of five publishes
+        if (i % 2 == 0)    { loop.setIKTime(1e-4 * (i % 4 == 0 ? 1 : 3)); }
+        if (i % 5 == 0)    { loop.setPubTime(2e-4); }
+
+        // The 10th cycle is too long, and it misses its deadline
+        if (i == 10)
+        {
+            double start = RTLoop::now();
+            while (RTLoop::now() - start < 0.0025) {};
+
+            EXPECT_FALSE(loop.sleep());
+        }
+        else
+        {
+            loop.sleep();
+        }
+    }
+
+    RTLoopStats stats = loop.getStats();
+
+    EXPECT_EQ(stats.period,        0.001);
+    EXPECT_EQ(stats.cycles,          50u);
+    EXPECT_GE(stats.overruns,         1u);
+
+    // The IK and publishing means do not count the cycles that did not run them
+    EXPECT_EQ       (stats.ik_cycles,         25u);
+    EXPECT_EQ       (stats.ik_time_last,     1e-4);
+    EXPECT_NEAR     (stats.ik_time_mean, (13 * 1e-4 + 12 * 3e-4) / 25, 1e-9);
+    EXPECT_DOUBLE_EQ(stats.ik_time_max,      3e-4);
+    EXPECT_EQ       (stats.pub_cycles,        10u);
+    EXPECT_NEAR     (stats.pub_time_mean, 2e-4, 1e-9);
+    EXPECT_EQ       (stats.pub_time_max,     2e-4);
+
+    EXPECT_GE(stats.cycle_time_max, 0.0025);
+    EXPECT_GE(stats.jitter_max, stats.jitter_mean);
+
+    unsigned long cnt = 0;
+    for (size_t i = 0; i < stats.hist.size(); ++i)    { cnt += stats.hist[i]; }
+    EXPECT_EQ(cnt, stats.cycles);
+
+    human_robot_collaboration_msgs::CtrlLoopStats msg;
+    stats.toMsg(msg);
+    EXPECT_EQ(msg.cycles,                       50u);
+    EXPECT_EQ(msg.ik_cycles,                    25u);
+    EXPECT_EQ(msg.pub_cycles,                   10u);
+    EXPECT_EQ(msg.hist.size(), size_t(RT_HIST_BINS));
+
+    // Restarting the loop resets the statistics
+    loop.start();
+    EXPECT_EQ(loop.getStats().cycles, 0u);
+}
+
+TEST(UtilsLib, ThreadPool)
+{
+    for (size_t num_workers = 0; num_workers < 4; ++num_workers)
+    {
+        ThreadPool pool(num_workers);
+        EXPECT_EQ(pool.size(), max(num_workers, size_t(1)));
+
+        // Every task is run exactly once, and by a valid worker. Every task
+        // is written only by the worker that runs it, hence without races.
+        vector<int>         tasks(100, 0);
+        vector<size_t> task_worker(tasks.size(), pool.size());
+
+        for (int i = 0; i < 10; ++i)
+        {
+            EXPECT_TRUE(pool.parallelFor(tasks.size(), [&](size_t _task, size_t _worker)
+            {
+                ++tasks[_task];
+                task_worker[_task] = _worker;
+            }));
+
+            for (size_t j = 0; j < task_worker.size(); ++j)    { EXPECT_LT(task_worker[j], pool.size()); }
+        }
+
+        for (size_t i = 0; i < tasks.size(); ++i)    { EXPECT_EQ(tasks[i], 10); }
+
+        EXPECT_TRUE(pool.parallelFor(0, [](size_t, size_t) {}));
+    }
+}
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv)
 {